@@ -59,12 +59,15 @@ up.  Then we're done!
 
 __author__ = 'csilvers@google.com (Craig Silverstein)'
 
+import contextlib
 import difflib
 import argparse
+import multiprocessing
 import os
 import re
 import sys
-from collections import OrderedDict
+from collections import OrderedDict, deque
+from io import StringIO
 
 _EPILOG = """\
 Reads the output from include-what-you-use on stdin -- run with --v=1 (default)
@@ -2093,6 +2096,8 @@ def GetLineSortOrdinal(kind, quoted_includes_first):
     return SORT_ORDER_DEFAULT[kind]
 
 
+# iwyu_fix_includes.cc ports ParseOneFile and FixFileLines, with the
+# routines they call, for iwyu --apply.  Please keep it in sync.
 def FixFileLines(iwyu_record, file_lines, flags, fileinfo):
   """Applies one block of lines from the iwyu output script.
 
@@ -2229,6 +2234,100 @@ def FixOneFile(iwyu_record, file_contents, flags, fileinfo):
   return old_lines, fixed_lines
 
 
+def _FixOneRecord(iwyu_record, flags):
+  """Loads the file named by iwyu_record and computes its fixed contents.
+
+  This does not modify the file; that is left to the caller, so that it
+  can run in a worker process while the parent does all the writing.
+
+  Arguments:
+    iwyu_record: an IWYUOutputRecord for the file to fix.
+    flags: commandline flags, as parsed by argparse.
+
+  Returns:
+    A tuple (fileinfo, old_lines, fixed_lines), or None if the file
+    could not be read or fixed.
+  """
+  try:
+    fileinfo = FileInfo.parse(iwyu_record.filename)
+
+    file_contents = _ReadFile(iwyu_record.filename, fileinfo)
+    if not file_contents:
+      return None
+
+    print(">>> Fixing #includes in '%s'" % iwyu_record.filename)
+    old_lines, fixed_lines = FixOneFile(iwyu_record, file_contents, flags,
+                                        fileinfo)
+    return fileinfo, old_lines, fixed_lines
+  except FixIncludesError as why:
+    print('ERROR: %s - skipping file %s' % (why, iwyu_record.filename))
+  return None
+
+
+def _FixOneRecordInWorker(record_and_flags):
+  """Runs _FixOneRecord in a worker process, capturing what it prints.
+
+  Returns a tuple (result, output), where result is the return value
+  of _FixOneRecord and output is everything it printed, so the parent
+  can print it in record order rather than in completion order.
+  """
+  iwyu_record, flags = record_and_flags
+  output = StringIO()
+  with contextlib.redirect_stdout(output):
+    result = _FixOneRecord(iwyu_record, flags)
+  return result, output.getvalue()
+
+
+def _FixedRecords(iwyu_records, flags):
+  """Yields (iwyu_record, _FixOneRecord result) for each of iwyu_records.
+
+  With flags.jobs > 1, records are fixed concurrently by a pool of worker
+  processes.  Results are still yielded in the order of iwyu_records, and
+  iwyu_records is consumed lazily, so it may be a generator that is still
+  reading iwyu output.  Whatever it prints while producing a record is
+  printed along with that record's result, so the output reads as it
+  does with a single job.
+  """
+  if flags.jobs <= 1:
+    for iwyu_record in iwyu_records:
+      yield iwyu_record, _FixOneRecord(iwyu_record, flags)
+    return
+
+  # Each entry is (what was printed while producing the record, the
+  # record, its pending result).  Records are produced in this thread,
+  # rather than in the pool's task handler, so their output can be held.
+  pending = deque()
+
+  def _Finish(entry):
+    parse_output, iwyu_record, async_result = entry
+    result, output = async_result.get()
+    sys.stdout.write(parse_output)
+    sys.stdout.write(output)
+    return iwyu_record, result
+
+  pool = multiprocessing.Pool(flags.jobs)
+  try:
+    records = iter(iwyu_records)
+    while True:
+      parse_output = StringIO()
+      with contextlib.redirect_stdout(parse_output):
+        iwyu_record = next(records, None)
+      if iwyu_record is None:
+        break
+      async_result = pool.apply_async(_FixOneRecordInWorker,
+                                      ((iwyu_record, flags),))
+      pending.append((parse_output.getvalue(), iwyu_record, async_result))
+      while pending and pending[0][2].ready():
+        yield _Finish(pending.popleft())
+    while pending:
+      yield _Finish(pending.popleft())
+    sys.stdout.write(parse_output.getvalue())
+    pool.close()
+  finally:
+    pool.terminate()
+    pool.join()
+
+
 def FixManyFiles(iwyu_records, flags):
   """Given a list of iwyu_records, fix each file listed in the record.
 
@@ -2241,40 +2340,112 @@ def FixManyFiles(iwyu_records, flags):
     iwyu_records: a collection of IWYUOutputRecord objects holding
       the parsed output of the include-what-you-use script (run at
       verbose level 1 or higher) pertaining to a single source file.
-      iwyu_record.filename indicates what file to edit.
-    flags: commandline flags, as parsed by argparse..
+      iwyu_record.filename indicates what file to edit.  This may be
+      a generator; files are fixed as records are produced.
+    flags: commandline flags, as parsed by argparse..  flags.jobs is
+      the number of files to fix concurrently.
 
   Returns:
     The number of files fixed (as opposed to ones that needed no fixing).
   """
   files_fixed = 0
-  for iwyu_record in iwyu_records:
-    try:
-      fileinfo = FileInfo.parse(iwyu_record.filename)
-
-      file_contents = _ReadFile(iwyu_record.filename, fileinfo)
-      if not file_contents:
-        continue
+  for iwyu_record, result in _FixedRecords(iwyu_records, flags):
+    if not result:
+      continue
 
-      print(">>> Fixing #includes in '%s'" % iwyu_record.filename)
-      old_lines, fixed_lines = FixOneFile(iwyu_record, file_contents, flags, fileinfo)
-      if old_lines == fixed_lines:
-        print("No changes in file %s" % iwyu_record.filename)
-        continue
+    fileinfo, old_lines, fixed_lines = result
+    if old_lines == fixed_lines:
+      print("No changes in file %s" % iwyu_record.filename)
+      continue
 
-      if flags.dry_run:
-        PrintFileDiff(old_lines, fixed_lines)
-      else:
-        _WriteFile(iwyu_record.filename, fileinfo, fixed_lines)
+    if flags.dry_run:
+      PrintFileDiff(old_lines, fixed_lines)
+    else:
+      _WriteFile(iwyu_record.filename, fileinfo, fixed_lines)
 
-      files_fixed += 1
-    except FixIncludesError as why:
-      print('ERROR: %s - skipping file %s' % (why, iwyu_record.filename))
+    files_fixed += 1
 
   print('IWYU edited %d files on your behalf.\n' % files_fixed)
   return files_fixed
 
 
+def _ParseIWYUOutputRecords(f, files_to_process, flags):
+  """Yields each IWYUOutputRecord in f that we have been asked to fix.
+
+  Records for files that are not listed in files_to_process, or that
+  are excluded by --ignore_re or --only_re, are skipped.  Records are
+  yielded as soon as they are parsed, and are not merged.
+  """
+  while True:
+    iwyu_output_parser = IWYUOutputParser()
+    try:
+      iwyu_record = iwyu_output_parser.ParseOneRecord(f, flags)
+      if not iwyu_record:
+        break
+    except FixIncludesError as why:
+      print('ERROR: %s' % why)
+      continue
+    filename = NormalizeFilePath(flags.basedir, iwyu_record.filename)
+    if files_to_process is not None and filename not in files_to_process:
+      print('(skipping %s: not listed on commandline)' % filename)
+      continue
+    if flags.ignore_re and re.search(flags.ignore_re, filename):
+      print('(skipping %s: it matches --ignore_re, which is %s)' % (
+          filename, flags.ignore_re))
+      continue
+    if flags.only_re and not re.search(flags.only_re, filename):
+      print('(skipping %s: it does not match --only_re, which is %s)' % (
+          filename, flags.only_re))
+      continue
+    yield filename, iwyu_record
+
+
+def _IsContentfulRecord(filename, iwyu_record, flags):
+  """Returns true iff the (fully merged) iwyu_record needs to be applied."""
+  if flags.update_comments or iwyu_record.HasContentfulChanges():
+    return True
+  print('(skipping %s: iwyu reports no contentful changes)' % filename)
+  return False
+
+
+def _StreamRecordsToFix(records, flags):
+  """Yields the records to fix as soon as they can be known to be complete.
+
+  A header may be reported by many translation units, and its records
+  must all be merged before it can be fixed, so headers are held back
+  until all of the iwyu output has been read.  Everything else is
+  reported only by the translation unit it is the main file of, and is
+  yielded as soon as its record is parsed.
+
+  Arguments:
+    records: an iterable of (filename, IWYUOutputRecord) pairs.
+    flags: commandline flags, as parsed by argparse.
+  """
+  dispatched_filenames = set()
+  # Maintain sort order by using OrderedDict instead of dict
+  header_records = OrderedDict()  # IWYUOutputRecords keyed by filename
+  for filename, iwyu_record in records:
+    if filename in dispatched_filenames:
+      # The file may already be fixed, so the line numbers in this
+      # record can no longer be trusted.
+      print('ERROR: %s was reported more than once; ignoring all but the'
+            ' first record in --stream mode' % filename)
+      continue
+    if _MayBeHeaderFile(filename):
+      if filename in header_records:
+        header_records[filename].Merge(iwyu_record)
+      else:
+        header_records[filename] = iwyu_record
+      continue
+    dispatched_filenames.add(filename)
+    if _IsContentfulRecord(filename, iwyu_record, flags):
+      yield iwyu_record
+
+  for filename, iwyu_record in header_records.items():
+    if _IsContentfulRecord(filename, iwyu_record, flags):
+      yield iwyu_record
+
+
 def ProcessIWYUOutput(f, files_to_process, flags, cwd):
   """Fix the #include and forward-declare lines as directed by f.
 
@@ -2285,9 +2456,11 @@ def ProcessIWYUOutput(f, files_to_process, flags, cwd):
     f: an iterable object that is the output of include_what_you_use.
     files_to_process: A set of filenames, or None.  If not None, we
        ignore files mentioned in f that are not in files_to_process.
-    flags: commandline flags, as parsed by argparse.  The only flag
-       we use directly is flags.ignore_re, to indicate files not to
-       process; we also pass the flags to other routines.
+    flags: commandline flags, as parsed by argparse.  The only flags
+       we use directly are flags.ignore_re and flags.only_re, to
+       indicate files not to process, and flags.stream, to start fixing
+       files before all of f has been read; we also pass the flags to
+       other routines.
     cwd: the current working directory, externalized for testing.
 
   Returns:
@@ -2299,32 +2472,15 @@ def ProcessIWYUOutput(f, files_to_process, flags, cwd):
     files_to_process = [NormalizeFilePath(cwd, fname)
                         for fname in files_to_process]
 
+  records = _ParseIWYUOutputRecords(f, files_to_process, flags)
+  if flags.stream:
+    return FixManyFiles(_StreamRecordsToFix(records, flags), flags)
+
   # First collect all the iwyu data from stdin.
 
   # Maintain sort order by using OrderedDict instead of dict
   iwyu_output_records = OrderedDict()  # IWYUOutputRecords keyed by filename
-  while True:
-    iwyu_output_parser = IWYUOutputParser()
-    try:
-      iwyu_record = iwyu_output_parser.ParseOneRecord(f, flags)
-      if not iwyu_record:
-        break
-    except FixIncludesError as why:
-      print('ERROR: %s' % why)
-      continue
-    filename = NormalizeFilePath(flags.basedir, iwyu_record.filename)
-    if files_to_process is not None and filename not in files_to_process:
-      print('(skipping %s: not listed on commandline)' % filename)
-      continue
-    if flags.ignore_re and re.search(flags.ignore_re, filename):
-      print('(skipping %s: it matches --ignore_re, which is %s)' % (
-          filename, flags.ignore_re))
-      continue
-    if flags.only_re and not re.search(flags.only_re, filename):
-      print('(skipping %s: it does not match --only_re, which is %s)' % (
-          filename, flags.only_re))
-      continue
-
+  for filename, iwyu_record in records:
     if filename in iwyu_output_records:
       iwyu_output_records[filename].Merge(iwyu_record)
     else:
@@ -2334,15 +2490,11 @@ def ProcessIWYUOutput(f, files_to_process, flags, cwd):
   # seen for them.  (We have to wait until we're all done, since a .h
   # file may have a contentful change when #included from one .cc
   # file, but not another, and we need to have merged them above.)
-  if not flags.update_comments:
-    for filename in iwyu_output_records:
-      if not iwyu_output_records[filename].HasContentfulChanges():
-        print('(skipping %s: iwyu reports no contentful changes)' % filename)
-        # Mark that we're skipping this file by setting the record to None
-        iwyu_output_records[filename] = None
+  contentful_records = [
+      iwyu_record for filename, iwyu_record in iwyu_output_records.items()
+      if _IsContentfulRecord(filename, iwyu_record, flags)]
 
   # Now do all the fixing, and return the number of files modified
-  contentful_records = [ior for ior in iwyu_output_records.values() if ior]
   return FixManyFiles(contentful_records, flags)
 
 
@@ -2467,6 +2619,20 @@ def main(argv):
                       default=False,
                       help='When sorting includes, place quoted ones first')
 
+  parser.add_argument('--stream', action='store_true', default=False,
+                      help=('Start fixing each source file as soon as its'
+                            ' record has been read, instead of reading all'
+                            ' of the iwyu output first.  Headers, which may'
+                            ' be reported by several translation units, are'
+                            ' still fixed only after all output is read.'
+                            ' Every non-header file must be reported at most'
+                            ' once.'))
+  parser.add_argument('--nostream', action='store_false', dest='stream')
+
+  parser.add_argument('-j', '--jobs', type=int, default=1,
+                      help=('Number of files to fix concurrently'
+                            ' [default: 1]'))
+
   parser.add_argument('files', nargs='*', metavar='FILES')
 
   flags = parser.parse_args(argv[1:])
@@ -2484,6 +2650,9 @@ def main(argv):
   if flags.update_comments:
     flags.comments = True
 
+  if flags.jobs < 1:
+    sys.exit('FATAL ERROR: -j must be at least 1')
+
   if flags.sort_only:
     if not files_to_modify:
       sys.exit('FATAL ERROR: -s flag requires a list of filenames')
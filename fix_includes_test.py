@@ -23,6 +23,7 @@ try:
 except ImportError:
     from io import StringIO
 
+import multiprocessing
 import re
 import sys
 # I use unittest instead of googletest to ease opensourcing.
@@ -44,6 +45,8 @@ class FakeFlags(object):
     self.reorder = True
     self.basedir = None
     self.quoted_includes_first = False
+    self.stream = False
+    self.jobs = 1
 
 
 class FixIncludesBase(unittest.TestCase):
@@ -2173,6 +2176,169 @@ template <typename Arg1> ClassTemplate;
     self.RegisterFileContents({'twice.cc': infile})
     self.ProcessAndTest(iwyu_output)
 
+  def testStreamingFixesHeadersLast(self):
+    """Tests --stream fixes source files at once and merges headers first."""
+    source_a = """\
+#include "stream.h"
+#include <notused.h>  ///-
+"""
+    source_b = """\
+///+#include <stdio.h>
+#include "stream.h"
+"""
+    header = """\
+#include "used_only_in_a.h"
+#include <notused.h>  ///-
+"""
+    iwyu_output = """\
+stream.h should add these lines:
+
+stream.h should remove these lines:
+- #include <notused.h>  // lines 2-2
+
+The full include-list for stream.h:
+#include "used_only_in_a.h"  // lines 1-1
+---
+
+stream_a.cc should add these lines:
+
+stream_a.cc should remove these lines:
+- #include <notused.h>  // lines 2-2
+
+The full include-list for stream_a.cc:
+#include "stream.h"  // lines 1-1
+---
+
+stream.h should add these lines:
+
+stream.h should remove these lines:
+- #include "used_only_in_a.h"  // lines 1-1
+- #include <notused.h>  // lines 2-2
+
+The full include-list for stream.h:
+---
+
+stream_b.cc should add these lines:
+#include <stdio.h>
+
+stream_b.cc should remove these lines:
+
+The full include-list for stream_b.cc:
+#include <stdio.h>
+#include "stream.h"  // lines 1-1
+---
+"""
+    self.flags.stream = True
+    self.RegisterFileContents({'stream.h': header,
+                               'stream_a.cc': source_a,
+                               'stream_b.cc': source_b})
+    num_modified_files = fix_includes.ProcessIWYUOutput(
+        StringIO(iwyu_output), None, self.flags, None)
+    self.assertListEqual(self.expected_after_map['stream_a.cc'] +
+                         self.expected_after_map['stream_b.cc'] +
+                         self.expected_after_map['stream.h'],
+                         self.actual_after_contents)
+    self.assertEqual(3, num_modified_files)
+
+  def testStreamingIgnoresRepeatedSourceFile(self):
+    """Tests --stream does not apply a second record for a source file."""
+    infile = """\
+#include <notused.h>  ///-
+#include "used.h"
+"""
+    iwyu_output = """\
+stream_twice.cc should add these lines:
+
+stream_twice.cc should remove these lines:
+- #include <notused.h>  // lines 1-1
+
+The full include-list for stream_twice.cc:
+#include "used.h"  // lines 2-2
+---
+
+stream_twice.cc should add these lines:
+
+stream_twice.cc should remove these lines:
+- #include "used.h"  // lines 2-2
+
+The full include-list for stream_twice.cc:
+#include <notused.h>  // lines 1-1
+---
+"""
+    self.flags.stream = True
+    self.RegisterFileContents({'stream_twice.cc': infile})
+    self.ProcessAndTest(iwyu_output, expected_num_modified_files=1)
+    self.assertIn('ERROR: stream_twice.cc was reported more than once',
+                  self.stdout_stub.getvalue())
+
+  @unittest.skipUnless(multiprocessing.get_start_method() == 'fork',
+                       'test stubs are only visible to forked workers')
+  def testParallelJobs(self):
+    """Tests -j fixes files concurrently, but writes them in record order."""
+    file_contents_map = {}
+    iwyu_output = ''
+    for i in range(8):
+      filename = 'parallel%d.cc' % i
+      file_contents_map[filename] = """\
+#include <notused.h>  ///-
+///+#include <stdio.h>
+#include "used.h"
+"""
+      iwyu_output += """\
+%(f)s should add these lines:
+#include <stdio.h>
+
+%(f)s should remove these lines:
+- #include <notused.h>  // lines 1-1
+
+The full include-list for %(f)s:
+#include <stdio.h>
+#include "used.h"  // lines 2-2
+---
+""" % {'f': filename}
+    self.flags.jobs = 3
+    self.RegisterFileContents(file_contents_map)
+    self.ProcessAndTest(iwyu_output, expected_num_modified_files=8)
+    fixing_order = re.findall(r"^>>> Fixing #includes in '(\S+)'",
+                              self.stdout_stub.getvalue(), re.M)
+    self.assertListEqual(['parallel%d.cc' % i for i in range(8)],
+                         fixing_order)
+
+  @unittest.skipUnless(multiprocessing.get_start_method() == 'fork',
+                       'test stubs are only visible to forked workers')
+  def testParallelJobsStreamMessages(self):
+    """Tests -j --stream prints parse messages in record order."""
+    file_contents_map = {}
+    iwyu_output = ''
+    for i in range(6):
+      filename = 'parallel_stream%d.cc' % i
+      file_contents_map[filename] = """\
+#include <notused.h>  ///-
+#include "used.h"
+"""
+      iwyu_output += """\
+%(f)s should add these lines:
+
+%(f)s should remove these lines:
+- #include <notused.h>  // lines 1-1
+
+The full include-list for %(f)s:
+#include "used.h"  // lines 2-2
+---
+""" % {'f': filename}
+    self.flags.jobs = 3
+    self.flags.stream = True
+    self.flags.ignore_re = 'parallel_stream[25]'
+    self.RegisterFileContents(file_contents_map)
+    self.ProcessAndTest(iwyu_output,
+                        unedited_files=['parallel_stream2.cc',
+                                        'parallel_stream5.cc'],
+                        expected_num_modified_files=4)
+    messages = re.findall(r"^(?:>>> Fixing #includes in '|\(skipping )([^':]+)",
+                          self.stdout_stub.getvalue(), re.M)
+    self.assertListEqual(['parallel_stream%d.cc' % i for i in range(6)],
+                         messages)
+
   def testAddForwardDeclare(self):
     """Test adding a forward-declare, rather than keeping one."""
     infile = """\
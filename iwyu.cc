@@ -87,8 +87,10 @@
 //     already get it via foo.h, IWYU won't recommend foo.cc to
 //     #include bar.h, unless it already does so.
 
+#include <chrono>                       // for steady_clock
+#include <cstdint>                      // for int64_t
 #include <cstdio>
-#include <cstdlib>                      // for atoi, exit
+#include <cstdlib>                      // for atoi, exit, _Exit
 #include <functional>
 #include <map>                          // for map, swap, etc
 #include <memory>                       // for unique_ptr
@@ -104,6 +106,7 @@
 #include "clang/AST/Decl.h"
 #include "clang/AST/DeclBase.h"
 #include "clang/AST/DeclCXX.h"
+#include "clang/AST/DeclGroup.h"
 #include "clang/AST/DeclTemplate.h"
 #include "clang/AST/Expr.h"
 #include "clang/AST/ExprCXX.h"
@@ -126,19 +129,24 @@
 #include "clang/Basic/TypeTraits.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendAction.h"
+#include "clang/Frontend/FrontendActions.h"
 #include "clang/Lex/Preprocessor.h"
+#include "clang/Rewrite/Core/Rewriter.h"
 #include "clang/Sema/Ownership.h"
 #include "clang/Sema/Sema.h"
 #include "iwyu_ast_util.h"
 #include "iwyu_cache.h"
 #include "iwyu_driver.h"
 #include "iwyu_globals.h"
+#include "iwyu_include_picker.h"
 #include "iwyu_location_util.h"
+#include "iwyu_memory_report.h"
 #include "iwyu_output.h"
 #include "iwyu_port.h"  // for CHECK_
 #include "iwyu_preprocessor.h"
 #include "iwyu_stl_util.h"
 #include "iwyu_string_util.h"
+#include "iwyu_template_profile.h"
 #include "iwyu_use_flags.h"
 #include "iwyu_verrs.h"
 #include "llvm/ADT/ArrayRef.h"
@@ -148,6 +156,7 @@
 #include "llvm/Support/Casting.h"
 #include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
 
 // TODO: Clean out pragmas as IWYU improves.
 // IWYU pragma: no_include "clang/AST/Redeclarable.h"
@@ -208,6 +217,7 @@ using clang::ConceptReference;
 using clang::ConstantArrayType;
 using clang::Decl;
 using clang::DeclContext;
+using clang::DeclGroupRef;
 using clang::DeclRefExpr;
 using clang::DecltypeType;
 using clang::DeducedTemplateSpecializationType;
@@ -217,6 +227,7 @@ using clang::EnumDecl;
 using clang::EnumType;
 using clang::Expr;
 using clang::ExprResult;
+using clang::FileID;
 using clang::FriendDecl;
 using clang::FriendTemplateDecl;
 using clang::FunctionDecl;
@@ -229,6 +240,7 @@ using clang::MemberExpr;
 using clang::MemberPointerType;
 using clang::NamedDecl;
 using clang::NamespaceAliasDecl;
+using clang::NamespaceDecl;
 using clang::NestedNameSpecifier;
 using clang::NestedNameSpecifierLoc;
 using clang::OpaqueValueExpr;
@@ -237,6 +249,7 @@ using clang::PPCallbacks;
 using clang::ParenType;
 using clang::ParmVarDecl;
 using clang::PointerType;
+using clang::PreprocessOnlyAction;
 using clang::Preprocessor;
 using clang::QualType;
 using clang::QualifiedTypeLoc;
@@ -245,6 +258,7 @@ using clang::RecordType;
 using clang::RecursiveASTVisitor;
 using clang::RedeclarableTemplateDecl;
 using clang::ReferenceType;
+using clang::Rewriter;
 using clang::CXXRewrittenBinaryOperator;
 using clang::Sema;
 using clang::SourceLocation;
@@ -988,6 +1002,14 @@ class AstFlattenerVisitor : public BaseAstVisitor<AstFlattenerVisitor> {
       others.clear();
     }
 
+    // Bytes held on the heap, for the cache cap and --memory_report.
+    int64_t HeapBytes() const {
+      return VectorHeapBytes(typelocs) + VectorHeapBytes(nnslocs) +
+             VectorHeapBytes(tpl_names) + VectorHeapBytes(tpl_args) +
+             VectorHeapBytes(tpl_arglocs) +
+             others.size() * TreeNodeBytes<const void*>();
+    }
+
    private:
     friend class AstFlattenerVisitor;
 
@@ -1010,16 +1032,24 @@ class AstFlattenerVisitor : public BaseAstVisitor<AstFlattenerVisitor> {
   //------------------------------------------------------------
   // Public interface:
 
-  explicit AstFlattenerVisitor(CompilerInstance* compiler) : Base(compiler) { }
+  // The nodes below each flattened decl, kept for the whole translation
+  // unit since we make a new AstFlattenerVisitor each time we flatten.
+  typedef BoundedCache<const Decl*, NodeSet> Cache;
 
+  AstFlattenerVisitor(CompilerInstance* compiler, Cache* cache)
+      : Base(compiler), cache_(cache) { }
+
+  // The result stays valid until the next flattening.
   const NodeSet& GetNodesBelow(Decl* decl) {
     CHECK_(seen_nodes_.empty() && "Nodes should be clear before GetNodesBelow");
-    NodeSet* node_set = &nodeset_decl_cache_[decl];
-    if (node_set->empty()) {
-      TraverseDecl(decl);
-      swap(*node_set, seen_nodes_);  // move the seen_nodes_ into the cache
-    }
-    return *node_set;                // returns the cache entry
+    if (const NodeSet* node_set = cache_->Find(decl))
+      return *node_set;              // returns the cache entry
+    TraverseDecl(decl);
+    NodeSet node_set;
+    swap(node_set, seen_nodes_);     // move the seen_nodes_ into the cache
+    const int64_t bytes =
+        TreeNodeBytes<pair<const Decl* const, NodeSet>>() + node_set.HeapBytes();
+    return cache_->Insert(decl, std::move(node_set), bytes);
   }
 
   //------------------------------------------------------------
@@ -1111,16 +1141,9 @@ class AstFlattenerVisitor : public BaseAstVisitor<AstFlattenerVisitor> {
 
  private:
   NodeSet seen_nodes_;
-
-  // Because we make a new AstFlattenerVisitor each time we flatten, we
-  // need to make this map static.
-  // TODO(csilvers): just have one flattener, so this needn't be static.
-  static map<const Decl*, NodeSet> nodeset_decl_cache_;
+  Cache* const cache_;
 };
 
-map<const Decl*, AstFlattenerVisitor::NodeSet>
-AstFlattenerVisitor::nodeset_decl_cache_;
-
 // ----------------------------------------------------------------------
 // --- VisitorState
 // ----------------------------------------------------------------------
@@ -1134,7 +1157,9 @@ AstFlattenerVisitor::nodeset_decl_cache_;
 
 struct VisitorState {
   VisitorState(CompilerInstance* c, const IwyuPreprocessorInfo& ipi)
-      : compiler(c), preprocessor_info(ipi) {}
+      : compiler(c), preprocessor_info(ipi),
+        nodeset_cache("AstFlattenerVisitor",
+                      int64_t{GlobalFlags().cache_memory_limit} << 20) {}
 
   CompilerInstance* const compiler;
 
@@ -1146,6 +1171,9 @@ struct VisitorState {
   // instantiated calls, we can't store the exprs themselves, but have
   // to store their location.
   set<SourceLocation> processed_overload_locs;
+
+  // The uninstantiated templates flattened so far.
+  AstFlattenerVisitor::Cache nodeset_cache;
 };
 
 // ----------------------------------------------------------------------
@@ -1343,8 +1371,8 @@ class IwyuBaseAstVisitor : public BaseAstVisitor<Derived> {
     VERRS(5) << "Macro is defined in '" << GetFilePath(macro_def_file) << "'\n";
 
     const NamedDecl* fwd_decl = nullptr;
-    for (const NamedDecl* redecl : GetTagRedecls(decl)) {
-      if (GetFileEntry(redecl) == macro_def_file && IsForwardDecl(redecl)) {
+    for (const NamedDecl* redecl : GetTagRedeclsInFile(decl, macro_def_file)) {
+      if (IsForwardDecl(redecl)) {
         VERRS(5) << "Found fwd-decl hint at "
                  << PrintableLoc(GetLocation(redecl)) << "\n";
         fwd_decl = redecl;
@@ -1453,11 +1481,13 @@ class IwyuBaseAstVisitor : public BaseAstVisitor<Derived> {
 
     // If we're a template specialization, we also accept
     // forward-declarations of the underlying template (vector<T>, not
-    // vector<int>).
-    set<const NamedDecl*> redecls = GetTagRedecls(decl);
+    // vector<int>).  Only redecls in the same file as the use matter.
+    OptionalFileEntryRef use_file = GetFileEntry(use_loc);
+    vector<const NamedDecl*> redecls = GetTagRedeclsInFile(decl, use_file);
     if (const ClassTemplateSpecializationDecl* spec_decl = DynCastFrom(decl)) {
-      InsertAllInto(GetTagRedecls(spec_decl->getSpecializedTemplate()),
-                    &redecls);
+      const vector<const NamedDecl*>& tpl_redecls =
+          GetTagRedeclsInFile(spec_decl->getSpecializedTemplate(), use_file);
+      redecls.insert(redecls.end(), tpl_redecls.begin(), tpl_redecls.end());
     }
 
     // Check if the author forward-declared the class in the same file.
@@ -1651,7 +1681,11 @@ class IwyuBaseAstVisitor : public BaseAstVisitor<Derived> {
   // of the type being explicitly written in the source code or not.
   virtual void ReportTypeUse(SourceLocation used_loc, const Type* type,
                              DerefKind deref_kind) {
-    ReportTypeUseInternal(used_loc, type, blocked_types_, deref_kind);
+    set<const Type*> blocked_types(blocked_types_.begin(),
+                                   blocked_types_.end());
+    blocked_types.insert(call_site_blocked_types_.begin(),
+                         call_site_blocked_types_.end());
+    ReportTypeUseInternal(used_loc, type, std::move(blocked_types), deref_kind);
   }
 
   void ReportTypesUse(SourceLocation used_loc, const set<const Type*>& types) {
@@ -3404,6 +3438,10 @@ class IwyuBaseAstVisitor : public BaseAstVisitor<Derived> {
     return visitor_state_->preprocessor_info;
   }
 
+  AstFlattenerVisitor::Cache* nodeset_cache() const {
+    return &visitor_state_->nodeset_cache;
+  }
+
   set<const Type*> GetProvidedTypes(const Type* type,
                                     SourceLocation loc) const {
     set<const Type*> retval;
@@ -3434,7 +3472,14 @@ class IwyuBaseAstVisitor : public BaseAstVisitor<Derived> {
     return retval;
   }
 
-  set<const Type*> blocked_types_;
+  bool IsBlockedType(const Type* type) const {
+    return blocked_types_.count(type) || call_site_blocked_types_.count(type);
+  }
+
+  InternedTypeSet blocked_types_;
+  // Blocked on top of blocked_types_ while reporting one use at a call
+  // site.  Not interned, as each call has its own.
+  set<const Type*> call_site_blocked_types_;
   set<const Decl*> blocked_for_fwd_decl_;
 
  private:
@@ -3607,8 +3652,10 @@ class IwyuBaseAstVisitor : public BaseAstVisitor<Derived> {
   void ReportWithAdditionalBlockedTypes(
       const Type* type, const set<const Type*>& additional_blocked_types) {
     set<const Type*> new_blocked_types = additional_blocked_types;
-    new_blocked_types.insert(blocked_types_.begin(), blocked_types_.end());
-    ValueSaver<set<const Type*>> s(&blocked_types_, new_blocked_types);
+    new_blocked_types.insert(call_site_blocked_types_.begin(),
+                             call_site_blocked_types_.end());
+    ValueSaver<set<const Type*>> s(&call_site_blocked_types_,
+                                   new_blocked_types);
     ReportTypeUse(CurrentLoc(), type, DerefKind::None);
   }
 
@@ -3696,6 +3743,14 @@ class InstantiatedTemplateVisitor
   InstantiatedTemplateVisitor(VisitorState* visitor_state)
       : Base(visitor_state) {
     Clear();
+    if (TemplateProfile::IsEnabled())
+      template_profile_ = std::make_unique<TemplateProfile>();
+  }
+
+  // The cost of every scan so far, or null unless --template_profile
+  // or --template_profile_json is set.
+  const TemplateProfile* template_profile() const {
+    return template_profile_.get();
   }
 
   //------------------------------------------------------------
@@ -3728,8 +3783,8 @@ class InstantiatedTemplateVisitor
   void ScanInstantiatedFunction(
       const FunctionDecl* fn_decl,
       const ASTNode* caller_ast_node,
-      const map<const Type*, const Type*>& resugar_map,
-      const set<const Type*>& blocked_types) {
+      const InternedTypeMap& resugar_map,
+      const InternedTypeSet& blocked_types) {
     Clear();
     caller_ast_node_ = caller_ast_node;
     resugar_map_ = resugar_map;
@@ -3742,14 +3797,16 @@ class InstantiatedTemplateVisitor
     // node (instead, we immediately push a new node on top of it).
     set_current_ast_node(const_cast<ASTNode*>(caller_ast_node));
 
-    TraverseExpandedTemplateFunctionHelper(fn_decl);
+    ScanScope scan(this, fn_decl);
+    if (scan.WithinBudget())
+      TraverseExpandedTemplateFunctionHelper(fn_decl);
   }
 
   void ScanInstantiatedVariable(
       VarDecl* var_decl,
       ASTNode* caller_ast_node,
-      const map<const Type*, const Type*>& resugar_map,
-      const set<const Type*>& blocked_types) {
+      const InternedTypeMap& resugar_map,
+      const InternedTypeSet& blocked_types) {
     Clear();
     caller_ast_node_ = caller_ast_node;
     resugar_map_ = resugar_map;
@@ -3761,15 +3818,17 @@ class InstantiatedTemplateVisitor
            "AST node already set");
     set_current_ast_node(caller_ast_node);
 
-    TraverseExpandedTemplateVariableHelper(var_decl);
+    ScanScope scan(this, var_decl);
+    if (scan.WithinBudget())
+      TraverseExpandedTemplateVariableHelper(var_decl);
   }
 
   // This isn't a Stmt, but sometimes we need to fully instantiate
   // a template class to get at a field of it, for instance:
   // MyClass<T>::size_type s;
   void ScanInstantiatedType(ASTNode* caller_ast_node,
-                            const map<const Type*, const Type*>& resugar_map,
-                            const set<const Type*>& blocked_types) {
+                            const InternedTypeMap& resugar_map,
+                            const InternedTypeSet& blocked_types) {
     Clear();
     caller_ast_node_ = caller_ast_node;
     resugar_map_ = resugar_map;
@@ -3783,12 +3842,15 @@ class InstantiatedTemplateVisitor
     const TemplateSpecializationType* type =
         caller_ast_node->GetAs<TemplateSpecializationType>();
     CHECK_(type != nullptr && "Not a template specialization");
+    ScanScope scan(this, TypeToDeclAsWritten(type));
+    if (!scan.WithinBudget())
+      return;
 
     // As in TraverseExpandedTemplateFunctionHelper, we ignore all AST nodes
     // that will be reported when we traverse the uninstantiated type.
     if (const NamedDecl* type_decl_as_written =
             GetDefinitionAsWritten(TypeToDeclAsWritten(type))) {
-      AstFlattenerVisitor nodeset_getter(compiler());
+      AstFlattenerVisitor nodeset_getter(compiler(), nodeset_cache());
       nodes_to_ignore_ = nodeset_getter.GetNodesBelow(
           const_cast<NamedDecl*>(type_decl_as_written));
     }
@@ -3799,8 +3861,8 @@ class InstantiatedTemplateVisitor
 
   void ScanInstantiatedClass(ClassTemplateSpecializationDecl* decl,
                              ASTNode* caller_ast_node,
-                             const map<const Type*, const Type*>& resugar_map,
-                             const set<const Type*>& blocked_types) {
+                             const InternedTypeMap& resugar_map,
+                             const InternedTypeSet& blocked_types) {
     Clear();
     caller_ast_node_ = caller_ast_node;
     resugar_map_ = resugar_map;
@@ -3808,13 +3870,39 @@ class InstantiatedTemplateVisitor
 
     set_current_ast_node(caller_ast_node);
 
-    AstFlattenerVisitor nodeset_getter(compiler());
+    ScanScope scan(this, decl);
+    if (!scan.WithinBudget())
+      return;
+
+    AstFlattenerVisitor nodeset_getter(compiler(), nodeset_cache());
     nodes_to_ignore_ = nodeset_getter.GetNodesBelow(
         const_cast<NamedDecl*>(GetDefinitionAsWritten(decl)));
 
     TraverseDataAndTypeMembersOfClassHelper(decl);
   }
 
+  //------------------------------------------------------------
+  // Count the nodes each scan visits, for the template profile and the
+  // scan budgets.  Returning false unwinds the whole traversal.
+
+  bool TraverseDecl(Decl* decl) {
+    return CountNodeWithinBudget() && Base::TraverseDecl(decl);
+  }
+
+  bool TraverseStmt(Stmt* stmt) {
+    return CountNodeWithinBudget() && Base::TraverseStmt(stmt);
+  }
+
+  bool TraverseType(QualType qualtype, bool traverse_qualifier = true) {
+    return CountNodeWithinBudget() &&
+           Base::TraverseType(qualtype, traverse_qualifier);
+  }
+
+  bool TraverseTypeLoc(TypeLoc typeloc, bool traverse_qualifier = true) {
+    return CountNodeWithinBudget() &&
+           Base::TraverseTypeLoc(typeloc, traverse_qualifier);
+  }
+
   //------------------------------------------------------------
   // Implements virtual methods from Base.
 
@@ -3919,8 +4007,7 @@ class InstantiatedTemplateVisitor
         GetFileEntry(actual_used_loc) == GetFileEntry(caller_loc())) {
       // Let all the currently active types and decls know about this
       // report, so they can update their cache entries.
-      for (CacheStoringScope* storer : cache_storers_)
-        storer->NoteReportedDecl(decl);
+      cache_journal_.NoteReportedDecl(decl);
       Base::ReportDeclUse(caller_loc(), decl, comment, extra_use_flags,
                           report_using_decl_only);
     }
@@ -3958,10 +4045,8 @@ class InstantiatedTemplateVisitor
     if (CanIgnoreType(type))
       return;
 
-    if (!blocked_types_.count(GetCanonicalType(type))) {
-      for (CacheStoringScope* storer : cache_storers_)
-        storer->NoteReportedType(type);
-    }
+    if (!IsBlockedType(GetCanonicalType(type)))
+      cache_journal_.NoteReportedType(type);
     Base::ReportTypeUse(caller_loc(), type, DerefKind::None);
   }
 
@@ -4280,10 +4365,121 @@ class InstantiatedTemplateVisitor
   // Clears the state of the visitor.
   void Clear() {
     caller_ast_node_ = nullptr;
-    resugar_map_.clear();
+    resugar_map_ = InternedTypeMap();
+    call_site_blocked_types_.clear();
     traversed_decls_.clear();
     nodes_to_ignore_.clear();
-    cache_storers_.clear();
+    scan_counters_ = TemplateProfile::Counters();
+    over_budget_reason_ = nullptr;
+    instantiation_depth_ = 0;
+  }
+
+  // Brackets one Scan*() call.  Checks the budgets that can be spent
+  // before the scan even starts, falls back to a conservative answer
+  // if the scan ran out of budget, and attributes its time and
+  // counters to the template it scans if profiling is enabled.
+  class ScanScope {
+   public:
+    ScanScope(InstantiatedTemplateVisitor* visitor, const NamedDecl* decl)
+        : visitor_(visitor), decl_(decl) {
+      visitor_->scan_start_ = std::chrono::steady_clock::now();
+      if (ContainsKey(visitor_->over_budget_decls_, decl_))
+        visitor_->RunOutOfBudget("an earlier scan of it");
+      else if (visitor_->OverTimeLimit())
+        visitor_->RunOutOfBudget("--instantiation_time_limit");
+    }
+
+    ~ScanScope() {
+      if (visitor_->over_budget_reason_)
+        visitor_->ReportConservativeFullUses(decl_);
+      const std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - visitor_->scan_start_;
+      visitor_->scan_seconds_ += elapsed.count();
+      if (visitor_->template_profile_ != nullptr) {
+        visitor_->template_profile_->Record(decl_, visitor_->scan_counters_,
+                                            elapsed.count());
+      }
+    }
+
+    bool WithinBudget() const {
+      return visitor_->over_budget_reason_ == nullptr;
+    }
+
+   private:
+    InstantiatedTemplateVisitor* const visitor_;
+    const NamedDecl* const decl_;
+  };
+
+  //------------------------------------------------------------
+  // Scan budgets.  Pathological templates (expression templates, deep
+  // metaprograms) can make a scan explore an enormous call graph.
+  // Once a budget is spent, the traversal unwinds, nothing it saw is
+  // cached, and the scan reports all the template arguments of
+  // interest as fully used instead.
+
+  bool OverTimeLimit() const {
+    const double limit = GlobalFlags().instantiation_time_limit;
+    if (limit <= 0)
+      return false;
+    const std::chrono::duration<double> current =
+        std::chrono::steady_clock::now() - scan_start_;
+    return scan_seconds_ + current.count() > limit;
+  }
+
+  bool CountNodeWithinBudget() {
+    if (over_budget_reason_)
+      return false;
+    const int64_t nodes = ++scan_counters_.nodes;
+    const int max_nodes = GlobalFlags().max_scan_nodes;
+    if (max_nodes > 0 && nodes > max_nodes) {
+      RunOutOfBudget("--max_scan_nodes");
+      return false;
+    }
+    // Reading the clock for every node would cost more than the nodes.
+    if (nodes % 256 == 0 && OverTimeLimit()) {
+      RunOutOfBudget("--instantiation_time_limit");
+      return false;
+    }
+    return true;
+  }
+
+  // Called on entering a function or class body; depth is the number
+  // of bodies being traversed, this one included.
+  bool DepthWithinBudget(int depth) {
+    if (over_budget_reason_)
+      return false;
+    const int max_depth = GlobalFlags().max_instantiation_depth;
+    if (max_depth > 0 && depth > max_depth) {
+      RunOutOfBudget("--max_instantiation_depth");
+      return false;
+    }
+    return true;
+  }
+
+  void RunOutOfBudget(const char* reason) {
+    over_budget_reason_ = reason;
+    cache_journal_.Abandon();
+  }
+
+  // The conservative answer for a scan that ran out of budget: every
+  // template argument written at the call site is fully used.  Default
+  // arguments are left alone, as we can't tell whether the template
+  // intends to provide them without scanning it.
+  void ReportConservativeFullUses(const NamedDecl* decl) {
+    if (over_budget_decls_.insert(decl).second) {
+      VERRS(1) << PrintableLoc(caller_loc()) << ": warning: scan of "
+               << decl->getQualifiedNameAsString() << " stopped by "
+               << over_budget_reason_
+               << "; treating its template arguments as fully used\n";
+    }
+    if (current_ast_node()->in_forward_declare_context())
+      return;
+    for (const auto& item : resugar_map_) {
+      const Type* type = item.second;
+      // Bypass our ReportTypeUse: its filtering relies on the scan.
+      if (type && !type->isPointerType())
+        Base::ReportTypeUse(caller_loc(), type, DerefKind::None);
+    }
   }
 
   // If we see the instantiated template using a type or decl (such as
@@ -4361,9 +4557,13 @@ class InstantiatedTemplateVisitor
     if (ReplayUsesFromCache(*FunctionCallsFullUseCache(),
                             fn_decl, caller_loc()))
       return true;
+    ++scan_counters_.callee_traversals;
+    ValueSaver<int> depth(&instantiation_depth_, instantiation_depth_ + 1);
+    if (!DepthWithinBudget(instantiation_depth_))
+      return false;
     // Make sure all the types we report in the recursive TraverseDecl
     // calls, below, end up in the cache for fn_decl.
-    CacheStoringScope css(&cache_storers_, FunctionCallsFullUseCache(),
+    CacheStoringScope css(&cache_journal_, FunctionCallsFullUseCache(),
                           fn_decl, resugar_map_);
 
     // We want to ignore all nodes that are the same in this
@@ -4371,7 +4571,7 @@ class InstantiatedTemplateVisitor
     // of the function.  The latter will be reported when we traverse
     // the uninstantiated function, so we don't need to re-traverse
     // them here.
-    AstFlattenerVisitor nodeset_getter(compiler());
+    AstFlattenerVisitor nodeset_getter(compiler(), nodeset_cache());
     ValueSaver<AstFlattenerVisitor::NodeSet> s(&nodes_to_ignore_);
     // This gets to the decl for the (uninstantiated) template-as-written:
     const FunctionDecl* decl_as_written =
@@ -4399,7 +4599,7 @@ class InstantiatedTemplateVisitor
     // already have protection from recursion.
     traversed_decls_.insert(decl);
 
-    AstFlattenerVisitor nodeset_getter(compiler());
+    AstFlattenerVisitor nodeset_getter(compiler(), nodeset_cache());
     // This gets to the decl for the (uninstantiated) template-as-written:
     VarDecl* decl_as_written = decl->getTemplateInstantiationPattern();
     if (!decl_as_written)  // TODO(bolshakov): could it be null?
@@ -4486,10 +4686,14 @@ class InstantiatedTemplateVisitor
     // how to scan them.
     if (!class_decl->hasDefinition())
       return true;
+    ++scan_counters_.callee_traversals;
+    ValueSaver<int> depth(&instantiation_depth_, instantiation_depth_ + 1);
+    if (!DepthWithinBudget(instantiation_depth_))
+      return false;
 
     // Make sure all the types we report in the recursive TraverseDecl
     // calls, below, end up in the cache for class_decl.
-    CacheStoringScope css(&cache_storers_, ClassMembersFullUseCache(),
+    CacheStoringScope css(&cache_journal_, ClassMembersFullUseCache(),
                           class_decl, resugar_map_);
 
     for (DeclContext::decl_iterator it = class_decl->decls_begin();
@@ -4532,12 +4736,18 @@ class InstantiatedTemplateVisitor
   // Returns true if we replayed uses, false if key isn't in the cache.
   bool ReplayUsesFromCache(const FullUseCache& cache, const NamedDecl* key,
                            SourceLocation use_loc) {
-    if (!cache.Contains(key, resugar_map_))
+    // Reporting uses doesn't scan anything, so nothing is inserted into
+    // the cache, and the value isn't evicted, while we replay it.
+    const FullUseCache::Value* value = cache.Find(key, resugar_map_);
+    if (!value) {
+      ++scan_counters_.cache_misses;
       return false;
+    }
+    ++scan_counters_.cache_hits;
     VERRS(6) << "(Replaying full-use information from the cache for "
              << key->getQualifiedNameAsString() << ")\n";
-    ReportTypesUse(use_loc, cache.GetFullUseTypes(key, resugar_map_));
-    ReportDeclsUse(use_loc, cache.GetFullUseDecls(key, resugar_map_));
+    ReportTypesUse(use_loc, value->first);
+    ReportDeclsUse(use_loc, value->second);
     return true;
   }
 
@@ -4568,7 +4778,7 @@ class InstantiatedTemplateVisitor
       // TODO(csilvers): for default template args, item.first is sometimes
       // a RecordType even when it's a template specialization.  Figure out
       // how to get the proper type components in that situation.
-      const set<const Type*> type_components = GetComponentsOfType(item.first);
+      const set<const Type*>& type_components = GetComponentsOfType(item.first);
       if (ContainsAnyKey(resugar_map_, type_components)) {
         resugar_map.insert(item);
       }
@@ -4623,18 +4833,47 @@ class InstantiatedTemplateVisitor
   // recursive template call and encode a template type we don't care
   // about ourselves.  If it's in the resugar_map but with a nullptr
   // value, it's a default template parameter, that the
-  // template-caller may or may not be responsible for.
-  map<const Type*, const Type*> resugar_map_;
+  // template-caller may or may not be responsible for.  Both it and
+  // blocked_types_ are interned, so setting them up for a scan, and
+  // the cache keys made from them, copy no map.
+  InternedTypeMap resugar_map_;
 
   // Used to avoid recursion in the *Helper() methods.
   set<const Decl*> traversed_decls_;
 
   AstFlattenerVisitor::NodeSet nodes_to_ignore_;
 
-  // The current set of nodes we're updating cache entries for.
-  set<CacheStoringScope*> cache_storers_;
+  // What was reported while the nodes we're updating cache entries for
+  // were being traversed.  Empties itself when the last scope closes.
+  CacheStoringJournal cache_journal_;
+
+  // What the scan in progress did, and the totals per scanned template.
+  TemplateProfile::Counters scan_counters_;
+  std::unique_ptr<TemplateProfile> template_profile_;
+
+  // Budget state.  over_budget_reason_ names the budget the scan in
+  // progress ran out of, or is null.  Templates whose scan ran out are
+  // answered conservatively from then on, without scanning.
+  int instantiation_depth_ = 0;
+  const char* over_budget_reason_ = nullptr;
+  set<const NamedDecl*> over_budget_decls_;
+  std::chrono::steady_clock::time_point scan_start_;
+  double scan_seconds_ = 0;  // in all scans of this translation unit
 };  // class InstantiatedTemplateVisitor
 
+// IWYU is done with the translation unit once the violations are reported,
+// so we end the process right there instead of unwinding through clang.
+// With --fast_exit we don't even run static destructors or atexit handlers;
+// nothing is left to do but flush the output.
+[[noreturn]] static void ExitAfterAnalysis(int exit_code) {
+  if (!GlobalFlags().fast_exit)
+    exit(exit_code);
+  llvm::outs().flush();
+  llvm::errs().flush();
+  fflush(nullptr);
+  std::_Exit(exit_code);
+}
+
 // ----------------------------------------------------------------------
 // --- IwyuAstConsumer
 // ----------------------------------------------------------------------
@@ -4700,13 +4939,32 @@ class IwyuAstConsumer
   // Called once at the beginning of the compilation.
   void Initialize(ASTContext& context) override {}  // NOLINT
 
+  // Called for each top-level decl as it's parsed.  Indexes the decls
+  // for the pre-passes in HandleTranslationUnit.
+  bool HandleTopLevelDecl(DeclGroupRef group) override {  // NOLINT
+    // Sema hands over instantiations as top-level decls too when the
+    // pre-passes run; they are covered by their templates.
+    if (top_level_decls_complete_)
+      return true;
+    for (Decl* decl : group)
+      AddToTopLevelDeclIndex(decl);
+    return true;
+  }
+
   // Called once at the end of the compilation.
   void HandleTranslationUnit(ASTContext& context) override {  // NOLINT
     // TODO(csilvers): automatically detect preprocessing is done, somehow.
     const_cast<IwyuPreprocessorInfo*>(&preprocessor_info())->
         HandlePreprocessingDone();
 
+    std::unique_ptr<MemoryReport> memory_report;
+    if (MemoryReport::IsEnabled()) {
+      memory_report = std::make_unique<MemoryReport>();
+      RecordMemoryUsage("preprocessing", context, memory_report.get());
+    }
+
     TranslationUnitDecl* tu_decl = context.getTranslationUnitDecl();
+    top_level_decls_complete_ = true;
 
     // Sema::TUScope is reset after parsing, but Sema::getCurScope still points
     // to the translation unit decl scope. TUScope is required for lookup in
@@ -4719,7 +4977,8 @@ class IwyuAstConsumer
 
     // We run a separate pass to force parsing of late-parsed function
     // templates.
-    ParseFunctionTemplates(sema, tu_decl);
+    const vector<Decl*> decls_to_prepare = DeclsToPrepare(context);
+    ParseFunctionTemplates(sema, decls_to_prepare);
 
     // Clang lazily constructs the implicit methods of a C++ class (the
     // default constructor and destructor, etc) -- it only bothers to
@@ -4727,15 +4986,19 @@ class IwyuAstConsumer
     // But we need to be non-lazy: IWYU depends on analyzing what future
     // code *may* call in a class, not what current code *does*.  So we
     // force all the lazy evaluation to happen here.
-    InstantiateImplicitMethods(sema, tu_decl);
+    InstantiateImplicitMethods(sema, decls_to_prepare);
+    if (memory_report)
+      RecordMemoryUsage("pre-passes", context, memory_report.get());
 
     // Run IWYU analysis.
     TraverseDecl(tu_decl);
+    if (memory_report)
+      RecordMemoryUsage("AST traversal", context, memory_report.get());
 
     // Check if any unrecoverable errors have occurred.
     // There is no point in continuing when the AST is in a bad state.
     if (compiler()->getDiagnostics().hasUnrecoverableErrorOccurred())
-      exit(EXIT_FAILURE);
+      ExitAfterAnalysis(EXIT_FAILURE);
 
     const set<OptionalFileEntryRef>* const files_to_report_iwyu_violations_for =
         preprocessor_info().files_to_report_iwyu_violations_for();
@@ -4752,18 +5015,27 @@ class IwyuAstConsumer
     // We have to calculate the .h files before the .cc file, since
     // the .cc file inherits #includes from the .h files, and we
     // need to figure out what those #includes are going to be.
-    size_t num_edits = 0;
     OptionalFileEntryRef const main_file = preprocessor_info().main_file();
+    vector<IwyuFileInfo*> headers;
     for (OptionalFileEntryRef file : *files_to_report_iwyu_violations_for) {
       if (file == main_file)
         continue;
       CHECK_(preprocessor_info().FileInfoFor(file));
-      num_edits += preprocessor_info().FileInfoFor(file)
-          ->CalculateAndReportIwyuViolations();
+      headers.push_back(preprocessor_info().FileInfoFor(file));
     }
+    std::unique_ptr<Rewriter> rewriter;
+    if (GlobalFlags().apply) {
+      rewriter = std::make_unique<Rewriter>(compiler()->getSourceManager(),
+                                            compiler()->getLangOpts());
+    }
+    size_t num_edits = CalculateAndReportHeaderViolations(headers,
+                                                          rewriter.get());
     CHECK_(preprocessor_info().FileInfoFor(main_file));
     num_edits += preprocessor_info().FileInfoFor(main_file)
         ->CalculateAndReportIwyuViolations();
+    if (rewriter) {
+      preprocessor_info().FileInfoFor(main_file)->AddIwyuEdits(rewriter.get());
+    }
 
     int exit_code = EXIT_SUCCESS;
     if (GlobalFlags().exit_code_always) {
@@ -4774,11 +5046,151 @@ class IwyuAstConsumer
       exit_code = GlobalFlags().exit_code_error;
     }
 
-    exit(exit_code);
+    // Clang reports any file it fails to write.
+    if (rewriter && rewriter->overwriteChangedFiles())
+      exit_code = EXIT_FAILURE;
+
+    if (GlobalFlags().HasDebugFlag("cachestats")) {
+      PrintTypeComponentsStats();
+      FunctionCallsFullUseCache()->PrintStats();
+      ClassMembersFullUseCache()->PrintStats();
+      nodeset_cache()->PrintStats();
+    }
+
+    if (const TemplateProfile* profile =
+            instantiated_template_visitor_.template_profile()) {
+      if (GlobalFlags().template_profile > 0)
+        profile->PrintTop(GlobalFlags().template_profile, errs());
+      if (!GlobalFlags().template_profile_json.empty())
+        profile->WriteJson(GlobalFlags().template_profile_json);
+    }
+
+    if (memory_report) {
+      RecordMemoryUsage("violation reporting", context, memory_report.get());
+      if (GlobalFlags().memory_report)
+        memory_report->Print(errs());
+      if (!GlobalFlags().memory_report_json.empty())
+        memory_report->WriteJson(GlobalFlags().memory_report_json);
+    }
+
+    ExitAfterAnalysis(exit_code);
+  }
+
+  // Adds a snapshot of what clang's AST and iwyu's caches and tables
+  // hold at the end of phase to report.
+  void RecordMemoryUsage(const string& phase, const ASTContext& context,
+                         MemoryReport* report) const {
+    report->BeginPhase(phase);
+    MemoryUsage ast;
+    ast.bytes = context.getASTAllocatedMemory();
+    report->Add("clang AST", ast);
+    MemoryUsage side_tables;
+    side_tables.bytes = context.getSideTableAllocatedMemory();
+    report->Add("clang AST side tables", side_tables);
+    report->Add("function calls full-use cache",
+                FunctionCallsFullUseCache()->EstimateMemoryUsage());
+    report->Add("class members full-use cache",
+                ClassMembersFullUseCache()->EstimateMemoryUsage());
+    report->Add("flattened template cache",
+                nodeset_cache()->EstimateMemoryUsage());
+    MemoryUsage interned = InternedTypeMap::EstimateMemoryUsage();
+    interned += InternedTypeSet::EstimateMemoryUsage();
+    report->Add("interned resugar maps and type sets", interned);
+    report->Add("include picker", GlobalIncludePicker().EstimateMemoryUsage());
+    report->Add("symbol uses",
+                preprocessor_info().EstimateSymbolUseMemoryUsage());
+    report->Add("include graph",
+                preprocessor_info().EstimateIncludeGraphMemoryUsage());
+  }
+
+  // Calls CalculateAndReportIwyuViolations() for each header, in order,
+  // and adds its edits to rewriter if there is one.
+  // With --jobs, headers whose results don't depend on other headers are
+  // computed in forked processes first, and their output is replayed here
+  // in the same order it would otherwise have been printed.
+  // Invariant: a forked header hands back only its desired includes and
+  // its number of violations (see AdoptIwyuResult), which is all the main
+  // file needs from it.  Its lines, and anything its analysis allocates,
+  // exist only in the child, so we don't fork when something reads those
+  // after reporting: --apply edits the lines and --memory_report measures
+  // the allocations.  Anything else added here must either do the same or
+  // have the child serialize what it needs.
+  size_t CalculateAndReportHeaderViolations(
+      const vector<IwyuFileInfo*>& headers, Rewriter* rewriter) {
+    map<IwyuFileInfo*, size_t> task_index;
+    vector<std::function<string()>> tasks;
+    if (GlobalFlags().jobs > 1 && !rewriter && !GlobalFlags().memory_report &&
+        GlobalFlags().memory_report_json.empty()) {
+      for (IwyuFileInfo* header : headers) {
+        if (header->HasAssociatedHeaders())
+          continue;
+        task_index[header] = tasks.size();
+        tasks.push_back([header] {
+          return header->SerializeIwyuResult(
+              header->CalculateAndReportIwyuViolations());
+        });
+      }
+    }
+    vector<ForkedTaskResult> results;
+    if (tasks.size() < 2 ||
+        !RunForkedTasks(tasks, GlobalFlags().jobs, &results)) {
+      task_index.clear();
+    }
+
+    size_t num_edits = 0;
+    for (IwyuFileInfo* header : headers) {
+      const size_t* index = FindInMap(&task_index, header);
+      if (index && results[*index].ok) {
+        errs() << results[*index].output;
+        num_edits += header->AdoptIwyuResult(results[*index].payload);
+      } else {
+        // Not forked, or the child died; its output is incomplete.
+        num_edits += header->CalculateAndReportIwyuViolations();
+        if (rewriter)
+          header->AddIwyuEdits(rewriter);
+      }
+    }
+    return num_edits;
   }
 
-  void ParseFunctionTemplates(Sema& sema, TranslationUnitDecl* tu_decl) {
-    set<FunctionDecl*> late_parsed_decls = GetLateParsedFunctionDecls(tu_decl);
+  // Namespaces span files (and #includes), so index what they contain.
+  void AddToTopLevelDeclIndex(Decl* decl) {
+    if (isa<NamespaceDecl>(decl) || isa<LinkageSpecDecl>(decl)) {
+      for (Decl* child : cast<DeclContext>(decl)->decls())
+        AddToTopLevelDeclIndex(child);
+      return;
+    }
+    // Decls spelled in macros go under the invalid FileID, which we
+    // never skip.
+    const SourceLocation loc = GetLocation(decl);
+    const FileID file =
+        loc.isFileID() ? GlobalSourceManager()->getFileID(loc) : FileID();
+    top_level_decls_by_file_[file].push_back(decl);
+  }
+
+  // Returns the decls to run the pre-passes over: the top-level and
+  // namespace-level decls in files we may report violations for.  Those
+  // passes ignore everything outside such files anyway, so this saves
+  // walking all of the system headers twice.  Decls from a PCH or module
+  // never reach HandleTopLevelDecl, so then we fall back to the whole TU.
+  vector<Decl*> DeclsToPrepare(ASTContext& context) const {
+    if (context.getExternalSource() != nullptr)
+      return {context.getTranslationUnitDecl()};
+
+    vector<Decl*> decls;
+    for (const auto& [file, file_decls] : top_level_decls_by_file_) {
+      if (file.isValid() &&
+          CanIgnoreLocation(GlobalSourceManager()->getLocForStartOfFile(file)))
+        continue;
+      decls.insert(decls.end(), file_decls.begin(), file_decls.end());
+    }
+    return decls;
+  }
+
+  void ParseFunctionTemplates(Sema& sema, const vector<Decl*>& decls) {
+    set<FunctionDecl*> late_parsed_decls;
+    for (Decl* decl : decls)
+      InsertAllInto(GetLateParsedFunctionDecls(decl), &late_parsed_decls);
 
     // If we have any late-parsed functions, make sure the
     // -fdelayed-template-parsing flag is on. Otherwise we don't know where
@@ -4801,7 +5213,7 @@ class IwyuAstConsumer
     }
   }
 
-  void InstantiateImplicitMethods(Sema& sema, TranslationUnitDecl* tu_decl) {
+  void InstantiateImplicitMethods(Sema& sema, const vector<Decl*>& decls) {
     // Collect all implicit ctors/dtors that need to be instantiated.
     struct Visitor : public RecursiveASTVisitor<Visitor> {
       Visitor(Sema& sema) : sema(sema) {
@@ -4831,7 +5243,8 @@ class IwyuAstConsumer
 
     // Run visitor to collect implicit methods.
     Visitor v(sema);
-    v.TraverseDecl(tu_decl);
+    for (Decl* decl : decls)
+      v.TraverseDecl(decl);
 
     // For each method collected, let Sema define them.
     for (CXXMethodDecl* method : v.may_need_definition) {
@@ -4998,8 +5411,10 @@ class IwyuAstConsumer
         args.push_back(arg.getArgument());
 
       const TemplateInstantiationData data = GetTplInstData(args, decl);
+      const InternedTypeMap resugar_map(data.resugar_map);
+      const InternedTypeSet provided_types(data.provided_types);
       instantiated_template_visitor_.ScanInstantiatedClass(
-          decl, current_ast_node(), data.resugar_map, data.provided_types);
+          decl, current_ast_node(), resugar_map, provided_types);
 
       if (IsExplicitInstantiationDefinitionAsWritten(decl)) {
         // Explicit instantiation definition causes instantiation of all
@@ -5012,8 +5427,7 @@ class IwyuAstConsumer
         for (const CXXMethodDecl* member :
              decl->getCanonicalDecl()->methods()) {
           instantiated_template_visitor_.ScanInstantiatedFunction(
-              member, current_ast_node(), data.resugar_map,
-              data.provided_types);
+              member, current_ast_node(), resugar_map, provided_types);
         }
       }
     }
@@ -5205,7 +5619,8 @@ class IwyuAstConsumer
         return Base::VisitDeclRefExpr(expr);
       TemplateInstantiationData data = GetTplInstData(var_decl, expr);
       instantiated_template_visitor_.ScanInstantiatedVariable(
-          var_decl, current_ast_node(), data.resugar_map, data.provided_types);
+          var_decl, current_ast_node(), InternedTypeMap(data.resugar_map),
+          InternedTypeSet(data.provided_types));
     }
     return Base::VisitDeclRefExpr(expr);
   }
@@ -5340,7 +5755,8 @@ class IwyuAstConsumer
     if (!can_fwd_decl || type->isTypeAlias()) {
       const TemplateInstantiationData data = GetTplInstData(type);
       instantiated_template_visitor_.ScanInstantiatedType(
-          current_ast_node(), data.resugar_map, data.provided_types);
+          current_ast_node(), InternedTypeMap(data.resugar_map),
+          InternedTypeSet(data.provided_types));
     }
 
     if (!InImplicitCode(current_ast_node())) {
@@ -5452,7 +5868,8 @@ class IwyuAstConsumer
                                  provided_for_autocast.end());
     }
     instantiated_template_visitor_.ScanInstantiatedFunction(
-        callee, current_ast_node(), data.resugar_map, data.provided_types);
+        callee, current_ast_node(), InternedTypeMap(data.resugar_map),
+        InternedTypeSet(data.provided_types));
     return true;
   }
 
@@ -5464,8 +5881,9 @@ class IwyuAstConsumer
     ASTNode node(type);
     node.SetParent(current_ast_node());
     data.provided_types.insert(blocked_types.begin(), blocked_types.end());
-    instantiated_template_visitor_.ScanInstantiatedType(&node, data.resugar_map,
-                                                        data.provided_types);
+    instantiated_template_visitor_.ScanInstantiatedType(
+        &node, InternedTypeMap(data.resugar_map),
+        InternedTypeSet(data.provided_types));
   }
 
   set<const Type*> GetProvidedByTplArg(const Type* type) const {
@@ -5613,6 +6031,11 @@ class IwyuAstConsumer
 
   // Class we call to handle instantiated template functions and classes.
   InstantiatedTemplateVisitor instantiated_template_visitor_;
+
+  // The top-level and namespace-level decls, by the file they're in, in
+  // parse order.  Complete once HandleTranslationUnit is called.
+  map<FileID, vector<Decl*>> top_level_decls_by_file_;
+  bool top_level_decls_complete_ = false;
 };  // class IwyuAstConsumer
 
 // We use an ASTFrontendAction to hook up IWYU with Clang.
@@ -5648,12 +6071,52 @@ class IwyuAction : public ASTFrontendAction {
   const ToolChain& toolchain;
 };
 
+// For --generate_mappings, a preprocessor-only action: the include graph
+// and pragmas are all that's needed, so there's no parsing.
+class IwyuMappingsAction : public PreprocessOnlyAction {
+ public:
+  IwyuMappingsAction() = delete;
+
+  explicit IwyuMappingsAction(const ToolChain& toolchain)
+      : toolchain(toolchain) {
+  }
+
+ protected:
+  bool BeginSourceFileAction(CompilerInstance& compiler) override {
+    InitGlobals(compiler, toolchain);
+
+    Preprocessor& preprocessor = compiler.getPreprocessor();
+    preprocessor_info = new IwyuPreprocessorInfo(preprocessor);
+    preprocessor.addPPCallbacks(
+        std::unique_ptr<PPCallbacks>(preprocessor_info));
+    preprocessor.addCommentHandler(preprocessor_info);
+    return PreprocessOnlyAction::BeginSourceFileAction(compiler);
+  }
+
+  void EndSourceFileAction() override {
+    // Owned by the preprocessor, which is still alive here.
+    preprocessor_info->HandlePreprocessingDone();
+    if (!WriteGeneratedMappings(preprocessor_info->GenerateMappings(),
+                                GlobalFlags().generate_mappings)) {
+      exit(EXIT_FAILURE);
+    }
+    PreprocessOnlyAction::EndSourceFileAction();
+  }
+
+ private:
+  const ToolChain& toolchain;
+  IwyuPreprocessorInfo* preprocessor_info = nullptr;
+};
+
 } // namespace include_what_you_use
 
 int main(int argc, char **argv) {
   using clang::driver::ToolChain;
+  using clang::FrontendAction;
   using include_what_you_use::ExecuteAction;
+  using include_what_you_use::GlobalFlags;
   using include_what_you_use::IwyuAction;
+  using include_what_you_use::IwyuMappingsAction;
   using include_what_you_use::OptionsParser;
 
   llvm::llvm_shutdown_obj scoped_shutdown;
@@ -5669,7 +6132,10 @@ int main(int argc, char **argv) {
   //       CLANG_FLAGS... foo.cc
   OptionsParser options_parser(argc, argv);
   if (!ExecuteAction(options_parser.clang_argc(), options_parser.clang_argv(),
-                     [](const ToolChain& toolchain) {
+                     [](const ToolChain& toolchain)
+                         -> std::unique_ptr<FrontendAction> {
+                       if (!GlobalFlags().generate_mappings.empty())
+                         return std::make_unique<IwyuMappingsAction>(toolchain);
                        return std::make_unique<IwyuAction>(toolchain);
                      })) {
     return EXIT_FAILURE;
@@ -151,7 +151,6 @@ using clang::TemplateSpecializationKind;
 using clang::TemplateSpecializationType;
 using clang::TemplateTemplateParmDecl;
 using clang::TemplateTypeParmDecl;
-using clang::TranslationUnitDecl;
 using clang::Type;
 using clang::TypeAliasTemplateDecl;
 using clang::TypeDecl;
@@ -723,22 +722,67 @@ class CanonicalTypeEnumerator
   set<const Type*> seen_types_;
 };
 
+// Remembers what one of the enumerators above returned for each type.
+// Types are uniqued by the ASTContext and live as long as it does, and
+// iwyu only ever has one ASTContext, so results can be shared for the
+// rest of the translation unit.
+template <typename Enumerator>
+class TypeComponentsMemo {
+ public:
+  explicit TypeComponentsMemo(const char* name) : name_(name) {
+  }
+
+  const set<const Type*>& Get(const Type* type) {
+    auto it = components_.find(type);
+    if (it != components_.end()) {
+      ++hits_;
+      return it->second;
+    }
+    ++misses_;
+    Enumerator type_enumerator;
+    return components_.emplace(type, type_enumerator.Enumerate(type))
+        .first->second;
+  }
+
+  void PrintStats() const {
+    errs() << name_ << ": " << hits_ << " hits, " << misses_ << " misses, "
+           << components_.size() << " types\n";
+  }
+
+ private:
+  const char* const name_;
+  map<const Type*, set<const Type*>> components_;
+  size_t hits_ = 0;
+  size_t misses_ = 0;
+};
+
+static TypeComponentsMemo<SugaredTypeEnumerator> sugared_components_memo(
+    "GetComponentsOfType");
+static TypeComponentsMemo<TypeEnumeratorWithoutSubstituted>
+    unsubstituted_components_memo("GetComponentsOfTypeWithoutSubstituted");
+static TypeComponentsMemo<CanonicalTypeEnumerator> canonical_components_memo(
+    "GetCanonicalComponentsOfType");
+
 // A 'component' of a type is a type beneath it in the AST tree.
 // So 'Foo*' has component 'Foo', as does 'vector<Foo>', while
 // vector<pair<Foo, Bar>> has components pair<Foo,Bar>, Foo, and Bar.
-set<const Type*> GetComponentsOfType(const Type* type) {
-  SugaredTypeEnumerator type_enumerator;
-  return type_enumerator.Enumerate(type);
+const set<const Type*>& GetComponentsOfType(const Type* type) {
+  return sugared_components_memo.Get(type);
 }
 
-set<const Type*> GetComponentsOfTypeWithoutSubstituted(const Type* type) {
-  TypeEnumeratorWithoutSubstituted type_enumerator;
-  return type_enumerator.Enumerate(type);
+const set<const Type*>& GetComponentsOfTypeWithoutSubstituted(
+    const Type* type) {
+  return unsubstituted_components_memo.Get(type);
 }
 
-set<const Type*> GetCanonicalComponentsOfType(const Type* type) {
-  CanonicalTypeEnumerator type_enumerator;
-  return type_enumerator.Enumerate(type);
+const set<const Type*>& GetCanonicalComponentsOfType(const Type* type) {
+  return canonical_components_memo.Get(type);
+}
+
+void PrintTypeComponentsStats() {
+  sugared_components_memo.PrintStats();
+  unsubstituted_components_memo.PrintStats();
+  canonical_components_memo.PrintStats();
 }
 
 // --- Utilities for Decl.
@@ -853,7 +897,7 @@ SourceRange GetSourceRangeOfClassDecl(const Decl* decl) {
 // Use a local RAV implementation to simply collect all FunctionDecls marked for
 // late template parsing. This happens with the flag -fdelayed-template-parsing,
 // which is on by default in MSVC-compatible mode.
-set<FunctionDecl*> GetLateParsedFunctionDecls(TranslationUnitDecl* decl) {
+set<FunctionDecl*> GetLateParsedFunctionDecls(Decl* decl) {
   struct Visitor : public RecursiveASTVisitor<Visitor> {
     bool VisitFunctionDecl(FunctionDecl* function_decl) {
       if (function_decl->isLateTemplateParsed())
@@ -1293,7 +1337,7 @@ set<const NamedDecl*> GetNonTagRedecls(const NamedDecl* decl) {
   return retval;
 }
 
-set<const NamedDecl*> GetTagRedecls(const NamedDecl* decl) {
+static set<const NamedDecl*> CollectTagRedecls(const NamedDecl* decl) {
   const TagDecl* tag_decl = DynCastFrom(decl);
   const ClassTemplateDecl* tpl_decl = DynCastFrom(decl);
   if (tpl_decl)
@@ -1325,23 +1369,86 @@ set<const NamedDecl*> GetTagRedecls(const NamedDecl* decl) {
   return redecls;
 }
 
-const NamedDecl* GetFirstRedecl(const NamedDecl* decl) {
-  const NamedDecl* first_decl = decl;
-  SourceLocation first_decl_loc = GetLocation(first_decl);
+namespace {
+
+// What we know about the redecls of one class or class template.  Only
+// 'all' is filled in eagerly; the rest is derived on first use.
+struct TagRedeclInfo {
+  set<const NamedDecl*> all;
+  map<OptionalFileEntryRef, vector<const NamedDecl*>> by_file;
+  const NamedDecl* first = nullptr;
+  bool by_file_done = false;
+};
+
+}  // anonymous namespace
+
+// Redecl chains are done growing once the translation unit is parsed,
+// which is before iwyu asks for them, so we compute each set once.  The
+// result doesn't depend on which redecl we're asked about, except that a
+// friend decl is in its own set; those get their own entry.
+static TagRedeclInfo* GetTagRedeclInfo(const NamedDecl* decl) {
+  static map<const NamedDecl*, TagRedeclInfo> tag_redecl_infos;
+  const NamedDecl* key = decl;
+  if (const ClassTemplateDecl* tpl_decl = DynCastFrom(decl)) {
+    key = tpl_decl->getCanonicalDecl();
+  } else if (const TagDecl* tag_decl = DynCastFrom(decl)) {
+    if (!IsFriendDecl(tag_decl))
+      key = tag_decl->getCanonicalDecl();
+  } else {
+    return nullptr;
+  }
+
+  auto it = tag_redecl_infos.find(key);
+  if (it == tag_redecl_infos.end()) {
+    it = tag_redecl_infos.emplace(key, TagRedeclInfo()).first;
+    it->second.all = CollectTagRedecls(decl);
+  }
+  return &it->second;
+}
+
+const set<const NamedDecl*>& GetTagRedecls(const NamedDecl* decl) {
+  static const set<const NamedDecl*> no_redecls;
+  const TagRedeclInfo* info = GetTagRedeclInfo(decl);
+  return info ? info->all : no_redecls;
+}
 
-  set<const NamedDecl*> all_redecls = GetTagRedecls(decl);
-  if (all_redecls.empty())  // input is not a class or class template
+const vector<const NamedDecl*>& GetTagRedeclsInFile(
+    const NamedDecl* decl, OptionalFileEntryRef file) {
+  static const vector<const NamedDecl*> no_redecls;
+  TagRedeclInfo* info = GetTagRedeclInfo(decl);
+  if (!info)
+    return no_redecls;
+  if (!info->by_file_done) {
+    for (const NamedDecl* redecl : info->all)
+      info->by_file[GetFileEntry(redecl)].push_back(redecl);
+    info->by_file_done = true;
+  }
+  const vector<const NamedDecl*>* redecls = FindInMap(&info->by_file, file);
+  return redecls ? *redecls : no_redecls;
+}
+
+const NamedDecl* GetFirstRedecl(const NamedDecl* decl) {
+  TagRedeclInfo* info = GetTagRedeclInfo(decl);
+  if (!info || info->all.empty())  // input is not a class or class template
     return nullptr;
 
   SourceManager& sm = *GlobalSourceManager();
-  for (const NamedDecl* redecl : all_redecls) {
-    SourceLocation redecl_loc = GetLocation(redecl);
-    if (sm.isBeforeInTranslationUnit(redecl_loc, first_decl_loc)) {
-      first_decl = redecl;
-      first_decl_loc = redecl_loc;
+  if (!info->first) {
+    info->first = *info->all.begin();
+    SourceLocation first_loc = GetLocation(info->first);
+    for (const NamedDecl* redecl : info->all) {
+      SourceLocation redecl_loc = GetLocation(redecl);
+      if (sm.isBeforeInTranslationUnit(redecl_loc, first_loc)) {
+        info->first = redecl;
+        first_loc = redecl_loc;
+      }
     }
   }
-  return first_decl;
+  // Prefer the input decl unless some redecl strictly precedes it.
+  if (sm.isBeforeInTranslationUnit(GetLocation(info->first),
+                                   GetLocation(decl)))
+    return info->first;
+  return decl;
 }
 
 const NamedDecl* GetNonfriendClassRedecl(const NamedDecl* decl) {
@@ -1353,7 +1460,7 @@ const NamedDecl* GetNonfriendClassRedecl(const NamedDecl* decl) {
   if (!record_decl || !IsFriendDecl(record_decl))
     return decl;
 
-  set<const NamedDecl*> all_redecls = GetTagRedecls(decl);
+  const set<const NamedDecl*>& all_redecls = GetTagRedecls(decl);
   CHECK_(!all_redecls.empty() && "Uncaught non-class decl");
   return *all_redecls.begin();    // arbitrary choice
 }
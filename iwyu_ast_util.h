@@ -24,6 +24,7 @@
 #include "clang/AST/TemplateBase.h"
 #include "clang/AST/Type.h"
 #include "clang/AST/TypeLoc.h"
+#include "clang/Basic/FileEntry.h"
 #include "clang/Basic/SourceLocation.h"
 #include "clang/Basic/Specifiers.h"
 #include "iwyu_port.h"  // for CHECK_
@@ -56,7 +57,6 @@ class Stmt;
 class TagDecl;
 class TemplateDecl;
 class TemplateName;
-class TranslationUnitDecl;
 class TypeDecl;
 class ValueDecl;
 class VarDecl;
@@ -73,6 +73,7 @@ namespace include_what_you_use {
 using std::map;
 using std::set;
 using std::string;
+using std::vector;
 
 //------------------------------------------------------------
 // ASTNode and friends.
@@ -569,9 +570,9 @@ const clang::TagDecl* GetTagDefinition(const clang::Decl* decl);
 // class name.  Used to determine where forward-declares are.
 clang::SourceRange GetSourceRangeOfClassDecl(const clang::Decl* decl);
 
-// Collect all late-parsed function templates in a translation unit.
-set<clang::FunctionDecl*> GetLateParsedFunctionDecls(
-    clang::TranslationUnitDecl* decl);
+// Collect all late-parsed function templates in a decl, e.g. a
+// translation unit.
+set<clang::FunctionDecl*> GetLateParsedFunctionDecls(clang::Decl* decl);
 
 struct TemplateInstantiationData {
   map<const clang::Type*, const clang::Type*> resugar_map;
@@ -707,8 +708,15 @@ set<const clang::NamedDecl*> GetNonTagRedecls(const clang::NamedDecl* decl);
 // are guaranteed to be of the same type as the input Decl.  Returns
 // the empty set if the input is not a TagDecl or ClassTemplateDecl.
 // Otherwise, always returns at least one element (since the input
-// decl is its own redecl).
-set<const clang::NamedDecl*> GetTagRedecls(const clang::NamedDecl* decl);
+// decl is its own redecl).  The sets are computed once per class and
+// shared, so callers must not hold on to them across AST changes.
+const set<const clang::NamedDecl*>& GetTagRedecls(
+    const clang::NamedDecl* decl);
+
+// The subset of GetTagRedecls() located in the given file, in the same
+// order.  Files are partitioned once per class, so this is a lookup.
+const vector<const clang::NamedDecl*>& GetTagRedeclsInFile(
+    const clang::NamedDecl* decl, clang::OptionalFileEntryRef file);
 
 // Returns the redecl of decl that occurs first in the translation
 // unit (that is, is the first one you'd see if you did 'cc -E').
@@ -812,10 +820,13 @@ const clang::Type* Desugar(const clang::Type* type);
 // typedef Tpl1<A, B> Alias;
 // the returned set for something like 'Tpl2<Alias>' contains 'Alias', 'A' and
 // 'B' but not 'Tpl1<A, B>'.
-set<const clang::Type*> GetComponentsOfType(const clang::Type* type);
+// This and the two functions below memoize their results for the lifetime
+// of the ASTContext, so the returned sets are shared and must not change.
+const set<const clang::Type*>& GetComponentsOfType(const clang::Type* type);
 
 // Almost the same except it returns canonical types.
-set<const clang::Type*> GetCanonicalComponentsOfType(const clang::Type* type);
+const set<const clang::Type*>& GetCanonicalComponentsOfType(
+    const clang::Type* type);
 
 // Returns types for determination of their "provision" status. They are
 // canonicalized because intermediate sugar should be always provided already
@@ -824,9 +835,12 @@ set<const clang::Type*> GetCanonicalComponentsOfType(const clang::Type* type);
 // template <class T> struct Tpl1 { typedef Tpl2<T, A> Alias; };
 // the returned set for the type 'Tpl1<B>::Alias' contains 'A' but not 'B'
 // or any sugar for 'B'.
-set<const clang::Type*> GetComponentsOfTypeWithoutSubstituted(
+const set<const clang::Type*>& GetComponentsOfTypeWithoutSubstituted(
     const clang::Type*);
 
+// Prints hit rates of the memo tables above to stderr.
+void PrintTypeComponentsStats();
+
 // Returns true if the type has any template arguments.
 bool IsTemplatizedType(const clang::Type* type);
 
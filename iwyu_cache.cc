@@ -10,23 +10,37 @@
 #include "iwyu_cache.h"
 
 #include <functional>
+#include <iterator>
+#include <map>
 #include <set>
 #include <string>
+#include <utility>
 
 #include "clang/AST/DeclTemplate.h"
 #include "clang/AST/TemplateBase.h"
 #include "clang/AST/Type.h"
 #include "clang/Basic/LangOptions.h"
 #include "iwyu_ast_util.h"
+#include "iwyu_globals.h"
+#include "iwyu_include_picker.h"
+#include "iwyu_port.h"  // for CHECK_
 #include "iwyu_stl_util.h"
+#include "llvm/Support/raw_ostream.h"
 
+using clang::CXXRecordDecl;
+using clang::ClassTemplateDecl;
 using clang::ClassTemplateSpecializationDecl;
+using clang::Decl;
 using clang::LangOptions;
 using clang::NamedDecl;
 using clang::TemplateArgument;
 using clang::TemplateArgumentList;
 using clang::TemplateSpecializationType;
+using clang::TemplateTypeParmDecl;
 using clang::Type;
+using llvm::errs;
+using llvm::isa;
+using std::map;
 using std::set;
 using std::string;
 
@@ -37,7 +51,7 @@ namespace include_what_you_use {
 // arguments, and full use of all default templated arguments that
 // the class does not intend-to-provide.  (So vector<MyClass>
 // required full use of MyClass, but not of allocator<MyClass>).
-// TODO(csilvers): put this somewhere easier to modify, and add to it.
+// More can be added with 'full_use' directives in mapping files.
 static const char* const kFullUseTypes[] = {
     "__gnu_cxx::hash_map",
     "__gnu_cxx::hash_multimap",
@@ -55,6 +69,19 @@ static const char* const kFullUseTypes[] = {
     "std::unordered_set",
 };
 
+// The resugar map below only covers 'type' template args.  None of the
+// types in kFullUseTypes have any other kind of template parameter, but
+// mapping files may name any template.  This is decided from the template
+// itself, as it may first be seen as a dependent type, which has no
+// template arguments to look at.
+static bool HasOnlyTypeTemplateParams(const ClassTemplateDecl* tpl_decl) {
+  for (const NamedDecl* param : *tpl_decl->getTemplateParameters()) {
+    if (!isa<TemplateTypeParmDecl>(param) || param->isTemplateParameterPack())
+      return false;
+  }
+  return true;
+}
+
 // If the passed-in tpl_decl is one of the classes we have hard-coded
 // the full-use type information for, populate the cache with the
 // appropriate full-use type information for the given instantiation.
@@ -65,25 +92,53 @@ static const char* const kFullUseTypes[] = {
 // to instantiate methods, making the hard-coding much easier.
 map<const Type*, const Type*> FullUseCache::GetPrecomputedResugarMap(
     const TemplateSpecializationType* tpl_type, const LangOptions& lang_opts) {
-  static const int fulluse_size =
-      (sizeof(kFullUseTypes) / sizeof(*kFullUseTypes));
-  set<string> fulluse_types(kFullUseTypes, kFullUseTypes + fulluse_size);
-  if (!lang_opts.CPlusPlus17)
-    fulluse_types.insert({"std::forward_list", "std::list", "std::vector"});
+  // Neither the language options nor the mapping files change within
+  // a translation unit, so the name set is built once, and each
+  // template's qualified name is computed at most once.
+  static const set<string> fulluse_types = [&lang_opts] {
+    set<string> types(std::begin(kFullUseTypes), std::end(kFullUseTypes));
+    if (!lang_opts.CPlusPlus17)
+      types.insert({"std::forward_list", "std::list", "std::vector"});
+    const set<string>& mapped = GlobalIncludePicker().full_use_types();
+    types.insert(mapped.begin(), mapped.end());
+    return types;
+  }();
+  static map<const Decl*, bool> is_fulluse_template;
 
+  // A dependent type, such as 'Foo<T, N>', is written as the template.
   const NamedDecl* tpl_decl = TypeToDeclAsWritten(tpl_type);
-  if (!ContainsKey(fulluse_types, GetWrittenQualifiedNameAsString(tpl_decl)))
+  const ClassTemplateDecl* class_tpl_decl = DynCastFrom(tpl_decl);
+  if (const ClassTemplateSpecializationDecl* spec_decl = DynCastFrom(tpl_decl))
+    class_tpl_decl = spec_decl->getSpecializedTemplate();
+  else if (const CXXRecordDecl* record_decl = DynCastFrom(tpl_decl))
+    class_tpl_decl = record_decl->getDescribedClassTemplate();
+  if (class_tpl_decl == nullptr)
     return map<const Type*, const Type*>();
+  class_tpl_decl = class_tpl_decl->getCanonicalDecl();
 
-  // The code below doesn't handle template-template args/etc.  None
-  // of the types in kFullUseTypes should have those.  Just verify,
-  // when we can.
+  auto [it, inserted] = is_fulluse_template.try_emplace(class_tpl_decl, false);
+  if (inserted) {
+    const string name = GetWrittenQualifiedNameAsString(tpl_decl);
+    if (ContainsKey(fulluse_types, name)) {
+      it->second = HasOnlyTypeTemplateParams(class_tpl_decl);
+      // Said once per template, as the result is cached.
+      if (!it->second) {
+        errs() << "warning: ignoring full_use mapping for " << name
+               << ": only templates with type arguments are supported\n";
+      }
+    }
+  }
+  if (!it->second)
+    return map<const Type*, const Type*>();
+
+  // The code below doesn't handle template-template args/etc.  Just
+  // verify, when we can.
   if (const ClassTemplateSpecializationDecl* tpl_spec_decl =
           DynCastFrom(tpl_decl)) {
     const TemplateArgumentList& all_tpl_args = tpl_spec_decl->getTemplateArgs();
     for (unsigned i = 0; i < all_tpl_args.size(); ++i) {
       CHECK_((all_tpl_args.get(i).getKind() == TemplateArgument::Type) &&
-             "kFullUseType types must contain only 'type' template args");
+             "full-use templates must have only 'type' template args");
     }
   }
 
@@ -96,4 +151,18 @@ map<const Type*, const Type*> FullUseCache::GetPrecomputedResugarMap(
       .resugar_map;
 }
 
+void FullUseCache::Insert(
+    const void* decl_or_type, const InternedTypeMap& resugar_map,
+    set<const Type*> reported_types, set<const NamedDecl*> reported_decls) {
+  // TODO(csilvers): should in_forward_declare_context() be in Key too?
+  // The resugar map is shared, not owned by the entry.
+  const int64_t bytes =
+      TreeNodeBytes<pair<const Key, Value>>() +
+      reported_types.size() * TreeNodeBytes<const Type*>() +
+      reported_decls.size() * TreeNodeBytes<const NamedDecl*>();
+  cache_.Insert(Key(decl_or_type, resugar_map),
+                Value(std::move(reported_types), std::move(reported_decls)),
+                bytes);
+}
+
 }  // namespace include_what_you_use
@@ -15,13 +15,21 @@
 #ifndef INCLUDE_WHAT_YOU_USE_IWYU_CACHE_H_
 #define INCLUDE_WHAT_YOU_USE_IWYU_CACHE_H_
 
+#include <algorithm>                    // for lower_bound, partition_point
+#include <cstddef>                      // for size_t
+#include <cstdint>                      // for int64_t
+#include <functional>                   // for less
 #include <map>                          // for map
+#include <memory>                       // for unique_ptr, make_unique
 #include <set>                          // for set
-#include <utility>                      // for pair
+#include <unordered_map>                // for unordered_map
+#include <utility>                      // for pair, move
+#include <vector>                       // for vector
 
 #include "clang/AST/Type.h"
-#include "iwyu_port.h"  // for CHECK_
-#include "iwyu_stl_util.h"
+#include "iwyu_memory_report.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/Support/raw_ostream.h"
 
 // TODO: Clean out pragmas as IWYU improves.
 // IWYU pragma: no_include <iterator>
@@ -36,6 +44,229 @@ namespace include_what_you_use {
 using std::map;
 using std::pair;
 using std::set;
+using std::vector;
+
+// An immutable sorted array, hash-consed: arrays with the same contents
+// share a single copy, which lives until exit.  So copying one copies
+// a pointer, and two are equal iff they are the same object.  Template
+// scans and the FullUseCache keys built from them pass their resugar
+// maps and blocked types around this way.
+// The intern tables are not counted against --cache_memory_limit, as
+// evicting a cache entry can't tell whether others share its arrays;
+// --memory_report lists them.
+template <typename V>
+class InternedArray {
+ public:
+  typedef V value_type;
+  typedef const V* const_iterator;
+
+  const_iterator begin() const {
+    return values_->data();
+  }
+  const_iterator end() const {
+    return values_->data() + values_->size();
+  }
+  size_t size() const {
+    return values_->size();
+  }
+  bool empty() const {
+    return values_->empty();
+  }
+
+  bool operator==(const InternedArray& other) const {
+    return values_ == other.values_;
+  }
+  bool operator!=(const InternedArray& other) const {
+    return values_ != other.values_;
+  }
+  // An arbitrary order, for use as a map key.
+  bool operator<(const InternedArray& other) const {
+    return std::less<const vector<V>*>()(values_, other.values_);
+  }
+
+  // All arrays interned so far, for --memory_report.
+  static MemoryUsage EstimateMemoryUsage() {
+    return Table().usage;
+  }
+
+ protected:
+  // values must be sorted and unique.
+  explicit InternedArray(vector<V> values)
+      : values_(Intern(std::move(values))) {
+  }
+
+ private:
+  struct InternTable {
+    // Keyed by the hash of the contents; arrays with colliding hashes
+    // share a bucket.
+    std::unordered_map<size_t, vector<std::unique_ptr<const vector<V>>>>
+        buckets;
+    MemoryUsage usage;
+  };
+
+  static InternTable& Table() {
+    static InternTable table;
+    return table;
+  }
+
+  static const vector<V>* Intern(vector<V> values) {
+    InternTable& table = Table();
+    vector<std::unique_ptr<const vector<V>>>& bucket =
+        table.buckets[llvm::hash_combine_range(values.begin(), values.end())];
+    for (const std::unique_ptr<const vector<V>>& interned : bucket) {
+      if (*interned == values)
+        return interned.get();
+    }
+    ++table.usage.entries;
+    table.usage.bytes += sizeof(vector<V>) + VectorHeapBytes(values);
+    bucket.push_back(std::make_unique<const vector<V>>(std::move(values)));
+    return bucket.back().get();
+  }
+
+  const vector<V>* values_;
+};
+
+// An interned set<const Type*>, e.g. of the types blocked from being
+// reported by a template scan.
+class InternedTypeSet : public InternedArray<const clang::Type*> {
+ public:
+  typedef const clang::Type* key_type;
+
+  InternedTypeSet() : InternedTypeSet(set<const clang::Type*>()) {
+  }
+  explicit InternedTypeSet(const set<const clang::Type*>& types)
+      : InternedArray(vector<const clang::Type*>(types.begin(), types.end())) {
+  }
+
+  const_iterator find(key_type key) const {
+    const_iterator it = std::lower_bound(begin(), end(), key,
+                                         std::less<const clang::Type*>());
+    return it != end() && *it == key ? it : end();
+  }
+  size_t count(key_type key) const {
+    return find(key) != end();
+  }
+};
+
+// An interned map<const Type*, const Type*>, e.g. a resugar map: see
+// InstantiatedTemplateVisitor.
+class InternedTypeMap
+    : public InternedArray<pair<const clang::Type*, const clang::Type*>> {
+ public:
+  typedef const clang::Type* key_type;
+  typedef const clang::Type* mapped_type;
+
+  InternedTypeMap()
+      : InternedTypeMap(map<const clang::Type*, const clang::Type*>()) {
+  }
+  explicit InternedTypeMap(
+      const map<const clang::Type*, const clang::Type*>& type_map)
+      : InternedArray(vector<value_type>(type_map.begin(), type_map.end())) {
+  }
+
+  const_iterator lower_bound(key_type key) const {
+    return std::partition_point(begin(), end(), [key](const value_type& v) {
+      return std::less<const clang::Type*>()(v.first, key);
+    });
+  }
+  const_iterator upper_bound(key_type key) const {
+    return std::partition_point(begin(), end(), [key](const value_type& v) {
+      return !std::less<const clang::Type*>()(key, v.first);
+    });
+  }
+  const_iterator find(key_type key) const {
+    const_iterator it = lower_bound(key);
+    return it != end() && it->first == key ? it : end();
+  }
+  size_t count(key_type key) const {
+    return find(key) != end();
+  }
+};
+
+// A map whose total size, as estimated by its callers, is capped.
+// Once an insertion would go over the cap, entries are evicted with
+// the CLOCK algorithm, an approximation of least-recently-used: an
+// eviction hand sweeps over the entries, sparing those found since it
+// last passed them.  With a cap of 0 the cache grows without bound.
+template <typename K, typename V>
+class BoundedCache {
+ public:
+  BoundedCache(const char* name, int64_t max_bytes)
+      : name_(name), max_bytes_(max_bytes), hand_(entries_.end()) {
+  }
+  BoundedCache(const BoundedCache&) = delete;
+  BoundedCache& operator=(const BoundedCache&) = delete;
+
+  // Returns the value cached for key, or nullptr.  The pointer stays
+  // valid until the next Insert().
+  const V* Find(const K& key) const {
+    auto it = entries_.find(key);
+    if (it == entries_.end()) {
+      ++misses_;
+      return nullptr;
+    }
+    ++hits_;
+    it->second.referenced = true;
+    return &it->second.value;
+  }
+
+  // Adds value for key, unless key is already cached, and returns the
+  // cached value.  bytes is the caller's estimate of the entry's size.
+  const V& Insert(const K& key, V value, int64_t bytes) {
+    if (const auto it = entries_.find(key); it != entries_.end())
+      return it->second.value;
+    while (max_bytes_ > 0 && !entries_.empty() && bytes_ + bytes > max_bytes_)
+      EvictOne();
+    const auto it = entries_.emplace(key, Entry{std::move(value), bytes}).first;
+    bytes_ += bytes;
+    return it->second.value;
+  }
+
+  MemoryUsage EstimateMemoryUsage() const {
+    MemoryUsage usage;
+    usage.entries = entries_.size();
+    usage.bytes = bytes_;
+    return usage;
+  }
+
+  void PrintStats() const {
+    llvm::errs() << name_ << ": " << hits_ << " hits, " << misses_
+                 << " misses, " << evictions_ << " evictions, "
+                 << entries_.size() << " entries\n";
+  }
+
+ private:
+  struct Entry {
+    V value;
+    int64_t bytes;
+    // Set when the entry is added or found; cleared when the hand
+    // passes it.
+    mutable bool referenced = true;
+  };
+
+  void EvictOne() {
+    while (true) {
+      if (hand_ == entries_.end())
+        hand_ = entries_.begin();
+      if (!hand_->second.referenced)
+        break;
+      hand_->second.referenced = false;
+      ++hand_;
+    }
+    bytes_ -= hand_->second.bytes;
+    hand_ = entries_.erase(hand_);
+    ++evictions_;
+  }
+
+  const char* const name_;
+  const int64_t max_bytes_;
+  map<K, Entry> entries_;
+  typename map<K, Entry>::iterator hand_;
+  int64_t bytes_ = 0;
+  mutable int64_t hits_ = 0;
+  mutable int64_t misses_ = 0;
+  int64_t evictions_ = 0;
+};
 
 // This cache is used to store 'full use information' for a given
 // templated function call or type instantiation:
@@ -55,52 +286,33 @@ using std::set;
 // For each of these, the answer is always the same for the given
 // Decl (function call or class instantiation) with the same template
 // args.  So we store this info in a cache, since it's very expensive
-// to compute.
-
+// to compute.  Its size can be capped with --cache_memory_limit, at
+// the cost of recomputing evicted entries.
 class FullUseCache {
  public:
   // The first part of the key is the decl or type that we're
   // caching reporting-info for.  Since what we report depends on
   // what the types-of-interest were, we store that in the key too.
-  typedef pair<const void*,
-               map<const clang::Type*, const clang::Type*>> Key;
+  // Being interned, it's shared with the scans and compared by pointer.
+  typedef pair<const void*, InternedTypeMap> Key;
   // The value are the types and decls we reported.
-  typedef pair<const set<const clang::Type*>,
-               const set<const clang::NamedDecl*>> Value;
+  typedef pair<set<const clang::Type*>, set<const clang::NamedDecl*>> Value;
 
-  void Insert(const void* decl_or_type,
-              const map<const clang::Type*, const clang::Type*>& resugar_map,
-              const set<const clang::Type*>& reported_types,
-              const set<const clang::NamedDecl*>& reported_decls) {
-    // TODO(csilvers): should in_forward_declare_context() be in Key too?
-    cache_.insert(pair<Key,Value>(Key(decl_or_type, resugar_map),
-                                  Value(reported_types, reported_decls)));
+  FullUseCache(const char* name, int64_t max_bytes)
+      : cache_(name, max_bytes) {
   }
 
-  // resguar_map is the 'uncanonicalize' map for the template
-  // arguments used to instantiate this template.
-  bool Contains(
-      const void* key,
-      const map<const clang::Type*, const clang::Type*>& resugar_map) const {
-    return ContainsKey(cache_, Key(key, resugar_map));
-  }
-
-  // You must call Contains() before calling these, to make sure the
-  // key is in the cache.
-  const set<const clang::Type*>& GetFullUseTypes(
-      const void* key,
-      const map<const clang::Type*, const clang::Type*>& resugar_map) const {
-    const Value* value = FindInMap(&cache_, Key(key, resugar_map));
-    CHECK_(value && "Must call Contains() before calling GetFullUseTypes()");
-    return value->first;
-  }
+  void Insert(const void* decl_or_type, const InternedTypeMap& resugar_map,
+              set<const clang::Type*> reported_types,
+              set<const clang::NamedDecl*> reported_decls);
 
-  const set<const clang::NamedDecl*>& GetFullUseDecls(
-      const void* key,
-      const map<const clang::Type*, const clang::Type*>& resugar_map) const {
-    const Value* value = FindInMap(&cache_, Key(key, resugar_map));
-    CHECK_(value && "Must call Contains() before calling GetFullUseDecls()");
-    return value->second;
+  // Returns the types and decls reported for the key, or nullptr if it
+  // isn't cached.  resguar_map is the 'uncanonicalize' map for the
+  // template arguments used to instantiate this template.  The result
+  // stays valid until the next Insert().
+  const Value* Find(const void* key,
+                    const InternedTypeMap& resugar_map) const {
+    return cache_.Find(Key(key, resugar_map));
   }
 
   // In addition to the normal cache, which is filled via Insert()
@@ -114,14 +326,24 @@ class FullUseCache {
   // sugared properly: the output might be 'MyUnderlyingType' when the
   // input is 'vector<MyTypedef>'.  You will have to resugar yourself.
   // That is why this is implemented in a different function, and not
-  // available via GetFullUseType(), which does not have this problem
-  // with sugaring.
+  // available via Find(), which does not have this problem with
+  // sugaring.
   static map<const clang::Type*, const clang::Type*> GetPrecomputedResugarMap(
       const clang::TemplateSpecializationType* tpl_type,
       const clang::LangOptions&);
 
+  // For --memory_report.
+  MemoryUsage EstimateMemoryUsage() const {
+    return cache_.EstimateMemoryUsage();
+  }
+
+  // Prints hits, misses and evictions, for --debug=cachestats.
+  void PrintStats() const {
+    cache_.PrintStats();
+  }
+
  private:
-  map<Key, Value> cache_;
+  BoundedCache<Key, Value> cache_;
 };
 
 // This class allows us to update multiple cache entries at once.
@@ -130,44 +352,78 @@ class FullUseCache {
 // entry (B, Foo) ("B requires the full type info for Foo"), but we
 // also want to add a cache entry (A, Foo) ("A requires the full
 // type info for Foo", due to its calling B).  The way we do this is
-// whenever we enter a function -- or instantiate a type -- we add
-// it to our set of 'currently active functions', cache_storers_.
-// Whenever we decide we need full type info for some type Foo, we
-// add a new cache entry for every function/type in cache_storers_.
+// whenever we enter a function -- or instantiate a type -- we open a
+// CacheStoringScope for it.  Whenever we decide we need full type info
+// for some type Foo, we append Foo to a journal shared by all scopes.
+// Since scopes nest strictly, each one's cache entry is just the part
+// of the journal appended while it was open, so a report costs the same
+// no matter how many scopes are active.
+class CacheStoringJournal {
+ public:
+  // These are what ReportDeclUse() and ReportTypeUse() call to
+  // populate the cache entries of all open scopes.
+  void NoteReportedType(const clang::Type* type) {
+    if (open_scopes_ > 0)
+      reported_types_.push_back(type);
+  }
+  void NoteReportedDecl(const clang::NamedDecl* decl) {
+    if (open_scopes_ > 0)
+      reported_decls_.push_back(decl);
+  }
+
+  // Makes the open scopes store nothing: what they saw is incomplete,
+  // e.g. because the traversal was cut short.
+  void Abandon() {
+    if (open_scopes_ > 0)
+      abandoned_ = true;
+  }
+
+ private:
+  friend class CacheStoringScope;
+
+  vector<const clang::Type*> reported_types_;
+  vector<const clang::NamedDecl*> reported_decls_;
+  int open_scopes_ = 0;
+  bool abandoned_ = false;
+};
+
 class CacheStoringScope {
  public:
-  CacheStoringScope(set<CacheStoringScope*>* cache_storers,
+  CacheStoringScope(CacheStoringJournal* journal,
                     FullUseCache* cache,
                     const void* key,
-                    const map<const clang::Type*, const clang::Type*>& resugar)
-      : cache_storers_(cache_storers), cache_(cache),
-        key_(key), resugar_map_(resugar) {
-    // Register ourselves so ReportDeclUse() and ReportTypeUse()
-    // will call back to us.
-    cache_storers_->insert(this);
+                    const InternedTypeMap& resugar)
+      : journal_(journal), cache_(cache), key_(key), resugar_map_(resugar),
+        types_begin_(journal->reported_types_.size()),
+        decls_begin_(journal->reported_decls_.size()) {
+    ++journal_->open_scopes_;
   }
 
   ~CacheStoringScope() {
-    cache_->Insert(key_, resugar_map_, reported_types_, reported_decls_);
-    cache_storers_->erase(this);
-  }
-
-  // These are what ReportDeclUse() and ReportTypeUse() call to
-  // populate this cache entry.
-  void NoteReportedType(const clang::Type* type) {
-    reported_types_.insert(type);
-  }
-  void NoteReportedDecl(const clang::NamedDecl* decl) {
-    reported_decls_.insert(decl);
+    const vector<const clang::Type*>& types = journal_->reported_types_;
+    const vector<const clang::NamedDecl*>& decls = journal_->reported_decls_;
+    if (!journal_->abandoned_) {
+      cache_->Insert(
+          key_, resugar_map_,
+          set<const clang::Type*>(types.begin() + types_begin_, types.end()),
+          set<const clang::NamedDecl*>(decls.begin() + decls_begin_,
+                                       decls.end()));
+    }
+    // Enclosing scopes still need what we saw; the outermost one is done.
+    if (--journal_->open_scopes_ == 0) {
+      journal_->reported_types_.clear();
+      journal_->reported_decls_.clear();
+      journal_->abandoned_ = false;
+    }
   }
 
  private:
-  set<CacheStoringScope*>* const cache_storers_;
+  CacheStoringJournal* const journal_;
   FullUseCache* const cache_;
   const void* const key_;
-  const map<const clang::Type*, const clang::Type*>& resugar_map_;
-  set<const clang::Type*> reported_types_;
-  set<const clang::NamedDecl*> reported_decls_;
+  const InternedTypeMap resugar_map_;
+  const size_t types_begin_;
+  const size_t decls_begin_;
 };
 
 }  // namespace include_what_you_use
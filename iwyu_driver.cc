@@ -36,6 +36,7 @@
 #include "clang/FrontendTool/Utils.h"
 #include "clang/Lex/HeaderSearchOptions.h"
 #include "clang/Lex/PreprocessorOptions.h"
+#include "iwyu_globals.h"
 #include "iwyu_port.h"
 #include "iwyu_verrs.h"
 #include "llvm/ADT/ArrayRef.h"
@@ -379,19 +380,26 @@ bool ExecuteAction(int argc,
   const ArgStringList& cc_arguments = command.getArguments();
   std::shared_ptr<CompilerInvocation> invocation(new CompilerInvocation);
   CompilerInvocation::CreateFromArgs(*invocation, cc_arguments, *diagnostics);
-  invocation->getFrontendOpts().DisableFree = false;
+  // Release memory on the way out unless we were asked to exit fast.
+  invocation->getFrontendOpts().DisableFree = GlobalFlags().fast_exit;
 
   // Show the invocation, with -v.
   if (invocation->getHeaderSearchOpts().Verbose) {
     errs() << "clang invocation:\n" << JobsToString(jobs, "\n") << "\n";
   }
 
-  // Reject attempts at using precompiled headers.
+  // Reject attempts at using precompiled headers, unless we have a sidecar
+  // with the preprocessor events hidden inside the PCH.
   const PreprocessorOptions& opts = invocation->getPreprocessorOpts();
-  if (!opts.ImplicitPCHInclude.empty() || !opts.PCHThroughHeader.empty()) {
+  if (!opts.PCHThroughHeader.empty()) {
     errs() << "error: include-what-you-use does not support PCH\n";
     return false;
   }
+  if (!opts.ImplicitPCHInclude.empty() && GlobalFlags().pch_sidecar.empty()) {
+    errs() << "error: include-what-you-use does not support PCH without "
+              "-Xiwyu --pch_sidecar\n";
+    return false;
+  }
 
   // FIXME: This is copied from cc1_main.cpp; simplify and eliminate.
 
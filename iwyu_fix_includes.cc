@@ -0,0 +1,1303 @@
+//===--- iwyu_fix_includes.cc - make iwyu's edits like fix_includes.py ----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// The routines here are named after, and follow, the ones of the same
+// name in fix_includes.py; see there for more of the reasoning.
+
+#include "iwyu_fix_includes.h"
+
+#include <algorithm>                    // for max, stable_sort
+#include <map>                          // for map
+#include <optional>                     // for optional, nullopt
+#include <regex>                        // for regex, regex_search, etc
+#include <utility>                      // for make_pair
+
+#include "iwyu_path_util.h"
+#include "iwyu_string_util.h"
+#include "llvm/ADT/ArrayRef.h"
+
+namespace include_what_you_use {
+
+using llvm::ArrayRef;
+using std::map;
+using std::optional;
+
+namespace {
+
+// A [start_line, end_line) range of lines.
+using Span = pair<int, int>;
+
+// The types of line fix_includes.py tells apart, named after the regexes
+// it tells them by.
+enum class LineType {
+  None,  // contentful code, or the dummy line 0
+  Comment,
+  Blank,
+  NamespaceStart,
+  NamespaceStartAllman,
+  NamespaceStartMixed,
+  NamespaceContinueAllmanMixed,
+  NamespaceEnd,
+  If,
+  Else,
+  Endif,
+  Include,
+  ForwardDeclare,
+  HeaderGuard,
+  HeaderGuardDefine,
+  PragmaOnce,
+  PragmaPush,
+  PragmaPop
+};
+
+// The kinds of #include and forward-declare, in their default sort order.
+// fix_includes.py has one more, for --separate_project_includes.
+enum LineKind {
+  kNoKind = 0,
+  kMainCUIncludeKind,     // e.g. #include "foo.h" when editing foo.cc
+  kCSystemIncludeKind,    // e.g. #include <stdio.h>
+  kCXXSystemIncludeKind,  // e.g. #include <vector>
+  kNonsystemIncludeKind,  // e.g. #include "bar.h"
+  kForwardDeclareKind,    // e.g. class Baz;
+  kEOFKind                // used at eof
+};
+
+// fix_includes.py's regular expressions.  Those for line types are
+// applied with Match(), like Python's re.match.
+struct Regexes {
+  const std::regex comment{R"re(\s*//.*)re"};
+  const std::regex c_comment_start{R"re(\s*/\*)re"};
+  const std::regex c_comment_end{R"re(.*\*/\s*(.*)$)re"};
+  const std::regex comment_line{R"re(\s*//)re"};
+  const std::regex pragma_once_line{R"re(\s*#\s*pragma\s+once)re"};
+  const std::regex pragma_push_line{R"re(\s*#\s*pragma.*push.*)re"};
+  const std::regex pragma_pop_line{R"re(\s*#\s*pragma.*pop.*)re"};
+  const std::regex blank_line{R"re(\s*$)re"};
+  const std::regex if_line{R"re(\s*#\s*if)re"};
+  const std::regex else_line{R"re(\s*#\s*(else|elif)\b)re"};
+  const std::regex endif_line{R"re(\s*#\s*endif\b)re"};
+  const std::regex namespace_start{
+      R"re(\s*(namespace\b[^{]*\{\s*)+(//.*)?$|)re"
+      R"re(\s*(U_NAMESPACE_BEGIN)|)re"
+      R"re(\s*(HASH_NAMESPACE_DECLARATION_START))re"};
+  const std::regex namespace_start_allman{
+      R"re(\s*(namespace\b[^{=]*)+(//.*)?$)re"};
+  const std::regex namespace_start_mixed{
+      R"re(\s*(namespace\b[^{]*\{\s*)+(namespace\b[^{]*)+(//.*)?$)re"};
+  const std::regex namespace_continue_allman_mixed{
+      R"re(\s*\{\s*(//.*)?$)re"};
+  const std::regex namespace_end{
+      R"re(\s*(\})|)re"
+      R"re(\s*(U_NAMESPACE_END)|)re"
+      R"re(\s*(HASH_NAMESPACE_DECLARATION_END))re"};
+  const std::regex include{R"re(\s*#\s*include\s+([<"][^">]+[>"]))re"};
+  const std::regex header_guard_define{R"re(\s*#\s*define\s+)re"};
+  const std::regex namespace_name{R"re(\s*namespace\b(.*))re"};
+  // These are searched for rather than matched.
+  const std::regex iwyu_pragma_associated{R"re(IWYU\s*pragma:\s*associated)re"};
+  const std::regex barrier_include{R"re(^\s*#\s*include\s+(<linux/))re"};
+  const std::regex iwyu_namespace{R"re(namespace ([^{]*) \{ )re"};
+  const std::regex iwyu_classname{R"re(\{ ([^{}]*) \})re"};
+  const std::regex symbol_name{R"re([A-Za-z0-9_]+)re"};
+};
+
+const Regexes& Re() {
+  static const Regexes* const regexes = new Regexes;
+  return *regexes;
+}
+
+bool Match(const string& str, const std::regex& re,
+           std::smatch* match = nullptr) {
+  std::smatch unused;
+  return std::regex_search(str, match ? *match : unused, re,
+                           std::regex_constants::match_continuous);
+}
+
+bool Search(const string& str, const std::regex& re) {
+  return std::regex_search(str, re);
+}
+
+// Returns all the matches of re in str, or of its group if it has one,
+// like Python's re.findall.
+vector<string> FindAll(const string& str, const std::regex& re) {
+  vector<string> found;
+  for (std::sregex_iterator it(str.begin(), str.end(), re), end; it != end;
+       ++it) {
+    found.push_back((*it)[(*it).size() > 1 ? 1 : 0].str());
+  }
+  return found;
+}
+
+string StripComments(const string& str) {
+  return std::regex_replace(str, Re().comment, "");
+}
+
+int Count(StringRef str, char c) {
+  return static_cast<int>(str.count(c));
+}
+
+string Join(const vector<string>& parts, StringRef separator) {
+  string joined;
+  for (size_t i = 0; i < parts.size(); ++i) {
+    if (i > 0)
+      joined += separator.str();
+    joined += parts[i];
+  }
+  return joined;
+}
+
+// A line of the file being fixed, or a line to add to it, and what we
+// learn about it.
+struct LineInfo {
+  // The dummy line 0, which is always deleted.
+  LineInfo() : deleted(true) {
+  }
+
+  explicit LineInfo(StringRef file_line)
+      : line(file_line.str()), text(file_line.rtrim("\r\n").str()) {
+  }
+
+  // The line as in the file, with its line terminator.
+  string line;
+  // The line without its terminator, to match against.
+  string text;
+  LineType type = LineType::None;
+  // True if no line before this one has the same type.
+  bool is_first_line_of_this_type = false;
+  bool deleted = false;
+  // For #includes and forward-declares: the span of the line with the
+  // comments preceding it, and the span of the block of #includes and
+  // forward-declares it is in.  Other lines may have an arbitrary value.
+  optional<Span> move_span;
+  optional<Span> reorder_span;
+  // For #includes, the included file, with its ""s or <>s.
+  string key;
+  bool is_nested_forward_declaration = false;
+};
+
+bool IsNamespaceStart(LineType type) {
+  return type == LineType::NamespaceStart ||
+         type == LineType::NamespaceStartAllman ||
+         type == LineType::NamespaceStartMixed;
+}
+
+// Splits contents into lines that keep their line terminators, like
+// Python's splitlines(true) does for the ASCII line breaks.
+vector<LineInfo> ParseLines(StringRef contents) {
+  vector<LineInfo> file_lines(1);  // the dummy line 0
+  while (!contents.empty()) {
+    size_t end = contents.find_first_of("\n\r\v\f\x1c\x1d\x1e");
+    if (end == StringRef::npos) {
+      end = contents.size();
+    } else if (contents.substr(end, 2) == "\r\n") {
+      end += 2;
+    } else {
+      end += 1;
+    }
+    file_lines.emplace_back(contents.substr(0, end));
+    contents = contents.substr(end);
+  }
+  return file_lines;
+}
+
+// Returns the type of a line outside comments, and sets *key for
+// #includes.
+LineType GetLineType(const string& text, string* key) {
+  const Regexes& re = Re();
+  // The header-guard types depend on the lines around; they are set by
+  // MarkHeaderGuardIfPresent.  Forward-declares come from iwyu.
+  const pair<LineType, const std::regex*> line_types[] = {
+      {LineType::Comment, &re.comment_line},
+      {LineType::Blank, &re.blank_line},
+      {LineType::NamespaceStart, &re.namespace_start},
+      {LineType::NamespaceStartAllman, &re.namespace_start_allman},
+      {LineType::NamespaceStartMixed, &re.namespace_start_mixed},
+      {LineType::NamespaceEnd, &re.namespace_end},
+      {LineType::If, &re.if_line},
+      {LineType::Else, &re.else_line},
+      {LineType::Endif, &re.endif_line},
+      {LineType::Include, &re.include},
+      {LineType::PragmaOnce, &re.pragma_once_line},
+      {LineType::PragmaPush, &re.pragma_push_line},
+      {LineType::PragmaPop, &re.pragma_pop_line},
+  };
+  for (const auto& [type, type_re] : line_types) {
+    std::smatch match;
+    if (Match(text, *type_re, &match)) {
+      if (type == LineType::Include)
+        *key = match[1].str();
+      return type;
+    }
+  }
+  return LineType::None;
+}
+
+// Marks an #ifdef covering the whole file, usually a header guard, and
+// the #define after it.
+void MarkHeaderGuardIfPresent(vector<LineInfo>* file_lines) {
+  vector<LineInfo>& lines = *file_lines;
+  // Pass over blank lines, pragmas and comments at the top of the file.
+  size_t ifdef_start = 0;
+  for (; ifdef_start < lines.size(); ++ifdef_start) {
+    const LineInfo& line_info = lines[ifdef_start];
+    if (!line_info.deleted && line_info.type != LineType::Comment &&
+        line_info.type != LineType::Blank &&
+        line_info.type != LineType::PragmaOnce) {
+      break;
+    }
+  }
+  if (ifdef_start == lines.size() || lines[ifdef_start].type != LineType::If)
+    return;
+
+  // Find the end of this #ifdef, to see if it's really a header guard.
+  int ifdef_depth = 0;
+  size_t ifdef_end = ifdef_start;
+  for (; ifdef_end < lines.size(); ++ifdef_end) {
+    if (lines[ifdef_end].deleted)
+      continue;
+    if (lines[ifdef_end].type == LineType::If) {
+      ++ifdef_depth;
+    } else if (lines[ifdef_end].type == LineType::Endif) {
+      if (--ifdef_depth == 0)
+        break;
+    }
+  }
+  if (ifdef_end == lines.size())
+    return;
+
+  // All the lines after the end of the #ifdef must be blank or comments.
+  for (size_t i = ifdef_end + 1; i < lines.size(); ++i) {
+    if (!lines[i].deleted && lines[i].type != LineType::Comment &&
+        lines[i].type != LineType::Blank) {
+      return;
+    }
+  }
+
+  lines[ifdef_start].type = LineType::HeaderGuard;
+  if (Match(lines[ifdef_start + 1].text, Re().header_guard_define))
+    lines[ifdef_start + 1].type = LineType::HeaderGuardDefine;
+}
+
+// Sets the type and key of each line, and checks what record says
+// about them.
+bool CalculateLineTypesAndKeys(const FixIncludesRecord& record,
+                               vector<LineInfo>* file_lines, string* error) {
+  vector<LineInfo>& lines = *file_lines;
+  set<LineType> seen_types;
+  bool in_c_style_comment = false;
+  bool in_allman_or_mixed_namespace = false;
+  for (size_t i = 0; i < lines.size(); ++i) {
+    LineInfo& line_info = lines[i];
+    std::smatch match;
+    if (i == 0) {
+      line_info.type = LineType::None;
+    } else if (Match(line_info.text, Re().c_comment_start)) {
+      // Only comments at the start of a line count.
+      if (!Match(line_info.text, Re().c_comment_end, &match)) {
+        line_info.type = LineType::Comment;
+        in_c_style_comment = true;
+      } else if (match[1].length() == 0) {
+        line_info.type = LineType::Comment;
+      } else {
+        line_info.type = LineType::None;  // code follows the comment
+      }
+    } else if (in_c_style_comment &&
+               Match(line_info.text, Re().c_comment_end)) {
+      line_info.type = LineType::Comment;
+      in_c_style_comment = false;
+    } else if (in_c_style_comment) {
+      line_info.type = LineType::Comment;
+    } else if (in_allman_or_mixed_namespace &&
+               Match(line_info.text, Re().namespace_continue_allman_mixed)) {
+      in_allman_or_mixed_namespace = false;
+      line_info.type = LineType::NamespaceContinueAllmanMixed;
+    } else {
+      line_info.type = GetLineType(line_info.text, &line_info.key);
+      if (line_info.type == LineType::NamespaceStartAllman ||
+          line_info.type == LineType::NamespaceStartMixed) {
+        in_allman_or_mixed_namespace = true;  // look for the next {
+      }
+    }
+    line_info.is_first_line_of_this_type =
+        seen_types.insert(line_info.type).second;
+  }
+
+  const int num_lines = static_cast<int>(lines.size());
+  for (int line_number : record.some_include_lines) {
+    if (line_number >= num_lines ||
+        lines[line_number].type != LineType::Include) {
+      *error = "line " + std::to_string(line_number) + " is not an #include";
+      return false;
+    }
+  }
+  // We depend entirely on the record for the forward-declare lines.
+  for (const auto& [start_line, end_line] : record.seen_forward_declare_lines) {
+    if (end_line > num_lines) {
+      *error = "line " + std::to_string(end_line - 1) + " is past file-end";
+      return false;
+    }
+    for (int line_number = start_line; line_number < end_line; ++line_number)
+      lines[line_number].type = LineType::ForwardDeclare;
+  }
+  for (const auto& [start_line, end_line] :
+       record.nested_forward_declare_lines) {
+    if (end_line > num_lines) {
+      *error = "line " + std::to_string(end_line - 1) + " is past file-end";
+      return false;
+    }
+    for (int line_number = start_line; line_number < end_line; ++line_number)
+      lines[line_number].is_nested_forward_declaration = true;
+  }
+  for (int line_number : record.lines_to_delete) {
+    if (line_number >= num_lines) {
+      *error = "line " + std::to_string(line_number) + " is past file-end";
+      return false;
+    }
+    if (lines[line_number].type != LineType::Include &&
+        lines[line_number].type != LineType::ForwardDeclare) {
+      *error = "line " + std::to_string(line_number) +
+               " is not an #include or forward declare";
+      return false;
+    }
+  }
+
+  MarkHeaderGuardIfPresent(file_lines);
+  return true;
+}
+
+// Returns the previous or next line that isn't deleted, or -1.
+int PreviousNondeletedLine(const vector<LineInfo>& lines, int line_number) {
+  for (--line_number; line_number >= 0; --line_number) {
+    if (!lines[line_number].deleted)
+      return line_number;
+  }
+  return -1;
+}
+
+int NextNondeletedLine(const vector<LineInfo>& lines, int line_number) {
+  for (++line_number; line_number < static_cast<int>(lines.size());
+       ++line_number) {
+    if (!lines[line_number].deleted)
+      return line_number;
+  }
+  return -1;
+}
+
+// Returns the first line of the comments right before line_number, or
+// line_number if there are none, or if they start at the top of the file
+// (and so are probably a copyright notice).
+int LineNumberStartingPrecedingComments(const vector<LineInfo>& lines,
+                                        int line_number) {
+  int retval = line_number;
+  while (retval > 0 && lines[retval - 1].type == LineType::Comment)
+    --retval;
+  if (retval <= 1)
+    retval = line_number;
+  return retval;
+}
+
+// Sets the move span of each #include and forward-declare: the line with
+// the comments before it, which move (or go) together.
+void CalculateMoveSpans(const set<Span>& forward_declare_spans,
+                        vector<LineInfo>* file_lines) {
+  vector<LineInfo>& lines = *file_lines;
+  for (int line_number = 0; line_number < static_cast<int>(lines.size());
+       ++line_number) {
+    if (lines[line_number].type == LineType::Include) {
+      const int span_begin =
+          LineNumberStartingPrecedingComments(lines, line_number);
+      for (int i = span_begin; i <= line_number; ++i)
+        lines[i].move_span = Span(span_begin, line_number + 1);
+    }
+  }
+  for (auto [span_begin, span_end] : forward_declare_spans) {
+    span_begin = LineNumberStartingPrecedingComments(lines, span_begin);
+    for (int i = span_begin; i < span_end; ++i)
+      lines[i].move_span = Span(span_begin, span_end);
+  }
+}
+
+bool ContainsBarrierInclude(const vector<LineInfo>& lines, Span span) {
+  for (int line_number = span.first; line_number < span.second;
+       ++line_number) {
+    if (!lines[line_number].deleted &&
+        Search(lines[line_number].text, Re().barrier_include)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool LinesAreAllBlank(const vector<LineInfo>& lines, int start_line,
+                      int end_line) {
+  for (int line_number = start_line; line_number < end_line; ++line_number) {
+    if (!lines[line_number].deleted &&
+        lines[line_number].type != LineType::Blank) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Sets the reorder span of each #include and forward-declare: the block
+// of move spans, joined only by blank lines, that it is part of.  Lines
+// are only ever moved within their reorder span.  A barrier #include is
+// in a reorder span of its own.
+void CalculateReorderSpans(vector<LineInfo>* file_lines) {
+  vector<LineInfo>& lines = *file_lines;
+  set<Span> move_span_set;
+  for (const LineInfo& line_info : lines) {
+    if (line_info.move_span)
+      move_span_set.insert(*line_info.move_span);
+  }
+  const vector<Span> move_spans(move_span_set.begin(), move_span_set.end());
+
+  for (size_t i = 0; i < move_spans.size(); ++i) {
+    const int reorder_span_start = move_spans[i].first;
+    if (!ContainsBarrierInclude(lines, move_spans[i])) {
+      while (i + 1 < move_spans.size() &&
+             LinesAreAllBlank(lines, move_spans[i].second,
+                              move_spans[i + 1].first) &&
+             !ContainsBarrierInclude(lines, move_spans[i + 1])) {
+        ++i;
+      }
+    }
+    const int reorder_span_end = move_spans[i].second;
+    for (int line_number = reorder_span_start; line_number < reorder_span_end;
+         ++line_number) {
+      lines[line_number].reorder_span =
+          Span(reorder_span_start, reorder_span_end);
+    }
+  }
+}
+
+// Deletes the lines from first_line on, up to end_line, with the
+// comments and blank lines before them.
+void DeleteBlock(int first_line, int end_line, vector<LineInfo>* file_lines) {
+  vector<LineInfo>& lines = *file_lines;
+  first_line = LineNumberStartingPrecedingComments(lines, first_line);
+  while (first_line > 0 && lines[first_line - 1].type == LineType::Blank)
+    --first_line;
+  for (int line_number = first_line; line_number < end_line; ++line_number)
+    lines[line_number].deleted = true;
+}
+
+// Deletes namespaces left with nothing in them, and returns how many.
+int DeleteEmptyNamespaces(vector<LineInfo>* file_lines) {
+  vector<LineInfo>& lines = *file_lines;
+  const int num_lines = static_cast<int>(lines.size());
+  int num_namespaces_deleted = 0;
+  int start_line = 0;
+  while (start_line < num_lines) {
+    const LineInfo& start_info = lines[start_line];
+    if (start_info.deleted || !IsNamespaceStart(start_info.type)) {
+      ++start_line;
+      continue;
+    }
+    // Several namespaces can start on one line, or none, for a macro.
+    // For Allman namespaces, the depth goes up at the brace.
+    int namespace_depth = 0;
+    if (start_info.type != LineType::NamespaceStartAllman)
+      namespace_depth = std::max(Count(start_info.line, '{'), 1);
+
+    int end_line = start_line + 1;
+    while (end_line < num_lines) {
+      const LineInfo& line_info = lines[end_line];
+      if (line_info.deleted || line_info.type == LineType::Comment ||
+          line_info.type == LineType::Blank ||
+          line_info.type == LineType::NamespaceStartAllman) {
+        ++end_line;
+      } else if (line_info.type == LineType::NamespaceContinueAllmanMixed) {
+        ++namespace_depth;
+        ++end_line;
+      } else if (line_info.type == LineType::NamespaceStart ||
+                 line_info.type == LineType::NamespaceStartMixed) {
+        namespace_depth += std::max(Count(line_info.line, '{'), 1);
+        ++end_line;
+      } else if (line_info.type == LineType::NamespaceEnd) {
+        namespace_depth -= std::max(Count(line_info.line, '}'), 1);
+        ++end_line;
+        if (namespace_depth <= 0) {
+          DeleteBlock(start_line, end_line, file_lines);
+          ++num_namespaces_deleted;
+          break;
+        }
+      } else {
+        // Not an empty namespace; try again with the nested ones.
+        end_line = start_line + 1;
+        break;
+      }
+    }
+    start_line = end_line;
+  }
+  return num_namespaces_deleted;
+}
+
+// Deletes #ifdefs left with nothing in them (on either side of an
+// #else), and returns how many.
+int DeleteEmptyIfdefs(vector<LineInfo>* file_lines) {
+  vector<LineInfo>& lines = *file_lines;
+  const int num_lines = static_cast<int>(lines.size());
+  int num_ifdefs_deleted = 0;
+  int start_line = 0;
+  while (start_line < num_lines) {
+    if (lines[start_line].type != LineType::If &&
+        lines[start_line].type != LineType::HeaderGuard) {
+      ++start_line;
+      continue;
+    }
+    int end_line = start_line + 1;
+    while (end_line < num_lines) {
+      const LineInfo& line_info = lines[end_line];
+      if (line_info.deleted || line_info.type == LineType::Else ||
+          line_info.type == LineType::Comment ||
+          line_info.type == LineType::Blank) {
+        ++end_line;
+      } else if (line_info.type == LineType::Endif) {
+        ++end_line;
+        DeleteBlock(start_line, end_line, file_lines);
+        ++num_ifdefs_deleted;
+        break;
+      } else {
+        // Not an empty #ifdef; try again with the nested ones.
+        end_line = start_line + 1;
+        break;
+      }
+    }
+    start_line = end_line;
+  }
+  return num_ifdefs_deleted;
+}
+
+// Deletes the move spans in line_ranges that repeat an earlier one,
+// ignoring comments.
+void DeleteDuplicateLines(const vector<Span>& line_ranges,
+                          vector<LineInfo>* file_lines) {
+  vector<LineInfo>& lines = *file_lines;
+  set<string> seen_lines;
+  for (const Span& line_range : line_ranges) {
+    for (int line_number = line_range.first; line_number < line_range.second;
+         ++line_number) {
+      const LineInfo& line_info = lines[line_number];
+      if (line_info.type == LineType::Blank ||
+          line_info.type == LineType::Comment || !line_info.move_span ||
+          line_number != line_info.move_span->first) {
+        continue;
+      }
+      const Span move_span = *line_info.move_span;
+      vector<string> uncommented_lines;
+      for (int i = move_span.first; i < move_span.second; ++i) {
+        uncommented_lines.push_back(
+            StripComments(StringRef(lines[i].line).trim().str()));
+      }
+      const string uncommented_span = Join(uncommented_lines, " ");
+      if (seen_lines.count(uncommented_span)) {
+        for (int i = move_span.first; i < move_span.second; ++i)
+          lines[i].deleted = true;
+      } else if (!line_info.deleted) {
+        seen_lines.insert(uncommented_span);
+      }
+    }
+  }
+}
+
+// If the whole of line_range is deleted and leaves blank lines on both
+// sides, deletes the extra ones after it.
+void DeleteExtraneousBlankLines(Span line_range,
+                                vector<LineInfo>* file_lines) {
+  vector<LineInfo>& lines = *file_lines;
+  for (int line_number = line_range.first; line_number < line_range.second;
+       ++line_number) {
+    if (!lines[line_number].deleted)
+      return;
+  }
+
+  int before_line = PreviousNondeletedLine(lines, line_range.first);
+  int after_line = NextNondeletedLine(lines, line_range.second - 1);
+  while (before_line > 0 && lines[before_line].type == LineType::Blank &&
+         after_line > 0 && lines[after_line].type == LineType::Blank) {
+    lines[after_line].deleted = true;
+    before_line = PreviousNondeletedLine(lines, before_line);
+    after_line = NextNondeletedLine(lines, after_line);
+  }
+}
+
+// Returns the reorder spans that are not inside an #ifdef (other than
+// the header guard) or a namespace, in order.
+vector<Span> GetToplevelReorderSpans(const vector<LineInfo>& lines) {
+  const size_t num_lines = lines.size();
+  vector<bool> in_ifdef(num_lines, false);
+  int ifdef_depth = 0;
+  for (size_t line_number = 0; line_number < num_lines; ++line_number) {
+    const LineInfo& line_info = lines[line_number];
+    if (line_info.deleted)
+      continue;
+    if (line_info.type == LineType::If) {
+      ++ifdef_depth;
+    } else if (line_info.type == LineType::Endif) {
+      --ifdef_depth;
+    }
+    if (ifdef_depth > 0)
+      in_ifdef[line_number] = true;
+  }
+
+  // Telling whether a } ends a namespace is hard, so after the first
+  // contentful line inside a namespace, all the rest of the file is
+  // taken to be in the namespace.
+  vector<bool> in_namespace(num_lines, false);
+  int namespace_depth = 0;
+  for (size_t line_number = 0; line_number < num_lines; ++line_number) {
+    const LineInfo& line_info = lines[line_number];
+    if (line_info.deleted)
+      continue;
+    if (line_info.type == LineType::NamespaceStart ||
+        line_info.type == LineType::NamespaceStartMixed) {
+      namespace_depth += std::max(Count(line_info.line, '{'), 1);
+    } else if (line_info.type == LineType::NamespaceContinueAllmanMixed) {
+      ++namespace_depth;
+    } else if (line_info.type == LineType::NamespaceEnd) {
+      namespace_depth -= std::max(Count(line_info.line, '}'), 1);
+    }
+    if (namespace_depth > 0) {
+      in_namespace[line_number] = true;
+      if (line_info.type == LineType::None) {
+        std::fill(in_namespace.begin() + line_number, in_namespace.end(),
+                  true);
+        break;
+      }
+    }
+  }
+
+  set<Span> reorder_spans;
+  for (const LineInfo& line_info : lines) {
+    if (line_info.reorder_span)
+      reorder_spans.insert(*line_info.reorder_span);
+  }
+  vector<Span> good_reorder_spans;
+  for (const Span& reorder_span : reorder_spans) {
+    bool good = true;
+    for (int line_number = reorder_span.first;
+         line_number < reorder_span.second; ++line_number) {
+      if (in_ifdef[line_number] || in_namespace[line_number] ||
+          lines[line_number].is_nested_forward_declaration) {
+        good = false;
+        break;
+      }
+    }
+    if (good)
+      good_reorder_spans.push_back(reorder_span);
+  }
+  return good_reorder_spans;
+}
+
+// Returns the names of the namespaces a namespace line opens, with ""
+// for an anonymous one.
+vector<string> GetNamespaceNames(const string& namespace_line) {
+  vector<string> namespaces;
+  const string without_comments =
+      namespace_line.substr(0, namespace_line.find('/'));
+  for (const string& part : Split(without_comments, "{", 0)) {
+    std::smatch match;
+    if (Match(part, Re().namespace_name, &match))
+      namespaces.push_back(StringRef(match[1].str()).trim().str());
+  }
+  return namespaces;
+}
+
+// For a file that starts with #includes and forward-declares and then
+// opens namespaces, returns where forward-declares in each of those
+// namespaces go: the reorder span of the ones already there, or the line
+// after the namespace starts.  Each comes with its namespaces as iwyu
+// writes them, e.g. "namespace ns1 { namespace ns2 {", and the longest
+// come first.  Stops at the first contentful line, or at anything it
+// doesn't understand.
+vector<pair<string, optional<Span>>> GetNamespaceLevelReorderSpans(
+    const vector<LineInfo>& lines) {
+  map<string, optional<Span>> namespace_reorder_spans;
+  vector<string> namespace_prefixes;
+  string pending_namespace_prefix;
+  int ifdef_depth = 0;
+  for (int line_number = 0; line_number < static_cast<int>(lines.size());
+       ++line_number) {
+    const LineInfo& line_info = lines[line_number];
+    if (line_info.deleted)
+      continue;
+
+    const LineType type = line_info.type;
+    if (type == LineType::Comment || type == LineType::Blank ||
+        type == LineType::Include || type == LineType::HeaderGuard ||
+        type == LineType::HeaderGuardDefine ||
+        type == LineType::PragmaOnce || type == LineType::Else) {
+      continue;
+    } else if (type == LineType::If) {
+      ++ifdef_depth;
+    } else if (type == LineType::Endif) {
+      --ifdef_depth;
+    } else if (ifdef_depth != 0) {
+      continue;  // only namespaces outside #ifdefs count
+    } else if (type == LineType::NamespaceStart) {
+      for (const string& ns : GetNamespaceNames(line_info.text)) {
+        namespace_prefixes.push_back(ns.empty() ? "namespace {"
+                                                : "namespace " + ns + " {");
+      }
+      namespace_reorder_spans[Join(namespace_prefixes, " ")] =
+          Span(line_number + 1, line_number + 1);
+    } else if (type == LineType::NamespaceStartAllman) {
+      const vector<string> namespaces = GetNamespaceNames(line_info.text);
+      if (namespaces.size() != 1)
+        break;
+      pending_namespace_prefix = namespaces[0].empty()
+                                     ? "namespace"
+                                     : "namespace " + namespaces[0];
+    } else if (type == LineType::NamespaceStartMixed) {
+      // All but the last namespace are opened on this line.
+      const vector<string> namespaces = GetNamespaceNames(line_info.text);
+      if (namespaces.empty())
+        break;
+      for (size_t i = 0; i + 1 < namespaces.size(); ++i) {
+        namespace_prefixes.push_back(namespaces[i].empty()
+                                         ? "namespace {"
+                                         : "namespace " + namespaces[i] + " {");
+      }
+      pending_namespace_prefix = namespaces.back().empty()
+                                     ? "namespace"
+                                     : "namespace " + namespaces.back();
+    } else if (type == LineType::NamespaceContinueAllmanMixed) {
+      if (pending_namespace_prefix.empty())
+        break;
+      pending_namespace_prefix += " {";
+      namespace_prefixes.push_back(pending_namespace_prefix);
+      namespace_reorder_spans[Join(namespace_prefixes, " ")] =
+          Span(line_number + 1, line_number + 1);
+    } else if (type == LineType::NamespaceEnd) {
+      // Like Python's prefixes[:-count], which drops them all for 0.
+      const size_t namespace_end_count = Count(
+          StringRef(line_info.text).substr(0, line_info.text.find('/')), '}');
+      if (namespace_end_count == 0 ||
+          namespace_end_count >= namespace_prefixes.size()) {
+        namespace_prefixes.clear();
+      } else {
+        namespace_prefixes.resize(namespace_prefixes.size() -
+                                  namespace_end_count);
+      }
+    } else if (type == LineType::ForwardDeclare) {
+      if (!namespace_prefixes.empty()) {
+        namespace_reorder_spans[Join(namespace_prefixes, " ")] =
+            line_info.reorder_span;
+      }
+    } else {
+      break;  // contentful code, or a #pragma push or pop
+    }
+  }
+  return vector<pair<string, optional<Span>>>(namespace_reorder_spans.rbegin(),
+                                              namespace_reorder_spans.rend());
+}
+
+// Returns whether line_info is an #include of the header associated with
+// filename, e.g. foo.h or foo-inl.h for foo.cc or foo_test.cc.
+bool IsMainCUInclude(const LineInfo& line_info, const string& filename) {
+  if (line_info.type != LineType::Include || line_info.key[0] == '<')
+    return false;
+  if (Search(line_info.line, Re().iwyu_pragma_associated))
+    return true;
+
+  string canonical_include = line_info.key;
+  ReplaceAll(&canonical_include, "\"", "");
+  const string lowercase_include = StringRef(canonical_include).lower();
+  for (StringRef suffix : {"-inl.h", ".hpp", ".h"}) {
+    if (EndsWith(lowercase_include, suffix)) {
+      canonical_include.resize(canonical_include.size() - suffix.size());
+      break;
+    }
+  }
+
+  // Strip the extension (not a leading dot) and test suffixes.
+  string canonical_file = filename;
+  const size_t basename_start = canonical_file.rfind('/') + 1;
+  const size_t extension_start = canonical_file.rfind('.');
+  if (extension_start != string::npos && extension_start > basename_start &&
+      canonical_file.find_first_not_of('.', basename_start) <
+          extension_start) {
+    canonical_file.resize(extension_start);
+  }
+  for (StringRef suffix : {"_unittest", "_regtest", "_test"}) {
+    if (StripRight(&canonical_file, suffix))
+      break;
+  }
+  // .h files in /public/ match .cc files in /internal/.
+  string canonical_include2 = canonical_include;
+  ReplaceAll(&canonical_include2, "/public/", "/internal/");
+
+  if (canonical_file == canonical_include ||
+      canonical_file == canonical_include2) {
+    return true;
+  }
+  // The first #include may also match on the basename.
+  return line_info.is_first_line_of_this_type &&
+         Basename(canonical_file) == Basename(canonical_include);
+}
+
+LineKind GetLineKind(const LineInfo& line_info, const string& filename) {
+  const bool is_system_include =
+      line_info.type == LineType::Include && line_info.key[0] == '<';
+  if (line_info.deleted)
+    return kNoKind;
+  if (IsMainCUInclude(line_info, filename))
+    return kMainCUIncludeKind;
+  if (is_system_include &&
+      StripComments(line_info.line).find('.') != string::npos)
+    return kCSystemIncludeKind;
+  if (is_system_include)
+    return kCXXSystemIncludeKind;
+  if (line_info.type == LineType::Include)
+    return kNonsystemIncludeKind;
+  if (line_info.type == LineType::ForwardDeclare)
+    return kForwardDeclareKind;
+  return kNoKind;
+}
+
+int GetLineSortOrdinal(LineKind kind, bool quoted_includes_first) {
+  if (!quoted_includes_first)
+    return kind;
+  // Quoted kinds go before system ones.
+  switch (kind) {
+    case kNonsystemIncludeKind:
+      return 2;
+    case kCSystemIncludeKind:
+      return 3;
+    case kCXXSystemIncludeKind:
+      return 4;
+    default:
+      return kind;
+  }
+}
+
+// Returns the reorder span a new line of kind goes into: the first with
+// lines of that kind, else the last with lines of a kind that sorts
+// before, else the first with #includes of a kind that sorts after.
+// Failing all those, returns an empty span at the first line after the
+// leading comments, blank lines and header guard, unless that is in the
+// forward-declares' span, in which case it returns that.  Forward-declares
+// after contentful code are never considered.
+Span FirstReorderSpanWith(const vector<LineInfo>& lines,
+                          const vector<Span>& good_reorder_spans,
+                          LineKind kind, const string& filename) {
+  // The first contentful line is the first one not in a reorder span.
+  int first_contentful_line = 0;
+  if (!good_reorder_spans.empty())
+    first_contentful_line = good_reorder_spans.back().second;
+  for (size_t i = 0; i + 1 < good_reorder_spans.size(); ++i) {
+    if (good_reorder_spans[i].second != good_reorder_spans[i + 1].first) {
+      first_contentful_line = good_reorder_spans[i].second;
+      break;
+    }
+  }
+
+  map<int, Span> first_reorder_spans;
+  map<int, Span> last_reorder_spans;
+  for (const Span& reorder_span : good_reorder_spans) {
+    for (int line_number = reorder_span.first;
+         line_number < reorder_span.second; ++line_number) {
+      const LineKind line_kind = GetLineKind(lines[line_number], filename);
+      if (line_kind == kForwardDeclareKind &&
+          line_number > first_contentful_line) {
+        continue;
+      }
+      if (line_kind != kNoKind) {
+        first_reorder_spans.emplace(line_kind, reorder_span);
+        last_reorder_spans[line_kind] = reorder_span;
+      }
+    }
+  }
+
+  if (first_reorder_spans.count(kind))
+    return first_reorder_spans[kind];
+  for (int backup_kind = kind - 1; backup_kind >= kMainCUIncludeKind;
+       --backup_kind) {
+    if (last_reorder_spans.count(backup_kind))
+      return last_reorder_spans[backup_kind];
+  }
+  for (int backup_kind = kind + 1; backup_kind < kForwardDeclareKind;
+       ++backup_kind) {
+    if (first_reorder_spans.count(backup_kind))
+      return first_reorder_spans[backup_kind];
+  }
+
+  const int num_lines = static_cast<int>(lines.size());
+  int line_number = 0;
+  bool seen_header_guard = false;
+  while (line_number < num_lines) {
+    const LineInfo& line_info = lines[line_number];
+    if (line_info.deleted || line_info.type == LineType::Blank) {
+      ++line_number;
+    } else if (line_info.type == LineType::HeaderGuard) {
+      seen_header_guard = true;
+      line_number += 2;  // the #ifndef and the #define
+    } else if (line_info.type == LineType::PragmaOnce) {
+      seen_header_guard = true;
+      ++line_number;
+    } else if (line_info.type == LineType::Comment && !seen_header_guard) {
+      // Comments inside the header guard are no longer top-of-file
+      // comments, so new lines go before them.
+      ++line_number;
+    } else {
+      // Only forward-declare spans are left, if any.
+      const auto fwd_decl_span = first_reorder_spans.find(kForwardDeclareKind);
+      if (fwd_decl_span != first_reorder_spans.end() &&
+          line_number >= fwd_decl_span->second.first) {
+        return fwd_decl_span->second;
+      }
+      return Span(line_number, line_number);
+    }
+  }
+  return Span(num_lines, num_lines);
+}
+
+// Returns fwd_decl_line without the namespaces in namespace_prefix, e.g.
+// "namespace ns3 { class Foo; }" for "namespace ns1 { namespace ns3 {
+// class Foo; } }" and "namespace ns1 {", or "" if it isn't in them.
+string RemoveNamespacePrefix(const string& fwd_decl_line,
+                             const string& namespace_prefix) {
+  if (!StartsWith(fwd_decl_line, namespace_prefix))
+    return "";
+  StringRef rest = StringRef(fwd_decl_line).substr(namespace_prefix.size());
+  rest = rest.ltrim();
+  // Remove one } (and the space before it) for each namespace.
+  StringRef without_braces = rest.rtrim();
+  for (int i = Count(namespace_prefix, '{'); i > 0; --i) {
+    if (!EndsWith(without_braces, "}"))
+      return "";
+    without_braces = without_braces.drop_back().rtrim();
+  }
+  return without_braces.str();
+}
+
+// A move span, with what it is sorted by, and its lines as they are
+// written out.
+struct DecoratedMoveSpan {
+  Span reorder_span;
+  LineKind kind;
+  vector<string> all_lines;
+};
+
+// Returns move_span_lines, the lines of a move span or a line to add,
+// decorated with the reorder span it goes in, or nullopt if it has been
+// deleted.
+optional<DecoratedMoveSpan> DecoratedMoveSpanLines(
+    const FixIncludesRecord& record, const vector<LineInfo>& file_lines,
+    ArrayRef<LineInfo> move_span_lines) {
+  size_t first_contentful_line = 0;
+  for (; first_contentful_line < move_span_lines.size();
+       ++first_contentful_line) {
+    const LineInfo& line_info = move_span_lines[first_contentful_line];
+    if (!line_info.deleted && (line_info.type == LineType::Include ||
+                               line_info.type == LineType::ForwardDeclare)) {
+      break;
+    }
+  }
+  if (first_contentful_line == move_span_lines.size())
+    return std::nullopt;
+
+  const LineInfo& firstline = move_span_lines[first_contentful_line];
+  DecoratedMoveSpan decorated;
+  for (const LineInfo& line_info : move_span_lines) {
+    if (!line_info.deleted)
+      decorated.all_lines.push_back(line_info.line);
+  }
+  decorated.kind = GetLineKind(firstline, record.filename);
+
+  optional<Span> reorder_span = firstline.reorder_span;
+  if (!reorder_span) {
+    // A new line.  A forward-declare goes with those in its namespace,
+    // if there are any.
+    if (decorated.kind == kForwardDeclareKind) {
+      for (const auto& [namespace_prefix, possible_reorder_span] :
+           GetNamespaceLevelReorderSpans(file_lines)) {
+        if (namespace_prefix.empty() || !possible_reorder_span ||
+            !StartsWith(firstline.line, namespace_prefix)) {
+          continue;
+        }
+        const string new_firstline =
+            RemoveNamespacePrefix(firstline.line, namespace_prefix);
+        if (!new_firstline.empty()) {
+          decorated.all_lines[first_contentful_line] = new_firstline;
+          reorder_span = possible_reorder_span;
+          break;
+        }
+      }
+    }
+    if (!reorder_span) {
+      reorder_span =
+          FirstReorderSpanWith(file_lines, GetToplevelReorderSpans(file_lines),
+                               decorated.kind, record.filename);
+    }
+  }
+  decorated.reorder_span = *reorder_span;
+  return decorated;
+}
+
+// Returns whether to put a blank line between two decorated move spans:
+// at the end of a reorder span, if code or a namespace follows; else
+// between different kinds, except C and C++ system #includes.
+bool ShouldInsertBlankLine(const DecoratedMoveSpan& decorated_move_span,
+                           const DecoratedMoveSpan& next_decorated_move_span,
+                           const vector<LineInfo>& lines) {
+  if (decorated_move_span.reorder_span !=
+      next_decorated_move_span.reorder_span) {
+    const int num_lines = static_cast<int>(lines.size());
+    int next_line =
+        NextNondeletedLine(lines, decorated_move_span.reorder_span.second - 1);
+    while (next_line > 0 && next_line < num_lines &&
+           lines[next_line].type == LineType::Comment) {
+      ++next_line;
+    }
+    if (next_line <= 0 || next_line >= num_lines)
+      return false;
+    const LineType type = lines[next_line].type;
+    return IsNamespaceStart(type) || type == LineType::PragmaPush ||
+           type == LineType::None;
+  }
+
+  const LineKind this_kind = decorated_move_span.kind;
+  const LineKind next_kind = next_decorated_move_span.kind;
+  if (this_kind == next_kind || next_kind == kEOFKind)
+    return false;
+  auto is_system_kind = [](LineKind kind) {
+    return kind == kCSystemIncludeKind || kind == kCXXSystemIncludeKind;
+  };
+  if (is_system_kind(this_kind) && is_system_kind(next_kind))
+    return false;
+  return true;
+}
+
+// Turns the namespaced forward-declares iwyu writes on one line, e.g.
+//    namespace foo { namespace bar { class A; } }
+//    namespace foo { namespace bar { class B; } }
+// into one line per namespace and class:
+//    namespace foo {
+//    namespace bar {
+//    class A;
+//    class B;
+//    }  // namespace bar
+//    }  // namespace foo
+// Returns false if a line is malformed.
+bool NormalizeNamespaceForwardDeclareLines(vector<string>* lines) {
+  vector<string> retval;
+  vector<string> current_namespaces;
+  // A blank line at the end closes the last namespaces.
+  lines->push_back("");
+  for (const string& line : *lines) {
+    const vector<string> namespaces_in_line =
+        FindAll(line, Re().iwyu_namespace);
+    size_t differ_pos = 0;
+    while (differ_pos < namespaces_in_line.size() &&
+           differ_pos < current_namespaces.size() &&
+           namespaces_in_line[differ_pos] == current_namespaces[differ_pos]) {
+      ++differ_pos;
+    }
+    for (size_t i = current_namespaces.size(); i > differ_pos; --i)
+      retval.push_back("}  // namespace " + current_namespaces[i - 1]);
+    for (size_t i = differ_pos; i < namespaces_in_line.size(); ++i)
+      retval.push_back("namespace " + namespaces_in_line[i] + " {");
+    current_namespaces = namespaces_in_line;
+
+    if (namespaces_in_line.empty()) {
+      retval.push_back(line);
+      continue;
+    }
+    std::smatch match;
+    if (!std::regex_search(line, match, Re().iwyu_classname))
+      return false;
+    retval.push_back(match[1].str());
+  }
+  retval.pop_back();
+  lines->swap(retval);
+  return true;
+}
+
+// Deletes the lines record says to, and then the namespaces and #ifdefs
+// that are left empty, duplicate lines and extra blank lines.
+void DeleteLinesAccordingToIwyu(const FixIncludesRecord& record,
+                                vector<LineInfo>* file_lines) {
+  vector<LineInfo>& lines = *file_lines;
+  for (int line_number : record.lines_to_delete) {
+    // The whole move span, with the comments before the line.
+    if (const optional<Span>& move_span = lines[line_number].move_span) {
+      for (int i = move_span->first; i < move_span->second; ++i)
+        lines[i].deleted = true;
+    }
+  }
+
+  while (true) {
+    int num_deletes = DeleteEmptyNamespaces(file_lines);
+    num_deletes += DeleteEmptyIfdefs(file_lines);
+    if (num_deletes == 0)
+      break;
+  }
+
+  // Only top-level lines are checked for duplicates, to stay out of
+  // #ifdefs.  Empty #ifdefs and namespaces have no blank lines left.
+  const vector<Span> toplevel_reorder_spans = GetToplevelReorderSpans(lines);
+  DeleteDuplicateLines(toplevel_reorder_spans, file_lines);
+  for (const Span& reorder_span : toplevel_reorder_spans)
+    DeleteExtraneousBlankLines(reorder_span, file_lines);
+}
+
+// Returns the name, with namespaces, of the symbol a forward-declare
+// line to add declares.
+string GetSymbolNameFromForwardDeclareLine(const string& line) {
+  string named_line = line;
+  ReplaceAll(&named_line, "namespace {", "namespace (anonymous namespace) {");
+  const vector<string> namespaces_in_line =
+      FindAll(named_line, Re().iwyu_namespace);
+  const vector<string> symbols_in_line = FindAll(line, Re().symbol_name);
+  string symbol_name = symbols_in_line.empty() ? "" : symbols_in_line.back();
+  if (!namespaces_in_line.empty())
+    symbol_name = Join(namespaces_in_line, "::") + "::" + symbol_name;
+  return symbol_name;
+}
+
+// Returns the lines of the fixed file.
+bool FixFileLines(const FixIncludesRecord& record, bool quoted_includes_first,
+                  StringRef linesep, vector<LineInfo>* file_lines,
+                  vector<string>* output_lines, string* error) {
+  vector<LineInfo>& lines = *file_lines;
+  DeleteLinesAccordingToIwyu(record, file_lines);
+  // Deleting lines may join reorder spans.
+  CalculateReorderSpans(file_lines);
+
+  vector<DecoratedMoveSpan> decorated_move_spans;
+  set<Span> seen_move_spans;
+  for (const LineInfo& line_info : lines) {
+    if (!line_info.move_span ||
+        !seen_move_spans.insert(*line_info.move_span).second) {
+      continue;
+    }
+    const auto [start_line, end_line] = *line_info.move_span;
+    const ArrayRef<LineInfo> move_span_lines =
+        ArrayRef<LineInfo>(lines).slice(start_line, end_line - start_line);
+    if (optional<DecoratedMoveSpan> decorated_span =
+            DecoratedMoveSpanLines(record, lines, move_span_lines)) {
+      decorated_move_spans.push_back(std::move(*decorated_span));
+    }
+  }
+
+  // New #includes and forward-declares.  Forward-declares of the same
+  // symbol with different template arguments are only added once.
+  set<string> symbol_names_seen;
+  for (const string& line : record.lines_to_add) {
+    LineInfo line_info(line);
+    std::smatch match;
+    if (Match(line, Re().include, &match)) {
+      line_info.type = LineType::Include;
+      line_info.key = match[1].str();
+    } else {
+      if (!symbol_names_seen.insert(GetSymbolNameFromForwardDeclareLine(line))
+               .second) {
+        continue;
+      }
+      line_info.type = LineType::ForwardDeclare;
+    }
+    decorated_move_spans.push_back(
+        *DecoratedMoveSpanLines(record, lines, ArrayRef<LineInfo>(line_info)));
+  }
+
+  // A sentinel at the end, and sort (stably, so kept lines stay in order
+  // and new lines go after kept lines of their kind).
+  const int num_lines = static_cast<int>(lines.size());
+  decorated_move_spans.push_back(
+      DecoratedMoveSpan{Span(num_lines, num_lines), kEOFKind, {}});
+  std::stable_sort(
+      decorated_move_spans.begin(), decorated_move_spans.end(),
+      [=](const DecoratedMoveSpan& a, const DecoratedMoveSpan& b) {
+        return std::make_pair(
+                   a.reorder_span,
+                   GetLineSortOrdinal(a.kind, quoted_includes_first)) <
+               std::make_pair(
+                   b.reorder_span,
+                   GetLineSortOrdinal(b.kind, quoted_includes_first));
+      });
+
+  // Copy the lines outside reorder spans, and write out the sorted
+  // contents of each reorder span in its place.
+  size_t next_span = 0;
+  int line_number = 0;
+  while (line_number < num_lines && next_span < decorated_move_spans.size()) {
+    const Span current_reorder_span =
+        decorated_move_spans[next_span].reorder_span;
+    for (; line_number < current_reorder_span.first; ++line_number) {
+      if (!lines[line_number].deleted)
+        output_lines->push_back(lines[line_number].line);
+    }
+
+    vector<string> new_lines;
+    for (; next_span < decorated_move_spans.size() &&
+           decorated_move_spans[next_span].reorder_span == current_reorder_span;
+         ++next_span) {
+      const DecoratedMoveSpan& decorated_span = decorated_move_spans[next_span];
+      new_lines.insert(new_lines.end(), decorated_span.all_lines.begin(),
+                       decorated_span.all_lines.end());
+      if (next_span + 1 < decorated_move_spans.size() &&
+          ShouldInsertBlankLine(decorated_span,
+                                decorated_move_spans[next_span + 1], lines)) {
+        new_lines.push_back("");
+      }
+    }
+    if (!NormalizeNamespaceForwardDeclareLines(&new_lines)) {
+      *error = "malformed namespace line";
+      return false;
+    }
+    for (const string& new_line : new_lines)
+      output_lines->push_back(StringRef(new_line).rtrim().str() +
+                              linesep.str());
+    line_number = current_reorder_span.second;
+  }
+  return true;
+}
+
+}  // anonymous namespace
+
+bool FixIncludesInFile(const FixIncludesRecord& record,
+                       bool quoted_includes_first, StringRef contents,
+                       string* fixed_contents, string* error) {
+  // Python reads a file without its byte order mark, and writes it back.
+  const StringRef byte_order_mark = "\xEF\xBB\xBF";
+  const bool has_byte_order_mark = StartsWith(contents, byte_order_mark);
+  if (has_byte_order_mark)
+    contents = contents.substr(byte_order_mark.size());
+
+  // New lines end like most lines of the file.
+  const size_t windows_newlines = contents.count("\r\n");
+  const size_t unix_newlines = contents.count('\n') - windows_newlines;
+  const StringRef linesep = windows_newlines > unix_newlines ? "\r\n" : "\n";
+
+  vector<LineInfo> file_lines = ParseLines(contents);
+  if (file_lines.size() == 1) {  // fix_includes.py leaves empty files alone
+    *fixed_contents = (has_byte_order_mark ? byte_order_mark : "").str();
+    return true;
+  }
+  if (!CalculateLineTypesAndKeys(record, &file_lines, error))
+    return false;
+  CalculateMoveSpans(record.seen_forward_declare_lines, &file_lines);
+  CalculateReorderSpans(&file_lines);
+
+  vector<string> output_lines;
+  if (!FixFileLines(record, quoted_includes_first, linesep, &file_lines,
+                    &output_lines, error)) {
+    return false;
+  }
+  fixed_contents->clear();
+  if (has_byte_order_mark)
+    *fixed_contents += byte_order_mark.str();
+  for (const string& output_line : output_lines)
+    *fixed_contents += output_line;
+  return true;
+}
+
+}  // namespace include_what_you_use
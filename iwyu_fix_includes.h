@@ -0,0 +1,64 @@
+//===--- iwyu_fix_includes.h - make iwyu's edits like fix_includes.py -----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// The edits --apply makes to a file.  This is a port of the part of
+// fix_includes.py that fixes one file (FixFileLines and the routines it
+// calls), so that with --apply, iwyu leaves a file exactly as
+//    include-what-you-use ... | fix_includes.py --nosafe_headers
+// would.  The other fix_includes.py flags have their default values,
+// except --quoted_includes_first, which is passed in.  Please keep this
+// in sync with fix_includes.py.
+
+#ifndef INCLUDE_WHAT_YOU_USE_IWYU_FIX_INCLUDES_H_
+#define INCLUDE_WHAT_YOU_USE_IWYU_FIX_INCLUDES_H_
+
+#include <set>                          // for set
+#include <string>                       // for string
+#include <utility>                      // for pair
+#include <vector>                       // for vector
+
+#include "llvm/ADT/StringRef.h"
+
+namespace include_what_you_use {
+
+using llvm::StringRef;
+using std::pair;
+using std::set;
+using std::string;
+using std::vector;
+
+// What fix_includes.py reads from iwyu's report on one file (its
+// IWYUOutputRecord).  Line numbers are 1-based.
+struct FixIncludesRecord {
+  // The file name as iwyu reports it, to tell its associated header.
+  string filename;
+  // The lines of the #includes and forward-declares to remove.
+  set<int> lines_to_delete;
+  // Lines iwyu knows to be #includes, to check the report against.
+  set<int> some_include_lines;
+  // [start_line, end_line) of each forward-declare iwyu saw, and of
+  // those that declare a nested class.
+  set<pair<int, int>> seen_forward_declare_lines;
+  set<pair<int, int>> nested_forward_declare_lines;
+  // The #include and forward-declare lines to add, without comments,
+  // in the order iwyu reports them.
+  vector<string> lines_to_add;
+};
+
+// Returns contents, the text of record.filename, with the edits in
+// record made the way fix_includes.py makes them.  Returns false and
+// sets *error if record doesn't fit contents, in which case
+// fix_includes.py skips the file too.
+bool FixIncludesInFile(const FixIncludesRecord& record,
+                       bool quoted_includes_first, StringRef contents,
+                       string* fixed_contents, string* error);
+
+}  // namespace include_what_you_use
+
+#endif  // INCLUDE_WHAT_YOU_USE_IWYU_FIX_INCLUDES_H_
@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+
+##===--- iwyu_fix_includes_test.py - test iwyu_fix_includes.cc ------------===##
+#
+#                     The LLVM Compiler Infrastructure
+#
+# This file is distributed under the University of Illinois Open Source
+# License. See LICENSE.TXT for details.
+#
+##===----------------------------------------------------------------------===##
+
+"""Checks that iwyu_fix_includes.cc edits files as fix_includes.py does.
+
+IWYU --apply edits files with FixIncludesInFile, a port of the part of
+fix_includes.py that fixes one file.  This collects the file and the parsed
+IWYU output of every fix_includes_test.py case, and runs each through both
+FixIncludesInFile, via iwyu-fix-includes-test-driver, and fix_includes.py with
+the flags --apply stands for.  Each file is also tried with Windows and mixed
+line endings, with a byte order mark, and with --quoted_includes_first.
+
+Usage: iwyu_fix_includes_test.py [unittest args]
+           [-- path/to/iwyu-fix-includes-test-driver]
+"""
+
+import copy
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import unittest
+
+import fix_includes
+import fix_includes_test
+
+
+_DRIVER_PATH = shutil.which('iwyu-fix-includes-test-driver')
+
+_BYTE_ORDER_MARK = '\ufeff'
+
+
+def _CollectCases():
+  """Returns (test name, iwyu_record, file contents) for each file that
+  fix_includes_test.py fixes."""
+  cases = []
+  current_test = [None]
+  fix_one_file = fix_includes.FixOneFile
+
+  def CollectingFixOneFile(iwyu_record, file_contents, flags, fileinfo):
+    cases.append((current_test[0], copy.deepcopy(iwyu_record),
+                  ''.join(file_contents)))
+    return fix_one_file(iwyu_record, file_contents, flags, fileinfo)
+
+  def AllTests(suite):
+    for test in suite:
+      if isinstance(test, unittest.TestSuite):
+        yield from AllTests(test)
+      else:
+        yield test
+
+  # The test cases stub these out, and leave them that way.
+  saved = (sys.stdout, fix_includes._ReadFile, fix_includes._WriteFile,
+           fix_includes.FileInfo.parse)
+  fix_includes.FixOneFile = CollectingFixOneFile
+  try:
+    suite = unittest.defaultTestLoader.loadTestsFromModule(fix_includes_test)
+    for test in AllTests(suite):
+      current_test[0] = test.id()
+      test.run(unittest.TestResult())
+  finally:
+    fix_includes.FixOneFile = fix_one_file
+    (sys.stdout, fix_includes._ReadFile, fix_includes._WriteFile,
+     fix_includes.FileInfo.parse) = saved
+  return cases
+
+
+def _FixWithFixIncludes(iwyu_record, contents, quoted_includes_first):
+  """Returns contents as fix_includes.py --nosafe_headers fixes them, with
+  its other flags at their defaults, or None if it skips the file."""
+  flags = fix_includes_test.FakeFlags()
+  flags.blank_lines = True
+  flags.comments = False
+  flags.reorder = False
+  flags.safe_headers = False
+  flags.quoted_includes_first = quoted_includes_first
+
+  # Without --comments, the kept #includes are parsed without comments.
+  iwyu_record = copy.deepcopy(iwyu_record)
+  for key, line in iwyu_record.full_include_lines.items():
+    iwyu_record.full_include_lines[key] = fix_includes._COMMENT_RE.sub('', line)
+
+  has_byte_order_mark = contents.startswith(_BYTE_ORDER_MARK)
+  if has_byte_order_mark:
+    contents = contents[len(_BYTE_ORDER_MARK):]
+  linesep = fix_includes.FileInfo.guess_linesep(contents.encode('utf-8'))
+  fileinfo = fix_includes.FileInfo(linesep, 'utf-8')
+  try:
+    file_lines = fix_includes.ParseOneFile(contents.splitlines(True),
+                                           iwyu_record)
+    fixed_lines = fix_includes.FixFileLines(iwyu_record, file_lines, flags,
+                                            fileinfo)
+  except fix_includes.FixIncludesError:
+    return None
+  fixed_contents = ''.join(fixed_lines)
+  if has_byte_order_mark:
+    fixed_contents = _BYTE_ORDER_MARK + fixed_contents
+  return fixed_contents
+
+
+class FixIncludesInFileTest(unittest.TestCase):
+  def setUp(self):
+    if not _DRIVER_PATH:
+      self.skipTest('\'iwyu-fix-includes-test-driver\' not found in PATH')
+    self.scratch_dir = tempfile.mkdtemp()
+    self.addCleanup(shutil.rmtree, self.scratch_dir)
+
+  def FixWithDriver(self, iwyu_record, contents, quoted_includes_first):
+    """Returns contents as FixIncludesInFile fixes them, or None if it
+    skips the file."""
+    record_path = os.path.join(self.scratch_dir, 'record')
+    with open(record_path, 'w', newline='\n') as f:
+      f.write('filename\t%s\n' % iwyu_record.filename)
+      for line_number in sorted(iwyu_record.lines_to_delete):
+        f.write('delete\t%d\n' % line_number)
+      for line_number in sorted(iwyu_record.some_include_lines):
+        f.write('include\t%d\n' % line_number)
+      for span in sorted(iwyu_record.seen_forward_declare_lines):
+        f.write('forward_declare\t%d\t%d\n' % span)
+      for span in sorted(iwyu_record.nested_forward_declare_lines):
+        f.write('nested_forward_declare\t%d\t%d\n' % span)
+      for line in iwyu_record.includes_and_forward_declares_to_add:
+        f.write('add\t%s\n' % line)
+    file_path = os.path.join(self.scratch_dir, 'file')
+    with open(file_path, 'wb') as f:
+      f.write(contents.encode('utf-8'))
+
+    cmd = [_DRIVER_PATH, record_path, file_path]
+    if quoted_includes_first:
+      cmd.insert(1, '--quoted_includes_first')
+    p = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    self.assertIn(p.returncode, (0, 1), p.stderr.decode('utf-8'))
+    if p.returncode != 0:
+      return None
+    return p.stdout.decode('utf-8')
+
+  def testMatchesFixIncludes(self):
+    cases = _CollectCases()
+    self.assertTrue(cases)
+    variants = (
+        ('unix', lambda contents: contents),
+        ('windows', lambda contents: contents.replace('\n', '\r\n')),
+        ('mixed', lambda contents: contents.replace('\n', '\r\n', 1)),
+        ('bom', lambda contents: _BYTE_ORDER_MARK + contents),
+    )
+    for test_name, iwyu_record, contents in cases:
+      for variant, make_variant in variants:
+        for quoted_includes_first in (False, True):
+          with self.subTest(test=test_name, file=iwyu_record.filename,
+                            variant=variant,
+                            quoted_includes_first=quoted_includes_first):
+            variant_contents = make_variant(contents)
+            self.assertEqual(
+                _FixWithFixIncludes(iwyu_record, variant_contents,
+                                    quoted_includes_first),
+                self.FixWithDriver(iwyu_record, variant_contents,
+                                   quoted_includes_first))
+
+
+if __name__ == '__main__':
+  if '--' in sys.argv:
+    separator = sys.argv.index('--')
+    if separator + 1 < len(sys.argv):
+      _DRIVER_PATH = sys.argv[separator + 1]
+    del sys.argv[separator:]
+  unittest.main()
@@ -0,0 +1,131 @@
+//===--- iwyu_fix_includes_test_driver.cc - run FixIncludesInFile ---------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// Runs FixIncludesInFile on one file, for iwyu_fix_includes_test.py to
+// check against fix_includes.py.  Usage:
+//    iwyu-fix-includes-test-driver [--quoted_includes_first] <record> <file>
+// Each line of <record> holds one item of the FixIncludesRecord for
+// <file>, as a name and tab-separated values:
+//    filename <filename as iwyu reports it>
+//    delete <line number>
+//    include <line number>
+//    forward_declare <start line> <end line>
+//    nested_forward_declare <start line> <end line>
+//    add <line to add>
+// The fixed file is written to stdout.  If the record doesn't fit the
+// file, the error is written to stderr and the exit code is 1.
+
+#include <memory>                       // for unique_ptr
+#include <string>                       // for string
+#include <utility>                      // for move, pair
+
+#include "iwyu_fix_includes.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/ErrorOr.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+using include_what_you_use::FixIncludesInFile;
+using include_what_you_use::FixIncludesRecord;
+using llvm::ErrorOr;
+using llvm::MemoryBuffer;
+using llvm::SmallVector;
+using llvm::StringRef;
+using llvm::errs;
+using llvm::outs;
+using std::pair;
+using std::string;
+using std::unique_ptr;
+
+namespace {
+
+bool ParseLineNumber(StringRef text, int* line_number) {
+  return !text.getAsInteger(10, *line_number);
+}
+
+// Parses "<start line>\t<end line>".
+bool ParseSpan(StringRef text, pair<int, int>* span) {
+  const pair<StringRef, StringRef> start_end = text.split('\t');
+  return ParseLineNumber(start_end.first, &span->first) &&
+         ParseLineNumber(start_end.second, &span->second);
+}
+
+bool ParseRecord(StringRef text, FixIncludesRecord* record) {
+  SmallVector<StringRef, 64> lines;
+  text.split(lines, '\n', -1, /*KeepEmpty=*/false);
+  for (StringRef line : lines) {
+    const pair<StringRef, StringRef> name_value = line.split('\t');
+    const StringRef name = name_value.first;
+    const StringRef value = name_value.second;
+    int line_number;
+    pair<int, int> span;
+    if (name == "filename") {
+      record->filename = value.str();
+    } else if (name == "delete" && ParseLineNumber(value, &line_number)) {
+      record->lines_to_delete.insert(line_number);
+    } else if (name == "include" && ParseLineNumber(value, &line_number)) {
+      record->some_include_lines.insert(line_number);
+    } else if (name == "forward_declare" && ParseSpan(value, &span)) {
+      record->seen_forward_declare_lines.insert(span);
+    } else if (name == "nested_forward_declare" && ParseSpan(value, &span)) {
+      record->nested_forward_declare_lines.insert(span);
+    } else if (name == "add") {
+      record->lines_to_add.push_back(value.str());
+    } else {
+      errs() << "malformed record line: " << line << "\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+unique_ptr<MemoryBuffer> ReadFile(StringRef filename) {
+  ErrorOr<unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(filename);
+  if (!buffer) {
+    errs() << "cannot read " << filename << ": "
+           << buffer.getError().message() << "\n";
+    return nullptr;
+  }
+  return std::move(*buffer);
+}
+
+}  // anonymous namespace
+
+int main(int argc, char** argv) {
+  bool quoted_includes_first = false;
+  int first_arg = 1;
+  if (first_arg < argc &&
+      StringRef(argv[first_arg]) == "--quoted_includes_first") {
+    quoted_includes_first = true;
+    ++first_arg;
+  }
+  if (argc - first_arg != 2) {
+    errs() << "usage: " << argv[0]
+           << " [--quoted_includes_first] <record> <file>\n";
+    return 2;
+  }
+
+  const unique_ptr<MemoryBuffer> record_buffer = ReadFile(argv[first_arg]);
+  const unique_ptr<MemoryBuffer> file_buffer = ReadFile(argv[first_arg + 1]);
+  FixIncludesRecord record;
+  if (!record_buffer || !file_buffer ||
+      !ParseRecord(record_buffer->getBuffer(), &record)) {
+    return 2;
+  }
+
+  string fixed_contents, error;
+  if (!FixIncludesInFile(record, quoted_includes_first,
+                         file_buffer->getBuffer(), &fixed_contents, &error)) {
+    errs() << error << "\n";
+    return 1;
+  }
+  outs() << fixed_contents;
+  return 0;
+}
@@ -11,12 +11,15 @@
 
 #include <algorithm>                    // for sort, make_pair
 #include <climits>
+#include <cstdint>                      // for int64_t
 #include <cstdio>                       // for printf
 #include <cstdlib>                      // for atoi, exit, getenv
 #include <cstring>
 #include <map>                          // for map
+#include <memory>                       // for unique_ptr
 #include <set>                          // for set
 #include <string>                       // for string, operator<, etc
+#include <system_error>                 // for error_code
 #include <utility>                      // for make_pair, pair
 
 #include "clang/AST/PrettyPrinter.h"
@@ -39,8 +42,11 @@
 #include "iwyu_string_util.h"
 #include "iwyu_verrs.h"
 #include "iwyu_version.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Option/ArgList.h"
+#include "llvm/Support/ErrorOr.h"
+#include "llvm/Support/MemoryBuffer.h"
 
 using clang::CompilerInstance;
 using clang::HeaderSearch;
@@ -78,18 +84,34 @@ static void PrintHelp(const char* extra_msg) {
          "        to the default of reporting for the input .cc file and its\n"
          "        associated .h files).  This flag may be specified multiple\n"
          "        times to specify multiple glob patterns.\n"
+         "   --check_also_file=<filename>: like --check_also, for each glob\n"
+         "        pattern in the file, one per line.  Empty lines and lines\n"
+         "        starting with '#' are ignored.\n"
          "   --keep=<glob>: tells iwyu to always keep these includes.\n"
          "        This flag may be specified multiple times to specify\n"
          "        multiple glob patterns.\n"
          "   --mapping_file=<filename>: gives iwyu a mapping file.\n"
          "   --no_internal_mappings: do not add iwyu's internal mappings.\n"
          "   --export_mappings=<dirpath>: writes out all internal mappings.\n"
+         "   --generate_mappings=<filename>: instead of analyzing the source\n"
+         "        file, only preprocess it and write a mapping file from the\n"
+         "        library headers it #includes.  Each header they pull in\n"
+         "        from their own directory tree is mapped as private to the\n"
+         "        #included header that reaches it, alongside the mappings\n"
+         "        given by IWYU pragmas and @headername.\n"
          "   --pch_in_code: mark the first include in a translation unit as a\n"
          "        precompiled header.  Use --pch_in_code to prevent IWYU from\n"
          "        removing necessary PCH includes.  Though Clang forces PCHs\n"
          "        to be listed as prefix headers, the PCH-in-code pattern can\n"
          "        be used with GCC and is standard practice on MSVC\n"
          "        (e.g. stdafx.h).\n"
+         "   --pch_sidecar=<filename>: when the translation unit is compiled\n"
+         "        with -include-pch, read the #includes and IWYU pragmas of\n"
+         "        the headers inside the PCH from this file, as written by\n"
+         "        --write_pch_sidecar.\n"
+         "   --write_pch_sidecar=<filename>: record the #includes and IWYU\n"
+         "        pragmas of the file being analyzed, typically the prefix\n"
+         "        header a PCH is built from, in this file.\n"
          "   --prefix_header_includes=<value>: tells iwyu what to do with\n"
          "        in-source includes and forward declarations involving\n"
          "        prefix headers.  Prefix header is a file included via\n"
@@ -117,6 +139,10 @@ static void PrintHelp(const char* extra_msg) {
          "   --update_comments: update and insert 'why' comments, even if no\n"
          "        #include lines need to be added or removed.\n"
          "   --no_fwd_decls: do not use forward declarations.\n"
+         "   --apply: also make the reported changes to the analyzed files,\n"
+         "        as fix_includes.py --nosafe_headers would with its other\n"
+         "        flags at their defaults, writing each edited file once at\n"
+         "        the end.\n"
          "   --verbose=<level>: the higher the level, the more output.\n"
          "   --quoted_includes_first: when sorting includes, place quoted\n"
          "        ones first.\n"
@@ -125,6 +151,34 @@ static void PrintHelp(const char* extra_msg) {
          "   --error[=N]: exit with N (default: 1) for iwyu violations\n"
          "   --error_always[=N]: always exit with N (default: 1) (for use\n"
          "        with 'make -k')\n"
+         "   --fast_exit: exit right after reporting, without running\n"
+         "        destructors or freeing memory.  Output is still flushed.\n"
+         "   --jobs=<N>: compute the violations of up to N headers at once\n"
+         "        in forked processes (default: 1).  Output is unchanged.\n"
+         "        Ignored with --apply and --memory_report.\n"
+         "   --max_instantiation_depth=<N>: stop scanning a template\n"
+         "        instantiation that nests more than N function or class\n"
+         "        bodies, and treat its template arguments as fully used.\n"
+         "   --max_scan_nodes=<N>: likewise, for instantiations whose scan\n"
+         "        visits more than N AST nodes.\n"
+         "   --instantiation_time_limit=<seconds>: likewise, for all\n"
+         "        instantiations scanned after this much time was spent\n"
+         "        scanning instantiations.  By default there are no limits.\n"
+         "   --cache_memory_limit=<megabytes>: keep each cache of template\n"
+         "        instantiation results below about this size, recomputing\n"
+         "        the least recently used entries once it's reached\n"
+         "        (default: 0, unlimited).  The interned resugar maps and\n"
+         "        type sets they refer to are kept regardless.\n"
+         "   --template_profile=<N>: after analysis, print the N template\n"
+         "        instantiations that took longest to scan, with the AST\n"
+         "        nodes visited, bodies traversed and full-use cache hits.\n"
+         "   --template_profile_json=<filename>: write the scan cost of\n"
+         "        every template instantiation to this file as JSON.\n"
+         "   --memory_report: at the end of each analysis phase, print the\n"
+         "        estimated entries and bytes held by iwyu's caches and\n"
+         "        tables, next to the memory allocated for clang's AST.\n"
+         "   --memory_report_json=<filename>: write the same estimates to\n"
+         "        this file as JSON.\n"
          "   --debug=flag[,flag...]: debug flags (undocumented)\n"
          "   --regex=<dialect>: use specified regex dialect in IWYU:\n"
          "          llvm:       fast and simple (default)\n"
@@ -151,6 +205,26 @@ static void PrintVersion() {
   llvm::outs() << " based on " << getClangFullVersion() << "\n";
 }
 
+// Adds the globs listed in filename, one per line, as with --check_also.
+// Returns false, after printing an error, if the file can't be read.
+static bool AddGlobsToReportIWYUViolationsForFromFile(const char* filename) {
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+      llvm::MemoryBuffer::getFile(filename);
+  if (std::error_code error = buffer.getError()) {
+    llvm::errs() << filename << ": error: " << error.message() << "\n";
+    return false;
+  }
+  llvm::SmallVector<StringRef, 64> lines;
+  buffer.get()->getBuffer().split(lines, '\n');
+  for (StringRef line : lines) {
+    line = line.trim();
+    if (line.empty() || line.starts_with("#"))
+      continue;
+    AddGlobToReportIWYUViolationsFor(line.str());
+  }
+  return true;
+}
+
 static bool ParseIntegerOptarg(const char* optarg, int* res) {
   char* endptr = nullptr;
   long val = strtol(optarg, &endptr, 10);
@@ -215,20 +289,30 @@ CommandlineFlags::CommandlineFlags()
       pch_in_code(false),
       no_comments(false),
       update_comments(false),
+      apply(false),
       comments_with_namespace(false),
       no_fwd_decls(false),
       quoted_includes_first(false),
       cxx17ns(false),
       exit_code_error(EXIT_SUCCESS),
       exit_code_always(EXIT_SUCCESS),
+      fast_exit(false),
+      jobs(1),
+      template_profile(0),
+      memory_report(false),
+      max_instantiation_depth(0),
+      max_scan_nodes(0),
+      instantiation_time_limit(0),
+      cache_memory_limit(0),
       regex_dialect(RegexDialect::LLVM) {
   // Always keep Qt .moc includes; its moc compiler does its own IWYU analysis.
-  keep.emplace("*.moc");
+  keep.Add("*.moc");
 }
 
 int CommandlineFlags::ParseArgv(int argc, char** argv) {
   static const struct option longopts[] = {
     {"check_also", required_argument, nullptr, 'c'},  // can be specified >once
+    {"check_also_file", required_argument, nullptr, 'A'},
     {"keep", required_argument, nullptr, 'k'},  // can be specified >once
     {"transitive_includes_only", no_argument, nullptr, 't'},
     {"verbose", required_argument, nullptr, 'v'},
@@ -237,25 +321,45 @@ int CommandlineFlags::ParseArgv(int argc, char** argv) {
     {"no_default_mappings", no_argument, nullptr, 'n'},  // deprecated
     {"prefix_header_includes", required_argument, nullptr, 'x'},
     {"pch_in_code", no_argument, nullptr, 'h'},
+    {"pch_sidecar", required_argument, nullptr, 's'},
+    {"write_pch_sidecar", required_argument, nullptr, 'w'},
     {"max_line_length", required_argument, nullptr, 'l'},
     {"comment_style", required_argument, nullptr, 'i'},
     {"no_comments", no_argument, nullptr, 'o'},
     {"update_comments", no_argument, nullptr, 'u'},
+    {"apply", no_argument, nullptr, 'W'},
     {"no_fwd_decls", no_argument, nullptr, 'f'},
     {"quoted_includes_first", no_argument, nullptr, 'q' },
     {"cxx17ns", no_argument, nullptr, 'C'},
     {"error", optional_argument, nullptr, 'e'},
     {"error_always", optional_argument, nullptr, 'a'},
+    {"fast_exit", no_argument, nullptr, 'F'},
+    {"jobs", required_argument, nullptr, 'j'},
+    {"template_profile", required_argument, nullptr, 'T'},
+    {"template_profile_json", required_argument, nullptr, 'J'},
+    {"memory_report", no_argument, nullptr, 'M'},
+    {"memory_report_json", required_argument, nullptr, 'R'},
+    {"max_instantiation_depth", required_argument, nullptr, 'D'},
+    {"max_scan_nodes", required_argument, nullptr, 'N'},
+    {"instantiation_time_limit", required_argument, nullptr, 'L'},
+    {"cache_memory_limit", required_argument, nullptr, 'K'},
     {"debug", required_argument, nullptr, 'd'},
     {"regex", required_argument, nullptr, 'r'},
     {"experimental", required_argument, nullptr, 'p'},
     {"export_mappings", required_argument, nullptr, 'E'},
+    {"generate_mappings", required_argument, nullptr, 'G'},
     {nullptr, 0, nullptr, 0}
   };
   static const char shortopts[] = "v:c:m:d:nr";
   while (true) {
     switch (getopt_long(argc, argv, shortopts, longopts, nullptr)) {
       case 'c': AddGlobToReportIWYUViolationsFor(optarg); break;
+      case 'A':
+        if (!AddGlobsToReportIWYUViolationsForFromFile(optarg)) {
+          PrintHelp("FATAL ERROR: cannot read --check_also_file.");
+          exit(EXIT_FAILURE);
+        }
+        break;
       case 'k': AddGlobToKeepIncludes(optarg); break;
       case 't': transitive_includes_only = true; break;
       case 'v': verbose = atoi(optarg); break;
@@ -265,6 +369,7 @@ int CommandlineFlags::ParseArgv(int argc, char** argv) {
         break;
       case 'o': no_comments = true; break;
       case 'u': update_comments = true; break;
+      case 'W': apply = true; break;
       case 'i':
         if (strcmp(optarg, "none") == 0) {
           no_comments = true;
@@ -291,6 +396,8 @@ int CommandlineFlags::ParseArgv(int argc, char** argv) {
         }
         break;
       case 'h': pch_in_code = true; break;
+      case 's': pch_sidecar = optarg; break;
+      case 'w': write_pch_sidecar = optarg; break;
       case 'l':
         max_line_length = atoi(optarg);
         CHECK_((max_line_length >= 0) && "Max line length must be positive");
@@ -315,6 +422,64 @@ int CommandlineFlags::ParseArgv(int argc, char** argv) {
           exit(EXIT_FAILURE);
         }
         break;
+      case 'F': fast_exit = true; break;
+      case 'j':
+        if (!ParseIntegerOptarg(optarg, &jobs) || jobs < 1) {
+          PrintHelp("FATAL ERROR: --jobs argument must be a positive integer.");
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'T':
+        if (!ParseIntegerOptarg(optarg, &template_profile) ||
+            template_profile < 1) {
+          PrintHelp(
+              "FATAL ERROR: --template_profile argument must be a positive "
+              "integer.");
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'J': template_profile_json = optarg; break;
+      case 'M': memory_report = true; break;
+      case 'R': memory_report_json = optarg; break;
+      case 'D':
+        if (!ParseIntegerOptarg(optarg, &max_instantiation_depth) ||
+            max_instantiation_depth < 1) {
+          PrintHelp(
+              "FATAL ERROR: --max_instantiation_depth argument must be a "
+              "positive integer.");
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'N':
+        if (!ParseIntegerOptarg(optarg, &max_scan_nodes) ||
+            max_scan_nodes < 1) {
+          PrintHelp(
+              "FATAL ERROR: --max_scan_nodes argument must be a positive "
+              "integer.");
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'L': {
+        char* endptr = nullptr;
+        instantiation_time_limit = strtod(optarg, &endptr);
+        if (endptr == optarg || *endptr != '\0' ||
+            !(instantiation_time_limit > 0)) {
+          PrintHelp(
+              "FATAL ERROR: --instantiation_time_limit argument must be a "
+              "positive number of seconds.");
+          exit(EXIT_FAILURE);
+        }
+        break;
+      }
+      case 'K':
+        if (!ParseIntegerOptarg(optarg, &cache_memory_limit) ||
+            cache_memory_limit < 1) {
+          PrintHelp(
+              "FATAL ERROR: --cache_memory_limit argument must be a positive "
+              "number of megabytes.");
+          exit(EXIT_FAILURE);
+        }
+        break;
       case 'd': {
         // Split argument on comma and save in global, ignoring empty elements.
         vector<string> flags = Split(optarg, ",", 0);
@@ -352,6 +517,7 @@ int CommandlineFlags::ParseArgv(int argc, char** argv) {
         exit(EXIT_SUCCESS);
         break;
       }
+      case 'G': generate_mappings = optarg; break;
       case -1:
         return optind;  // means 'no more input'
       default:
@@ -495,8 +661,12 @@ void InitGlobals(CompilerInstance& compiler, const ToolChain& toolchain) {
   CXXStdLib cxxstdlib = DeriveCXXStdLib(compiler, toolchain);
   include_picker = new IncludePicker(regex_dialect, cstdlib, cxxstdlib);
 
-  function_calls_full_use_cache = new FullUseCache;
-  class_members_full_use_cache = new FullUseCache;
+  const int64_t cache_max_bytes = int64_t{GlobalFlags().cache_memory_limit}
+                                  << 20;
+  function_calls_full_use_cache =
+      new FullUseCache("FunctionCallsFullUseCache", cache_max_bytes);
+  class_members_full_use_cache =
+      new FullUseCache("ClassMembersFullUseCache", cache_max_bytes);
 
   for (const HeaderSearchPath& entry : search_paths) {
     const char* path_type_name =
@@ -555,30 +725,22 @@ FullUseCache* ClassMembersFullUseCache() {
 
 void AddGlobToReportIWYUViolationsFor(const string& glob) {
   CHECK_(commandline_flags && "Call ParseIwyuCommandlineFlags() before this");
-  commandline_flags->check_also.insert(NormalizeFilePath(glob));
+  commandline_flags->check_also.Add(NormalizeFilePath(glob));
 }
 
 bool ShouldReportIWYUViolationsFor(OptionalFileEntryRef file) {
-  const string filepath = GetFilePath(file);
-  for (const string& glob : GlobalFlags().check_also)
-    if (GlobMatchesPath(glob.c_str(), filepath.c_str()))
-      return true;
-  return false;
+  return GlobalFlags().check_also.Matches(GetFilePath(file));
 }
 
 void AddGlobToKeepIncludes(const string& glob) {
   CHECK_(commandline_flags && "Call ParseIwyuCommandlineFlags() before this");
-  commandline_flags->keep.insert(NormalizeFilePath(glob));
+  commandline_flags->keep.Add(NormalizeFilePath(glob));
 }
 
 bool ShouldKeepIncludeFor(OptionalFileEntryRef file) {
   if (GlobalFlags().keep.empty())
     return false;
-  const string filepath = GetFilePath(file);
-  for (const string& glob : GlobalFlags().keep)
-    if (GlobMatchesPath(glob.c_str(), filepath.c_str()))
-      return true;
-  return false;
+  return GlobalFlags().keep.Matches(GetFilePath(file));
 }
 
 void InitGlobalsAndFlagsForTesting() {
@@ -600,8 +762,12 @@ void InitGlobalsAndFlagsForTesting() {
   include_picker =
       new IncludePicker(GlobalFlags().regex_dialect, cstdlib, cxxstdlib);
 
-  function_calls_full_use_cache = new FullUseCache;
-  class_members_full_use_cache = new FullUseCache;
+  const int64_t cache_max_bytes = int64_t{GlobalFlags().cache_memory_limit}
+                                  << 20;
+  function_calls_full_use_cache =
+      new FullUseCache("FunctionCallsFullUseCache", cache_max_bytes);
+  class_members_full_use_cache =
+      new FullUseCache("ClassMembersFullUseCache", cache_max_bytes);
 
   // Use a reasonable default for the -I flags.
   map<string, HeaderSearchPath::Type> search_path_map;
@@ -16,6 +16,7 @@
 #include <vector>                       // for vector
 
 #include "clang/Basic/FileEntry.h"
+#include "iwyu_path_util.h"
 
 namespace clang {
 class CompilerInstance;
@@ -90,25 +91,42 @@ struct CommandlineFlags {
   bool HasDebugFlag(const char* flag) const;
   bool HasExperimentalFlag(const char* flag) const;
 
-  set<string> check_also;  // -c: globs to report iwyu violations for
-  set<string> keep;        // -k: globs to force-keep includes for
+  GlobSet check_also;      // -c: globs to report iwyu violations for
+  GlobSet keep;            // -k: globs to force-keep includes for
   bool transitive_includes_only;   // -t: don't add 'new' #includes to files
   int verbose;             // -v: how much information to emit as we parse
   vector<string> mapping_files; // -m: mapping files
   bool no_internal_mappings;    // -n: no internal mappings
+  // Preprocess only, and write the mappings found here.  No short option.
+  string generate_mappings;
   // Truncate output lines to this length. No short option.
   int max_line_length;
   // Policy regarding files included via -include option.  No short option.
   PrefixHeaderIncludePolicy prefix_header_include_policy;
   bool pch_in_code;   // Treat the first seen include as a PCH. No short option.
+  string pch_sidecar;  // Include graph and pragmas of a PCH. No short option.
+  string write_pch_sidecar;  // Record them here. No short option.
   bool no_comments;   // Disable 'why' comments. No short option.
   bool update_comments; // Force 'why' comments. No short option.
+  bool apply;  // Edit the analyzed files in place. No short option.
   bool comments_with_namespace; // Show namespace in 'why' comments.
   bool no_fwd_decls;  // Disable forward declarations.
   bool quoted_includes_first; // Place quoted includes first in sort order.
   bool cxx17ns; // -C: C++17 nested namespace syntax
   int exit_code_error;   // Exit with this code for iwyu violations.
   int exit_code_always;  // Always exit with this exit code.
+  bool fast_exit;  // Skip all teardown after analysis. No short option.
+  int jobs;  // Processes to compute header violations in. No short option.
+  int template_profile;  // Print the N costliest template scans. No short option.
+  string template_profile_json;  // Write all scan costs here. No short option.
+  bool memory_report;  // Print memory estimates per phase. No short option.
+  string memory_report_json;  // Write them here. No short option.
+  // Budgets of template instantiation scans; 0 is unlimited.  No short options.
+  int max_instantiation_depth;    // Nested function and class bodies.
+  int max_scan_nodes;             // AST nodes per scan.
+  double instantiation_time_limit;  // Seconds in all scans of the TU.
+  // Megabytes per cache of template scan results; 0 is unlimited.
+  int cache_memory_limit;  // No short option.
   set<string> dbg_flags; // Debug flags.
   set<string> exp_flags;       // Experimental flags.
   RegexDialect regex_dialect;  // Dialect for regular expression processing.
@@ -134,7 +152,8 @@ const SourceManagerCharacterDataGetter& DefaultDataGetter();
 FullUseCache* FunctionCallsFullUseCache();
 FullUseCache* ClassMembersFullUseCache();
 
-// These files are based on the commandline (--check_also flag plus argv).
+// These files are based on the commandline (--check_also and
+// --check_also_file flags plus argv).
 // They are specified as glob file-patterns (which behave just as they
 // do in the shell).  TODO(csilvers): use a prefix instead? allow '...'?
 void AddGlobToReportIWYUViolationsFor(const string& glob);
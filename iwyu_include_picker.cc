@@ -9,7 +9,7 @@
 
 #include "iwyu_include_picker.h"
 
-#include <algorithm>                    // for find
+#include <algorithm>                    // for find, min
 #include <cstddef>                      // for size_t
 #include <ctime>                        // for time
 // not hash_map: it's not as portable and needs hash<string>.
@@ -32,6 +32,7 @@
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/ADT/Twine.h"
 #include "llvm/Support/Casting.h"
@@ -1257,98 +1258,183 @@ bool IsQuotedFilepathPattern(const string& str) {
   return IsQuotedInclude(str) || StartsWith(str, "@");
 }
 
-// Given a vector of nodes, augment each node with its children, as
-// defined by m: nodes[i] is replaced by nodes[i] + m[nodes[i]],
-// ignoring duplicates.  The input vector is modified in place.
-void ExpandOnce(const IncludePicker::IncludeMap& m,
-                vector<MappedInclude>* nodes) {
-  vector<MappedInclude> nodes_and_children;
-  set<string> seen_nodes_and_children;
-  for (const MappedInclude& node : *nodes) {
-    // First insert the node itself, then all its kids.
-    if (!ContainsKey(seen_nodes_and_children, node.quoted_include)) {
-      nodes_and_children.push_back(node);
-      seen_nodes_and_children.insert(node.quoted_include);
-    }
-    if (const vector<MappedInclude>* children =
-        FindInMap(&m, node.quoted_include)) {
-      for (const MappedInclude& child : *children) {
-        if (!ContainsKey(seen_nodes_and_children, child.quoted_include)) {
-          nodes_and_children.push_back(child);
-          seen_nodes_and_children.insert(child.quoted_include);
-        }
+// If the filename-map maps a.h to b.h, and also b.h to c.h, then
+// there's a transitive mapping of a.h to c.h.  We want to add that
+// into the filepath map as well, to make lookups easier.
+//
+// This class computes those closures over integer node ids.  It finds
+// the strongly connected components of the mapping graph with Tarjan's
+// algorithm, which yields them children-first, so the closure of every
+// node outside the current component is already known when it's
+// needed.  Each closure keeps the preference order of the original
+// mapping: a child comes first, then the child's own closure, in the
+// order the children were mapped, skipping duplicates.
+//
+// Cycles in mappings are generally benign.  All nodes of a cycle end
+// up mapping to every node reachable from the cycle, themselves
+// included.
+//
+// The closures point into the values of the map they were computed
+// from, so they must be used before that map is modified.
+class IncludeMapClosure {
+ public:
+  explicit IncludeMapClosure(const IncludePicker::IncludeMap& m) {
+    for (const IncludePicker::IncludeMap::value_type& node : m) {
+      const int id = GetId(node.first);
+      children_[id] = &node.second;
+      for (const MappedInclude& child : node.second) {
+        // GetId may grow child_ids_, so don't hold a reference across it.
+        const int child_id = GetId(child.quoted_include);
+        child_ids_[id].push_back(child_id);
       }
     }
+    for (int id = 0; id < static_cast<int>(names_.size()); ++id) {
+      if (index_[id] == -1)
+        FindComponents(id);
+    }
   }
-  nodes->swap(nodes_and_children);  // modify nodes in-place
-}
 
-enum TransitiveStatus { kUnused = 0, kCalculating, kDone };
+  // Returns the transitive closure of key, which must be a key of the
+  // map this was constructed from.
+  vector<MappedInclude> GetClosure(const string& key) const {
+    vector<MappedInclude> retval;
+    for (const Entry& entry : closure_[ids_.lookup(key)])
+      retval.push_back(*entry.include);
+    return retval;
+  }
 
-// If the filename-map maps a.h to b.h, and also b.h to c.h, then
-// there's a transitive mapping of a.h to c.h.  We want to add that
-// into the filepath map as well, to make lookups easier.  We do this
-// by doing a depth-first search for a single mapping, recursing
-// whenever the value is itself a key in the map, and putting the
-// results in a vector of all values seen.
-// NOTE: This function updates values seen in filename_map, but
-// does not invalidate any filename_map iterators.
-void MakeNodeTransitive(IncludePicker::IncludeMap* filename_map,
-                        map<string, TransitiveStatus>* seen_nodes,
-                        vector<string>* node_stack,  // used for debugging
-                        const string& key) {
-  // If we've already calculated this node's transitive closure, we're done.
-  const TransitiveStatus status = (*seen_nodes)[key];
-  if (status == kCalculating) {  // means there's a cycle in the mapping
-    // Note that cycles in mappings are generally benign, the cycle detection
-    // here is only necessary to protect the recursive algorithm from infinite
-    // regress. We will still expand all reachable nodes in the graph to a
-    // plain sequence representing the transitive closure.
-    // The expanded mappings are only used for simple lookup, never followed
-    // recursively (which could have necessitated preserving cycles and handling
-    // them in that traversal too).
-    // Log cycles at a high verbosity level to aid debugging.
-    VERRS(8) << "Ignored cycle in include mappings: ";
-    for (const string& node : *node_stack)
-      VERRS(8) << node << " -> ";
-    VERRS(8) << key << "\n";
-    return;
+  // Given a vector of nodes, returns each node followed by its
+  // closure, ignoring duplicates.
+  vector<MappedInclude> Expand(const vector<MappedInclude>& nodes) {
+    vector<MappedInclude> retval;
+    ++stamp_;
+    for (const MappedInclude& node : nodes) {
+      const int id = GetId(node.quoted_include);
+      if (emitted_[id] != stamp_) {
+        emitted_[id] = stamp_;
+        retval.push_back(node);
+      }
+      for (const Entry& entry : closure_[id]) {
+        if (emitted_[entry.id] != stamp_) {
+          emitted_[entry.id] = stamp_;
+          retval.push_back(*entry.include);
+        }
+      }
+    }
+    return retval;
   }
-  if (status == kDone)
-    return;
 
-  IncludePicker::IncludeMap::iterator node = filename_map->find(key);
-  if (node == filename_map->end()) {
-    (*seen_nodes)[key] = kDone;
-    return;
+ private:
+  struct Entry {
+    int id;
+    const MappedInclude* include;
+  };
+
+  // Returns the id of quoted_include, allocating one if it's new.
+  int GetId(const string& quoted_include) {
+    const auto [it, inserted] =
+        ids_.try_emplace(quoted_include, static_cast<int>(names_.size()));
+    if (inserted) {
+      names_.push_back(it->first());
+      children_.push_back(nullptr);
+      child_ids_.emplace_back();
+      closure_.emplace_back();
+      component_.push_back(-1);
+      index_.push_back(-1);
+      lowlink_.push_back(-1);
+      on_stack_.push_back(false);
+      emitted_.push_back(0);
+      expanded_.push_back(0);
+    }
+    return it->second;
   }
 
-  // Keep track of node->second as we update it, to avoid duplicates.
-  (*seen_nodes)[key] = kCalculating;
-  for (const MappedInclude& child : node->second) {
-    node_stack->push_back(child.quoted_include);
-    MakeNodeTransitive(filename_map, seen_nodes, node_stack,
-                       child.quoted_include);
-    node_stack->pop_back();
+  // Tarjan's algorithm.  Each component is closed as soon as it's found.
+  void FindComponents(int id) {
+    index_[id] = lowlink_[id] = next_index_++;
+    stack_.push_back(id);
+    on_stack_[id] = true;
+    for (int child : child_ids_[id]) {
+      if (index_[child] == -1) {
+        FindComponents(child);
+        lowlink_[id] = std::min(lowlink_[id], lowlink_[child]);
+      } else if (on_stack_[child]) {
+        lowlink_[id] = std::min(lowlink_[id], index_[child]);
+      }
+    }
+    if (lowlink_[id] != index_[id])
+      return;
+
+    vector<int> members;
+    int member;
+    do {
+      member = stack_.back();
+      stack_.pop_back();
+      on_stack_[member] = false;
+      component_[member] = next_component_;
+      members.push_back(member);
+    } while (member != id);
+
+    if (members.size() > 1 && ShouldPrint(8)) {
+      VERRS(8) << "Cycle in include mappings:";
+      for (int cycle_member : members)
+        VERRS(8) << " " << names_[cycle_member];
+      VERRS(8) << "\n";
+    }
+
+    for (int closed : members) {
+      ++stamp_;
+      AppendChildren(closed, &closure_[closed]);
+    }
+    ++next_component_;
   }
-  (*seen_nodes)[key] = kDone;
 
-  // Our transitive closure is just the union of the closure of our
-  // children.  This routine replaces our value with this closure,
-  // by replacing each of our values with its values.  Since our
-  // values have already been made transitive, that is a closure.
-  ExpandOnce(*filename_map, &node->second);
-}
+  // Appends the children of id and their closures to out.  Children in
+  // the same component aren't closed yet, so they're expanded in turn.
+  void AppendChildren(int id, vector<Entry>* out) {
+    expanded_[id] = stamp_;
+    if (children_[id] == nullptr)
+      return;
+    for (size_t i = 0; i < children_[id]->size(); ++i) {
+      const int child = child_ids_[id][i];
+      if (emitted_[child] != stamp_) {
+        emitted_[child] = stamp_;
+        out->push_back({child, &(*children_[id])[i]});
+      }
+      if (component_[child] != component_[id]) {
+        for (const Entry& entry : closure_[child]) {
+          if (emitted_[entry.id] != stamp_) {
+            emitted_[entry.id] = stamp_;
+            out->push_back(entry);
+          }
+        }
+      } else if (expanded_[child] != stamp_) {
+        AppendChildren(child, out);
+      }
+    }
+  }
 
-// Updates the values in filename_map based on its transitive mappings.
-void MakeMapTransitive(IncludePicker::IncludeMap* filename_map) {
-  // Insert keys of filename_map here once we know their value is
-  // the complete transitive closure.
-  map<string, TransitiveStatus> seen_nodes;
-  vector<string> node_stack;
-  for (const IncludePicker::IncludeMap::value_type& includes : *filename_map)
-    MakeNodeTransitive(filename_map, &seen_nodes, &node_stack, includes.first);
-}
+  llvm::StringMap<int> ids_;
+  // Indexed by node id.  children_ is null for nodes that aren't keys.
+  vector<StringRef> names_;
+  vector<const vector<MappedInclude>*> children_;
+  vector<vector<int>> child_ids_;
+  vector<vector<Entry>> closure_;
+  vector<int> component_;
+
+  // Tarjan state.
+  vector<int> index_;
+  vector<int> lowlink_;
+  vector<bool> on_stack_;
+  vector<int> stack_;
+  int next_index_ = 0;
+  int next_component_ = 0;
+
+  // Per-traversal marks, valid when equal to stamp_.
+  vector<unsigned> emitted_;
+  vector<unsigned> expanded_;
+  unsigned stamp_ = 0;
+};
 
 // Get a scalar value from a YAML node.
 // Returns empty string if it's not of type ScalarNode.
@@ -1473,6 +1559,20 @@ string YAMLQuoted(IncludeVisibility visibility) {
   CHECK_UNREACHABLE_("unexpected visibility");
 }
 
+void WriteMapping(llvm::raw_ostream& out,
+                  StringRef directive,
+                  StringRef map_from,
+                  IncludeVisibility from_visibility,
+                  StringRef map_to,
+                  IncludeVisibility to_visibility) {
+  out << "  { " << YAMLQuoted(directive) << ": ["
+      << YAMLQuoted(map_from) << ", "
+      << YAMLQuoted(from_visibility) << ", "
+      << YAMLQuoted(map_to) << ", "
+      << YAMLQuoted(to_visibility)
+      << "] },\n";
+}
+
 void WriteMappings(StringRef directive,
                    const IncludeMapEntry* entries,
                    size_t count,
@@ -1496,12 +1596,8 @@ void WriteMappings(StringRef directive,
     CHECK_(entry.to_visibility != kUnusedVisibility)
         << "cannot export unknown to-visibility";
 
-    out << "  { " << YAMLQuoted(directive) << ": ["
-        << YAMLQuoted(entry.map_from) << ", "
-        << YAMLQuoted(entry.from_visibility) << ", "
-        << YAMLQuoted(entry.map_to) << ", "
-        << YAMLQuoted(entry.to_visibility)
-        << "] },\n";
+    WriteMapping(out, directive, entry.map_from, entry.from_visibility,
+                 entry.map_to, entry.to_visibility);
   }
   out << "]\n";
 }
@@ -1535,6 +1631,25 @@ void ExportInternalMappings(const string& dirpath) {
 #undef WRITE_MAPPINGS_ARRAY
 }
 
+bool WriteGeneratedMappings(const set<pair<string, string>>& mappings,
+                            const string& filename) {
+  std::error_code error;
+  llvm::raw_fd_ostream out(filename, error);
+  if (error) {
+    llvm::errs() << filename << ": error: " << error.message() << "\n";
+    return false;
+  }
+
+  // No timestamp, so the file only changes when the mappings do.
+  out << "# Generated by IWYU from the include graph\n";
+  out << "[\n";
+  for (const auto& [map_from, map_to] : mappings) {
+    WriteMapping(out, "include", map_from, kPrivate, map_to, kPublic);
+  }
+  out << "]\n";
+  return true;
+}
+
 MappedInclude::MappedInclude(const string& q, const string& p)
   : quoted_include(q)
   , path(p)
@@ -1716,6 +1831,10 @@ void IncludePicker::AddSymbolMapping(const string& map_from,
                  to_visibility);
 }
 
+void IncludePicker::AddFullUseType(const string& qualified_name) {
+  full_use_types_.insert(qualified_name);
+}
+
 void IncludePicker::AddIncludeMappings(const IncludeMapEntry* entries,
                                        size_t count) {
   for (size_t i = 0; i < count; ++i) {
@@ -1838,11 +1957,21 @@ void IncludePicker::FinalizeAddedIncludes() {
   ExpandRegexes();
 
   // If a.h maps to b.h maps to c.h, we'd like an entry from a.h to c.h too.
-  MakeMapTransitive(&filepath_include_map_);
-  // Now that filepath_include_map_ is transitively closed, it's an
-  // easy task to get the values of symbol_include_map_ closed too.
-  for (IncludeMap::value_type& symbol_include : symbol_include_map_) {
-    ExpandOnce(filepath_include_map_, &symbol_include.second);
+  // Once filepath_include_map_ is transitively closed, it's an easy task
+  // to get the values of symbol_include_map_ closed too.  Both are
+  // updated only after all closures are computed, since the closures
+  // refer to the original values.
+  {
+    IncludeMapClosure closure(filepath_include_map_);
+    for (IncludeMap::value_type& symbol_include : symbol_include_map_)
+      symbol_include.second = closure.Expand(symbol_include.second);
+    vector<vector<MappedInclude>> closed_values;
+    closed_values.reserve(filepath_include_map_.size());
+    for (const IncludeMap::value_type& includes : filepath_include_map_)
+      closed_values.push_back(closure.GetClosure(includes.first));
+    size_t i = 0;
+    for (IncludeMap::value_type& includes : filepath_include_map_)
+      includes.second = std::move(closed_values[i++]);
   }
 
   has_called_finalize_added_include_lines_ = true;
@@ -1989,6 +2118,27 @@ vector<string> IncludePicker::GetCandidateHeadersForFilepathIncludedFrom(
   return BestQuotedIncludesForIncluder(mapped_includes, including_filepath);
 }
 
+const vector<string>& IncludePicker::GetCandidateHeadersForFileIncludedFrom(
+    OptionalFileEntryRef included_file,
+    OptionalFileEntryRef including_file) const {
+  CHECK_(has_called_finalize_added_include_lines_ && "Must finalize includes");
+  // Keyed on the names rather than the file entries: one file reached
+  // through a symlink or a different -I spelling has one entry but
+  // several names, and the answer depends on the name.  Each name has
+  // its own map entry, so the paths are only normalized on a miss.
+  const auto name_key = [](OptionalFileEntryRef file) -> const void* {
+    return file ? &file->getMapEntry() : nullptr;
+  };
+  auto [it, inserted] = candidate_headers_cache_.try_emplace(
+      make_pair(name_key(included_file), name_key(including_file)));
+  if (inserted) {
+    it->second = std::make_unique<const vector<string>>(
+        GetCandidateHeadersForFilepathIncludedFrom(
+            GetFilePath(included_file), GetFilePath(including_file)));
+  }
+  return *it->second;
+}
+
 bool IncludePicker::HasMapping(const string& map_from_filepath,
                                const string& map_to_filepath) const {
   CHECK_(has_called_finalize_added_include_lines_ && "Must finalize includes");
@@ -2031,11 +2181,88 @@ vector<string> IncludePicker::GetMappedPublicHeaders(
   return GetCandidateHeadersForFilepathIncludedFrom(decl_filepath, use_path);
 }
 
+vector<string> IncludePicker::GetMappedPublicHeaders(
+    const string& symbol_name,
+    OptionalFileEntryRef use_file,
+    OptionalFileEntryRef decl_file) const {
+  vector<string> symbol_headers =
+      GetCandidateHeadersForSymbolUsedFrom(symbol_name, GetFilePath(use_file));
+  if (!symbol_headers.empty())
+    return symbol_headers;
+  return GetCandidateHeadersForFileIncludedFrom(decl_file, use_file);
+}
+
+namespace {
+
+int64_t MappedIncludesBytes(const vector<MappedInclude>& includes) {
+  int64_t bytes = VectorHeapBytes(includes);
+  for (const MappedInclude& include : includes) {
+    bytes += StringHeapBytes(include.quoted_include) +
+             StringHeapBytes(include.path);
+  }
+  return bytes;
+}
+
+int64_t StringSetBytes(const set<string>& strings) {
+  int64_t bytes = strings.size() * TreeNodeBytes<string>();
+  for (const string& str : strings)
+    bytes += StringHeapBytes(str);
+  return bytes;
+}
+
+}  // anonymous namespace
+
+MemoryUsage IncludePicker::EstimateMemoryUsage() const {
+  MemoryUsage usage;
+  for (const IncludeMap* m : {&symbol_include_map_, &filepath_include_map_}) {
+    for (const IncludeMap::value_type& entry : *m) {
+      ++usage.entries;
+      usage.bytes += TreeNodeBytes<IncludeMap::value_type>() +
+                     StringHeapBytes(entry.first) +
+                     MappedIncludesBytes(entry.second);
+    }
+  }
+  for (const VisibilityMap* m :
+       {&include_visibility_map_, &path_visibility_map_}) {
+    for (const VisibilityMap::value_type& entry : *m) {
+      ++usage.entries;
+      usage.bytes += TreeNodeBytes<VisibilityMap::value_type>() +
+                     StringHeapBytes(entry.first);
+    }
+  }
+  for (const map<string, set<string>>* m :
+       {&quoted_includes_to_quoted_includers_, &friend_to_headers_map_}) {
+    for (const auto& entry : *m) {
+      ++usage.entries;
+      usage.bytes += TreeNodeBytes<pair<const string, set<string>>>() +
+                     StringHeapBytes(entry.first) + StringSetBytes(entry.second);
+    }
+  }
+  for (const auto& entry : includer_and_includee_to_include_as_written_) {
+    ++usage.entries;
+    usage.bytes += TreeNodeBytes<pair<const pair<string, string>, string>>() +
+                   StringHeapBytes(entry.first.first) +
+                   StringHeapBytes(entry.first.second) +
+                   StringHeapBytes(entry.second);
+  }
+  usage.bytes += candidate_headers_cache_.getMemorySize();
+  for (const auto& entry : candidate_headers_cache_) {
+    ++usage.entries;
+    usage.bytes += sizeof(vector<string>) + VectorHeapBytes(*entry.second);
+    for (const string& header : *entry.second)
+      usage.bytes += StringHeapBytes(header);
+  }
+  usage.entries += full_use_types_.size();
+  usage.bytes += StringSetBytes(full_use_types_);
+  return usage;
+}
+
 // Parses a YAML/JSON file containing mapping directives of various types:
 //  symbol   - symbol name -> quoted include
 //  include  - private quoted include -> public quoted include
 //  ref      - include mechanism for mapping files, to allow project-specific
 //             groupings
+//  full_use - class template whose instantiation fully uses its type args
 // This private implementation method is recursive and builds the search path
 // incrementally.
 void IncludePicker::AddMappingsFromFile(const string& filename,
@@ -2172,6 +2399,16 @@ void IncludePicker::AddMappingsFromFile(const string& filename,
 
         // Recurse.
         AddMappingsFromFile(ref_file, extended_search_path);
+      } else if (directive == "full_use") {
+        // Full-use type.
+        string type_name = GetScalarValue(mapping_item_node.getValue());
+        if (type_name.empty()) {
+          json_stream.printError(current_node,
+              "Full-use type expects a single qualified template name.");
+          return;
+        }
+
+        AddFullUseType(type_name);
       } else {
         json_stream.printError(current_node,
             "Unknown directive '" + directive + "'.");
@@ -46,12 +46,15 @@
 
 #include <cstddef>
 #include <map>                          // for map, map<>::value_compare
+#include <memory>                       // for unique_ptr
 #include <set>                          // for set
 #include <string>                       // for string
 #include <utility>                      // for pair
 #include <vector>                       // for vector
 
 #include "clang/Basic/FileEntry.h"
+#include "iwyu_memory_report.h"
+#include "llvm/ADT/DenseMap.h"
 
 // TODO: Clean out pragmas as IWYU improves.
 // IWYU pragma: no_include <iterator>
@@ -75,6 +78,12 @@ enum class CXXStdLib { None, ClangSymbols, Libstdcxx, Libcxx };
 // Write out all internal mappings to files in dirpath.
 void ExportInternalMappings(const string& dirpath);
 
+// Write out the private-to-public quoted include pairs found by
+// --generate_mappings as a mapping file.  Returns false, after printing
+// an error, if the file can't be written.
+bool WriteGeneratedMappings(const set<pair<string, string>>& mappings,
+                            const string& filename);
+
 // When a symbol or file is mapped to an include, that include is represented
 // by this struct.  It always has a quoted_include and may also have a path
 // (depending on its origin).
@@ -178,6 +187,15 @@ class IncludePicker {
   vector<string> GetCandidateHeadersForFilepathIncludedFrom(
       const string& included_filepath, const string& including_filepath) const;
 
+  // The same, for file entries.  Once the picker is finalized the
+  // answer for an (includee, includer) pair of paths never changes, and
+  // most uses in a file repeat a handful of pairs, so results are
+  // memoized.
+  // The returned reference stays valid for the picker's lifetime.
+  const vector<string>& GetCandidateHeadersForFileIncludedFrom(
+      clang::OptionalFileEntryRef included_file,
+      clang::OptionalFileEntryRef including_file) const;
+
   // Returns true if there is a mapping (possibly indirect) from
   // map_from to map_to.  This means that to_file 're-exports' all the
   // symbols from from_file.  Both map_from_filepath and
@@ -190,11 +208,23 @@ class IncludePicker {
   // Parses a YAML/JSON file containing mapping directives of various types.
   void AddMappingsFromFile(const string& filename);
 
+  // Qualified names of class templates added by 'full_use' mapping
+  // directives, on top of the built-in ones in iwyu_cache.cc.
+  const set<string>& full_use_types() const {
+    return full_use_types_;
+  }
+
   // Returns the headers which the symbol is mapped to. If none, returns
   // the headers which decl_filepath is mapped to.
   vector<string> GetMappedPublicHeaders(const string& symbol_name,
                                         const string& use_path,
                                         const string& decl_filepath) const;
+  vector<string> GetMappedPublicHeaders(
+      const string& symbol_name, clang::OptionalFileEntryRef use_file,
+      clang::OptionalFileEntryRef decl_file) const;
+
+  // For --memory_report: all mappings, include graph edges and caches.
+  MemoryUsage EstimateMemoryUsage() const;
 
  private:
   // Private implementation of mapping file parser, which takes
@@ -219,6 +249,10 @@ class IncludePicker {
       const string& map_from, const MappedInclude& map_to,
       IncludeVisibility to_visibility);
 
+  // Records a class template (e.g. "absl::flat_hash_map") whose
+  // instantiation requires full use of all its type arguments.
+  void AddFullUseType(const string& qualified_name);
+
   // Adds mappings from sized arrays of IncludeMapEntry.
   void AddIncludeMappings(const IncludeMapEntry* entries, size_t count);
   void AddSymbolMappings(const IncludeMapEntry* entries, size_t count);
@@ -304,6 +338,17 @@ class IncludePicker {
   // contents of friend_to_headers_map_["@\"foo/bar/.*\""].
   map<string, set<string>> friend_to_headers_map_;
 
+  // Memoized results of GetCandidateHeadersForFileIncludedFrom, keyed
+  // by the (includee, includer) names, as the FileEntryRef map entries
+  // that hold them, or nullptr for no file.  The results are held by
+  // pointer so that references to them survive rehashing.
+  mutable llvm::DenseMap<pair<const void*, const void*>,
+                         std::unique_ptr<const vector<string>>>
+      candidate_headers_cache_;
+
+  // Class templates declared full-use by mapping files.
+  set<string> full_use_types_;
+
   // Make sure we don't do any non-const operations after finalizing.
   bool has_called_finalize_added_include_lines_;
 
@@ -0,0 +1,90 @@
+//===--- iwyu_memory_report.cc - memory held by iwyu's tables -------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "iwyu_memory_report.h"
+
+#include <system_error>                 // for error_code
+
+#include "iwyu_globals.h"
+#include "iwyu_port.h"  // for CHECK_
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+using llvm::errs;
+using llvm::raw_fd_ostream;
+using llvm::raw_ostream;
+
+namespace include_what_you_use {
+
+int64_t StringHeapBytes(const string& str) {
+  // Short strings live inside the string object itself.
+  const char* data = str.data();
+  const char* object = reinterpret_cast<const char*>(&str);
+  if (data >= object && data < object + sizeof(str))
+    return 0;
+  return str.capacity() + 1;
+}
+
+bool MemoryReport::IsEnabled() {
+  return GlobalFlags().memory_report ||
+         !GlobalFlags().memory_report_json.empty();
+}
+
+void MemoryReport::BeginPhase(const string& phase) {
+  phases_.push_back(Phase{phase, {}});
+}
+
+void MemoryReport::Add(const string& subsystem, const MemoryUsage& usage) {
+  CHECK_(!phases_.empty() && "Call BeginPhase before Add");
+  phases_.back().subsystems.emplace_back(subsystem, usage);
+}
+
+void MemoryReport::Print(raw_ostream& os) const {
+  for (const Phase& phase : phases_) {
+    os << "Memory report after " << phase.name << ":\n"
+       << "     entries          bytes  subsystem\n";
+    for (const auto& [subsystem, usage] : phase.subsystems) {
+      os << llvm::format("%12lld %14lld", static_cast<long long>(usage.entries),
+                         static_cast<long long>(usage.bytes))
+         << "  " << subsystem << "\n";
+    }
+  }
+}
+
+bool MemoryReport::WriteJson(const string& filename) const {
+  std::error_code error;
+  raw_fd_ostream os(filename, error);
+  if (error) {
+    errs() << filename << ": error: " << error.message() << "\n";
+    return false;
+  }
+
+  llvm::json::OStream json(os, /*IndentSize=*/2);
+  json.array([&] {
+    for (const Phase& phase : phases_) {
+      json.object([&] {
+        json.attribute("phase", phase.name);
+        json.attributeArray("subsystems", [&] {
+          for (const auto& [subsystem, usage] : phase.subsystems) {
+            json.object([&] {
+              json.attribute("subsystem", subsystem);
+              json.attribute("entries", usage.entries);
+              json.attribute("bytes", usage.bytes);
+            });
+          }
+        });
+      });
+    }
+  });
+  os << "\n";
+  return true;
+}
+
+}  // namespace include_what_you_use
@@ -0,0 +1,95 @@
+//===--- iwyu_memory_report.h - memory held by iwyu's tables --------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// Estimates how much memory each of iwyu's own data structures holds at
+// the end of each analysis phase, next to what clang's ASTContext has
+// allocated.  Enabled by --memory_report and --memory_report_json; it
+// answers "where does iwyu's peak memory go on this file?".
+//
+// The estimates count container elements at their sizeof, plus the
+// heap storage of strings and a guess at the per-node overhead of
+// std::map and std::set.  They are meant for comparing subsystems and
+// phases, not for exact accounting.
+
+#ifndef INCLUDE_WHAT_YOU_USE_IWYU_MEMORY_REPORT_H_
+#define INCLUDE_WHAT_YOU_USE_IWYU_MEMORY_REPORT_H_
+
+#include <cstdint>                      // for int64_t
+#include <string>                       // for string
+#include <utility>                      // for pair
+#include <vector>                       // for vector
+
+namespace llvm {
+class raw_ostream;
+}  // namespace llvm
+
+namespace include_what_you_use {
+
+using std::pair;
+using std::string;
+using std::vector;
+
+struct MemoryUsage {
+  int64_t entries = 0;
+  int64_t bytes = 0;
+
+  MemoryUsage& operator+=(const MemoryUsage& other) {
+    entries += other.entries;
+    bytes += other.bytes;
+    return *this;
+  }
+};
+
+// Estimated size of one node of a std::map or std::set holding T: the
+// element plus the parent and child links and the color.
+template <typename T>
+constexpr int64_t TreeNodeBytes() {
+  return sizeof(T) + 4 * sizeof(void*);
+}
+
+// Bytes a string holds on the heap, beyond sizeof(string).  Zero for
+// strings short enough to be stored inline.
+int64_t StringHeapBytes(const string& str);
+
+// Bytes a vector holds on the heap, not counting what its elements in
+// turn point to.
+template <typename T>
+int64_t VectorHeapBytes(const vector<T>& v) {
+  return v.capacity() * sizeof(T);
+}
+
+class MemoryReport {
+ public:
+  // Returns true if either reporting flag is set.
+  static bool IsEnabled();
+
+  // Starts the snapshot taken at the end of the named phase.  The
+  // following calls to Add belong to it.
+  void BeginPhase(const string& phase);
+  void Add(const string& subsystem, const MemoryUsage& usage);
+
+  // Prints one table per phase.
+  void Print(llvm::raw_ostream& os) const;
+
+  // Writes all phases as a JSON array, in the order they ran.  Returns
+  // false, after printing an error, if the file can't be written.
+  bool WriteJson(const string& filename) const;
+
+ private:
+  struct Phase {
+    string name;
+    vector<pair<string, MemoryUsage>> subsystems;
+  };
+
+  vector<Phase> phases_;
+};
+
+}  // namespace include_what_you_use
+
+#endif  // INCLUDE_WHAT_YOU_USE_IWYU_MEMORY_REPORT_H_
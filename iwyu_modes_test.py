@@ -0,0 +1,165 @@
+#!/usr/bin/env python3
+
+##===--- iwyu_modes_test.py - test IWYU modes that write files ------------===##
+#
+#                     The LLVM Compiler Infrastructure
+#
+# This file is distributed under the University of Illinois Open Source
+# License. See LICENSE.TXT for details.
+#
+##===----------------------------------------------------------------------===##
+
+"""Tests for IWYU modes that run_iwyu_tests.py cannot check.
+
+run_iwyu_tests.py checks the diagnostics and summaries of a single run against
+the comments in the test file.  The modes tested here write files, or promise
+that two different invocations produce the same output, so each test copies an
+input tree from tests/modes/ to a scratch directory, runs IWYU there and
+compares what comes out.
+
+Usage: iwyu_modes_test.py [unittest args] [-- path/to/include-what-you-use]
+"""
+
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import unittest
+
+
+_MODES_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                          'tests', 'modes')
+
+_FIX_INCLUDES_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                  'fix_includes.py')
+
+_IWYU_PATH = shutil.which('include-what-you-use')
+
+
+class IwyuModesTestBase(unittest.TestCase):
+  # The directory under tests/modes/ holding the input tree.
+  input_dir = None
+
+  def setUp(self):
+    if not _IWYU_PATH:
+      self.skipTest('\'include-what-you-use\' not found in PATH')
+    scratch_dir = tempfile.mkdtemp()
+    self.addCleanup(shutil.rmtree, scratch_dir)
+    self.workdir = os.path.join(scratch_dir, self.input_dir)
+    shutil.copytree(os.path.join(_MODES_DIR, self.input_dir), self.workdir)
+
+  def RunCommand(self, cmd, stdin=''):
+    """Runs cmd in the scratch directory, returns (exit code, output)."""
+    p = subprocess.run(cmd, cwd=self.workdir, input=stdin.encode('utf-8'),
+                       stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+    return p.returncode, p.stdout.decode('utf-8')
+
+  def RunIwyu(self, args):
+    """Runs IWYU with args in the scratch directory, returns its output."""
+    _, output = self.RunCommand([_IWYU_PATH] + args)
+    return output
+
+  def ReadFile(self, filename):
+    """Returns the contents of filename in the scratch directory."""
+    with open(os.path.join(self.workdir, filename)) as f:
+      return f.read()
+
+
+class PchSidecarTest(IwyuModesTestBase):
+  input_dir = 'pch'
+
+  def testReplayedSidecarMatchesPrefixHeader(self):
+    """The headers inside a PCH are seen as if included with -include."""
+    clang = shutil.which('clang++')
+    if not clang:
+      self.skipTest('\'clang++\' not found in PATH')
+
+    self.RunIwyu(['-Xiwyu', '--write_pch_sidecar=prefix.iwyu',
+                  '-x', 'c++-header', 'prefix.h'])
+    self.assertTrue(os.path.exists(os.path.join(self.workdir, 'prefix.iwyu')))
+
+    exit_code, output = self.RunCommand(
+        [clang, '-x', 'c++-header', 'prefix.h', '-o', 'prefix.h.pch'])
+    if exit_code != 0:
+      self.skipTest('cannot build the PCH:\n' + output)
+
+    expected = self.RunIwyu(['-include', 'prefix.h', 'main.cc'])
+    actual = self.RunIwyu(['-include-pch', 'prefix.h.pch',
+                           '-Xiwyu', '--pch_sidecar=prefix.iwyu', 'main.cc'])
+    if 'PCH file' in actual or 'AST file' in actual:
+      # clang++ from PATH is not the clang IWYU is built against.
+      self.skipTest('cannot load the PCH:\n' + actual)
+    self.assertNotIn('warning:', actual)
+    self.assertEqual(expected, actual)
+
+
+class JobsTest(IwyuModesTestBase):
+  input_dir = 'jobs'
+
+  def testOutputDoesNotDependOnJobs(self):
+    """Headers computed in forked processes are reported as without."""
+    args = ['-Xiwyu', '--check_also=lib/*.h', '-Xiwyu', '--error',
+            '-I', '.', 'main.cc']
+    expected = self.RunCommand([_IWYU_PATH, '-Xiwyu', '--jobs=1'] + args)
+    actual = self.RunCommand([_IWYU_PATH, '-Xiwyu', '--jobs=4'] + args)
+    for header in ('lib/a.h', 'lib/b.h', 'lib/e.h'):
+      self.assertIn(header + ' should add these lines:', expected[1])
+    self.assertIn('(lib/c.h has correct #includes/fwd-decls)', expected[1])
+    self.assertEqual(expected, actual)
+
+
+class GenerateMappingsTest(IwyuModesTestBase):
+  input_dir = 'generate_mappings'
+
+  def testMappingsFromIncludeGraph(self):
+    """Private headers map to the entry headers they are reached from."""
+    self.RunIwyu(['-Xiwyu', '--generate_mappings=mylib.imp',
+                  '-I', 'include', 'mylib_public.cc'])
+    self.assertEqual(self.ReadFile('expected.imp'), self.ReadFile('mylib.imp'))
+
+
+class ApplyTest(IwyuModesTestBase):
+  input_dir = 'apply'
+
+  def AssertAppliesAsFixIncludes(self, args, edited_files):
+    """--apply and fix_includes.py both edit files as in expected/."""
+    self.RunIwyu(['-Xiwyu', '--apply', '-I', '.'] + args)
+    for filename in edited_files:
+      self.assertEqual(self.ReadFile(os.path.join('expected', filename)),
+                       self.ReadFile(filename), filename + ' with --apply')
+
+    for filename in edited_files:
+      shutil.copy(os.path.join(_MODES_DIR, self.input_dir, filename),
+                  os.path.join(self.workdir, filename))
+    output = self.RunIwyu(['-I', '.'] + args)
+    self.RunCommand([sys.executable, _FIX_INCLUDES_PATH, '--nosafe_headers'],
+                    stdin=output)
+    for filename in edited_files:
+      self.assertEqual(self.ReadFile(os.path.join('expected', filename)),
+                       self.ReadFile(filename),
+                       filename + ' with fix_includes.py')
+
+  def testRemoveInclude(self):
+    self.AssertAppliesAsFixIncludes(['remove_include.cc'],
+                                    ['remove_include.cc'])
+
+  def testRemoveForwardDeclares(self):
+    """A namespace left empty is removed along with its forward-declare."""
+    self.AssertAppliesAsFixIncludes(['remove_fwd_decl.cc'],
+                                    ['remove_fwd_decl.cc'])
+
+  def testAddIncludeToFileWithoutIncludes(self):
+    """The #include goes after the license header and header guard."""
+    self.AssertAppliesAsFixIncludes(
+        ['-Xiwyu', '--check_also=lib/no_includes.h', 'add_include.cc'],
+        ['lib/no_includes.h'])
+
+
+if __name__ == '__main__':
+  if '--' in sys.argv:
+    separator = sys.argv.index('--')
+    if separator + 1 < len(sys.argv):
+      _IWYU_PATH = sys.argv[separator + 1]
+    del sys.argv[separator:]
+  unittest.main()
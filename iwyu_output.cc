@@ -11,6 +11,7 @@
 
 #include <algorithm>                    // for sort, find
 #include <cstdio>                       // for snprintf
+#include <cstdlib>                      // for strtoul
 #include <iterator>                     // for inserter
 #include <list>
 #include <map>                          // for _Rb_tree_const_iterator, etc
@@ -27,7 +28,10 @@
 #include "clang/AST/Type.h"
 #include "clang/AST/TypeLoc.h"
 #include "clang/Basic/SourceLocation.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Rewrite/Core/Rewriter.h"
 #include "iwyu_ast_util.h"
+#include "iwyu_fix_includes.h"
 #include "iwyu_globals.h"
 #include "iwyu_include_picker.h"
 #include "iwyu_location_util.h"
@@ -36,7 +40,9 @@
 #include "iwyu_stl_util.h"
 #include "iwyu_string_util.h"
 #include "iwyu_verrs.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Support/Casting.h"
 
@@ -50,19 +56,23 @@ using clang::Decl;
 using clang::DeclContext;
 using clang::DeclarationName;
 using clang::EnumDecl;
+using clang::FileID;
 using clang::FunctionDecl;
 using clang::NamedDecl;
 using clang::NamespaceDecl;
 using clang::OptionalFileEntryRef;
 using clang::PrintingPolicy;
 using clang::RecordDecl;
+using clang::Rewriter;
 using clang::SourceLocation;
+using clang::SourceManager;
 using clang::SourceRange;
 using clang::TagDecl;
 using clang::TagTypeLoc;
 using clang::TemplateDecl;
 using clang::TypeSourceInfo;
 using clang::UsingDecl;
+using llvm::StringRef;
 using llvm::cast;
 using llvm::dyn_cast;
 using llvm::errs;
@@ -277,12 +287,47 @@ string GetShortNameAsString(const NamedDecl* named_decl) {
 
 }  // namespace internal
 
+namespace {
+
+struct SymbolNames {
+  string qualified;
+  string short_name;
+};
+
+// Printing the names of a decl is costly, and is needed only for
+// mapping lookups, 'why' comments and logging, so OneUse asks for them
+// lazily.  They are the same for all redecls, so we cache them by
+// canonical decl.
+void GetSymbolNames(const NamedDecl* decl, string* qualified,
+                    string* short_name) {
+  if (internal::FakeNamedDeclIfItIsOne(decl)) {  // tests reuse addresses
+    *qualified = internal::GetQualifiedNameAsString(decl);
+    *short_name = internal::GetShortNameAsString(decl);
+    return;
+  }
+  static map<const Decl*, SymbolNames> symbol_names;
+  const auto [it, inserted] =
+      symbol_names.try_emplace(decl->getCanonicalDecl());
+  if (inserted) {
+    it->second.qualified = internal::GetQualifiedNameAsString(decl);
+    it->second.short_name = internal::GetShortNameAsString(decl);
+  }
+  *qualified = it->second.qualified;
+  *short_name = it->second.short_name;
+}
+
+const clang::FileEntry* FileEntryOrNull(OptionalFileEntryRef file) {
+  return file ? &file->getFileEntry() : nullptr;
+}
+
+}  // anonymous namespace
+
 // Holds information about a single full or fwd-decl use of a symbol.
 OneUse::OneUse(const NamedDecl* decl, SourceLocation use_loc,
                SourceLocation decl_loc, OneUse::UseKind use_kind,
                UseFlags flags, const char* comment)
-    : symbol_name_(internal::GetQualifiedNameAsString(decl)),
-      short_symbol_name_(internal::GetShortNameAsString(decl)),
+    : name_decl_(decl),
+      has_symbol_names_(false),
       decl_(decl),
       decl_loc_(GetInstantiationLoc(decl_loc)),
       decl_file_(GetFileEntry(decl_loc_)),
@@ -298,7 +343,9 @@ OneUse::OneUse(const NamedDecl* decl, SourceLocation use_loc,
 // This constructor always creates a full use.
 OneUse::OneUse(const string& symbol_name, OptionalFileEntryRef dfn_file,
                SourceLocation use_loc)
-    : symbol_name_(symbol_name),
+    : name_decl_(nullptr),
+      has_symbol_names_(true),
+      symbol_name_(symbol_name),
       short_symbol_name_(symbol_name),
       decl_(nullptr),
       decl_file_(dfn_file),
@@ -318,7 +365,9 @@ OneUse::OneUse(const string& symbol_name, OptionalFileEntryRef dfn_file,
 OneUse::OneUse(OptionalFileEntryRef included_file,
                const string& quoted_include,
                clang::SourceLocation include_loc)
-    : symbol_name_(),
+    : name_decl_(nullptr),
+      has_symbol_names_(true),
+      symbol_name_(),
       short_symbol_name_(),
       decl_(nullptr),
       decl_file_(included_file),
@@ -349,12 +398,51 @@ string OneUse::PrintableUseLoc() const {
   return PrintableLoc(use_loc());
 }
 
+int64_t OneUse::HeapBytes() const {
+  int64_t bytes = StringHeapBytes(symbol_name_) +
+                  StringHeapBytes(short_symbol_name_) +
+                  StringHeapBytes(decl_filepath_) +
+                  VectorHeapBytes(repeated_use_locs_) +
+                  StringHeapBytes(comment_) +
+                  VectorHeapBytes(public_headers_) +
+                  StringHeapBytes(suggested_header_);
+  for (const string& header : public_headers_)
+    bytes += StringHeapBytes(header);
+  return bytes;
+}
+
+void OneUse::MaterializeSymbolNames() const {
+  if (has_symbol_names_)
+    return;
+  GetSymbolNames(name_decl_, &symbol_name_, &short_symbol_name_);
+  has_symbol_names_ = true;
+}
+
 void OneUse::SetPublicHeaders() {
   // We should never need to deal with public headers if we already know
   // who we map to.
   CHECK_(suggested_header_.empty() && "Should not need a public header here");
-  public_headers_ = GlobalIncludePicker().GetMappedPublicHeaders(
-      symbol_name_, GetFilePath(use_loc_), decl_filepath());
+  const OptionalFileEntryRef use_file = GetFileEntry(use_loc_);
+  if (name_decl_ && !internal::FakeNamedDeclIfItIsOne(name_decl_)) {
+    // After the first lookup for a symbol, key by the decl rather than
+    // printing its name again.
+    static map<std::tuple<const Decl*, const clang::FileEntry*,
+                          const clang::FileEntry*>,
+               vector<string>>
+        public_headers_by_decl;
+    const auto key =
+        std::make_tuple(name_decl_->getCanonicalDecl(),
+                        FileEntryOrNull(use_file), FileEntryOrNull(decl_file_));
+    const auto [it, inserted] = public_headers_by_decl.try_emplace(key);
+    if (inserted) {
+      it->second = GlobalIncludePicker().GetMappedPublicHeaders(
+          symbol_name(), use_file, decl_file_);
+    }
+    public_headers_ = it->second;
+  } else {
+    public_headers_ = GlobalIncludePicker().GetMappedPublicHeaders(
+        symbol_name(), use_file, decl_file_);
+  }
   if (public_headers_.empty())
     public_headers_.push_back(ConvertToQuotedInclude(decl_filepath()));
 }
@@ -562,8 +650,9 @@ bool OneIncludeOrForwardDeclareLine::HasSymbolUse(const string& symbol_name)
   return ContainsKey(symbol_counts_, symbol_name);
 }
 
-void OneIncludeOrForwardDeclareLine::AddSymbolUse(const string& symbol_name) {
-  ++symbol_counts_[symbol_name];
+void OneIncludeOrForwardDeclareLine::AddSymbolUse(const string& symbol_name,
+                                                  int count) {
+  symbol_counts_[symbol_name] += count;
 }
 
 bool OneIncludeOrForwardDeclareLine::IsIncludeLine() const {
@@ -685,6 +774,74 @@ static void LogIncludeFileUse(const string& prefix, const OneUse& use) {
            << " at " << use.PrintableUseLoc() << "\n";
 }
 
+MemoryUsage IwyuFileInfo::EstimateSymbolUseMemoryUsage() const {
+  MemoryUsage usage;
+  usage.entries = symbol_uses_.size();
+  usage.bytes = VectorHeapBytes(symbol_uses_);
+  for (const OneUse& use : symbol_uses_)
+    usage.bytes += use.HeapBytes();
+  for (const auto& entry : coalesced_uses_) {
+    usage.bytes += TreeNodeBytes<decltype(coalesced_uses_)::value_type>() +
+                   StringHeapBytes(std::get<string>(entry.first));
+  }
+  usage.bytes += coalescable_decls_.size() *
+                 TreeNodeBytes<decltype(coalescable_decls_)::value_type>();
+  return usage;
+}
+
+bool IwyuFileInfo::UsesAreCoalescable(const NamedDecl* decl) {
+  // Only whether a use comes before the redecls and definitions of a
+  // decl in the same file, or with --no_fwd_decls anywhere in the
+  // translation unit, depends on the use location.
+  if (GlobalFlags().no_fwd_decls)
+    return false;
+  const auto [it, inserted] = coalescable_decls_.try_emplace(decl, true);
+  if (!inserted)
+    return it->second;
+
+  vector<const Decl*> redecls(decl->redecls_begin(), decl->redecls_end());
+  const ClassTemplateDecl* tpl_decl = DynCastFrom(decl);
+  if (const ClassTemplateSpecializationDecl* spec_decl = DynCastFrom(decl))
+    tpl_decl = spec_decl->getSpecializedTemplate();
+  if (tpl_decl) {
+    redecls.insert(redecls.end(), tpl_decl->redecls_begin(),
+                   tpl_decl->redecls_end());
+    for (const ClassTemplateSpecializationDecl* spec :
+         tpl_decl->specializations()) {
+      redecls.insert(redecls.end(), spec->redecls_begin(), spec->redecls_end());
+    }
+  }
+  for (const Decl* redecl : redecls) {
+    if (GetFileEntry(redecl) == file_) {
+      it->second = false;
+      break;
+    }
+  }
+  return it->second;
+}
+
+bool IwyuFileInfo::CoalesceUse(const NamedDecl* decl, SourceLocation use_loc,
+                               OneUse::UseKind use_kind, UseFlags flags,
+                               const char* comment) {
+  // Uses in macros keep their own records, for the "used here" notes.
+  if (!use_loc.isFileID() || GetFileEntry(use_loc) != file_ ||
+      !UsesAreCoalescable(decl)) {
+    return false;
+  }
+  const auto [it, inserted] = coalesced_uses_.try_emplace(
+      std::make_tuple(decl, use_kind, flags, string(comment ? comment : "")),
+      symbol_uses_.size());
+  if (inserted)
+    return false;
+
+  OneUse& use = symbol_uses_[it->second];
+  use.add_repeated_use_loc(use_loc);
+  VERRS(6) << "Coalesced use of " << internal::PrintablePtr(decl)
+           << use.symbol_name() << " at " << PrintableLoc(use_loc)
+           << " into use at " << use.PrintableUseLoc() << "\n";
+  return true;
+}
+
 void IwyuFileInfo::ReportFullSymbolUse(SourceLocation use_loc,
                                        const NamedDecl* decl,
                                        UseFlags flags,
@@ -706,6 +863,8 @@ void IwyuFileInfo::ReportFullSymbolUse(SourceLocation use_loc,
       report_decl_loc = decl->getLocation();
     }
 
+    if (CoalesceUse(report_decl, use_loc, OneUse::kFullUse, flags, comment))
+      return;
     symbol_uses_.push_back(OneUse(report_decl, use_loc, report_decl_loc,
                                   OneUse::kFullUse, flags, comment));
     LogSymbolUse("Marked full-info use of decl", symbol_uses_.back());
@@ -757,6 +916,8 @@ void IwyuFileInfo::ReportForwardDeclareUse(SourceLocation use_loc,
   // combines friend decls with true forward-declare decls.  If that
   // happened here, replace the friend with a real fwd decl.
   decl = GetNonfriendClassRedecl(decl);
+  if (CoalesceUse(decl, use_loc, OneUse::kForwardDeclareUse, flags, comment))
+    return;
   symbol_uses_.push_back(OneUse(decl, use_loc, GetLocation(decl),
                                 OneUse::kForwardDeclareUse, flags, comment));
   LogSymbolUse("Marked fwd-decl use of decl", symbol_uses_.back());
@@ -1204,8 +1365,8 @@ void ProcessForwardDeclare(OneUse* use,
   // (A6) If a definition exists earlier in this file, discard this use.
   // Note: for the 'earlier' checks, what matters is the *instantiation*
   // location.
-  const set<const NamedDecl*> redecls = GetTagRedecls(tag_decl);
-  for (const NamedDecl* redecl : redecls) {
+  for (const NamedDecl* redecl :
+       GetTagRedeclsInFile(tag_decl, GetFileEntry(use->use_loc()))) {
     CHECK_(isa<TagDecl>(redecl) && "GetTagRedecls has redecls of wrong type");
     const SourceLocation defined_loc = GetLocation(redecl);
     if (cast<TagDecl>(redecl)->isCompleteDefinition() &&
@@ -1557,9 +1718,9 @@ void CalculateIwyuForForwardDeclareUse(
   const NamedDecl* dfn_from_desired_includes = nullptr;
   const NamedDecl* dfn_from_actual_includes = nullptr;
   for (const NamedDecl* dfn : dfns) {
-    vector<string> headers =
-        GlobalIncludePicker().GetCandidateHeadersForFilepathIncludedFrom(
-            GetFilePath(dfn), GetFilePath(use->use_loc()));
+    const vector<string>& headers =
+        GlobalIncludePicker().GetCandidateHeadersForFileIncludedFrom(
+            GetFileEntry(dfn), GetFileEntry(use->use_loc()));
     for (const string& header : headers) {
       if (ContainsKey(desired_includes, header))
         dfn_from_desired_includes = dfn;
@@ -1577,8 +1738,8 @@ void CalculateIwyuForForwardDeclareUse(
 
   // We also want to know if *any* redecl of this type is defined
   // in the same file as the use (and before it).
-  const set<const NamedDecl*>& redecls = GetTagRedecls(tag_decl);
-  for (const NamedDecl* redecl : redecls) {
+  for (const NamedDecl* redecl :
+       GetTagRedeclsInFile(tag_decl, GetFileEntry(use->use_loc()))) {
     if (DeclIsVisibleToUseInSameFile(redecl, *use)) {
       same_file_decl = redecl;
       break;
@@ -1588,7 +1749,7 @@ void CalculateIwyuForForwardDeclareUse(
   // an associated .h file.  Since associated .h files are always
   // desired includes, we don't need to check for that.
   if (!same_file_decl) {
-    for (const NamedDecl* redecl : redecls) {
+    for (const NamedDecl* redecl : GetTagRedecls(tag_decl)) {
       if (ContainsKey(associated_includes, GetFileEntry(redecl))) {
         same_file_decl = redecl;
         break;
@@ -1784,9 +1945,9 @@ void IwyuFileInfo::CalculateIwyuViolations(vector<OneUse>* uses) {
   }
 }
 
-static string GetWarningMsg(const OneUse& use) {
-  const SourceLocation spelling_loc = GetSpellingLoc(use.use_loc());
-  const SourceLocation instantiation_loc = GetInstantiationLoc(use.use_loc());
+static string GetWarningMsg(const OneUse& use, SourceLocation use_loc) {
+  const SourceLocation spelling_loc = GetSpellingLoc(use_loc);
+  const SourceLocation instantiation_loc = GetInstantiationLoc(use_loc);
   string warning = PrintableLoc(spelling_loc) + ": warning: ";
   if (use.is_full_use()) {
     warning += (use.symbol_name() + " is defined in " + use.suggested_header()
@@ -1809,8 +1970,14 @@ static string GetWarningMsg(const OneUse& use) {
 int IwyuFileInfo::EmitWarningMessages(const vector<OneUse>& uses) {
   set<pair<int, string>> iwyu_warnings;   // line-number, warning-msg.
   for (const OneUse& use : uses) {
-    if (use.is_iwyu_violation())
-      iwyu_warnings.insert(make_pair(use.UseLinenum(), GetWarningMsg(use)));
+    if (!use.is_iwyu_violation())
+      continue;
+    iwyu_warnings.insert(
+        make_pair(use.UseLinenum(), GetWarningMsg(use, use.use_loc())));
+    for (SourceLocation use_loc : use.repeated_use_locs()) {
+      iwyu_warnings.insert(
+          make_pair(GetLineNumber(use_loc), GetWarningMsg(use, use_loc)));
+    }
   }
   // Nice that set<> automatically sorts things for us!
   for (const pair<int, string>& warning : iwyu_warnings) {
@@ -1825,34 +1992,84 @@ int IwyuFileInfo::EmitWarningMessages(const vector<OneUse>& uses) {
 
 namespace internal {
 
-template <class IncludeOrFwdDecl>
-bool Contains(const vector<OneIncludeOrForwardDeclareLine>& lines,
-              const IncludeOrFwdDecl& item) {
-  return std::any_of(lines.begin(), lines.end(),
-                     [&](const OneIncludeOrForwardDeclareLine& line) {
-    return line.matches(item);
-  });
-}
-
-template <class ContainerType>
-void ClearDesiredForSurplusIncludesOrForwardDeclares(ContainerType& container) {
-  // Traverse multimap key by key.
-  for (typename ContainerType::iterator k = container.begin();
-       k != container.end(); k = container.upper_bound(k->first)) {
-    // For each key, mark all but the first value as undesirable.
-    typename ContainerType::iterator v = ++container.lower_bound(k->first);
-    typename ContainerType::iterator vend = container.upper_bound(k->first);
-    for (; v != vend; ++v) {
-      if (!v->second->is_elaborated_type())
-        v->second->clear_desired();
+// Maps each #include and forward-declare to the positions of the lines
+// for it, in line order.  Kept up to date as lines are added, so that
+// matching a use to its lines is a hash lookup rather than a scan of
+// every line.  Positions rather than pointers, since adding a line may
+// reallocate the vector.
+class LineIndex {
+ public:
+  explicit LineIndex(vector<OneIncludeOrForwardDeclareLine>* lines)
+      : lines_(lines) {
+    for (size_t i = 0; i < lines->size(); ++i)
+      Insert(i);
+  }
+
+  bool Contains(const string& quoted_include) const {
+    return include_lines_.count(quoted_include) > 0;
+  }
+  bool Contains(const NamedDecl* decl) const {
+    return fwd_decl_lines_.count(decl) > 0;
+  }
+
+  OneIncludeOrForwardDeclareLine& Add(OneIncludeOrForwardDeclareLine line) {
+    lines_->push_back(std::move(line));
+    Insert(lines_->size() - 1);
+    return lines_->back();
+  }
+
+  const vector<size_t>& LinesFor(const string& quoted_include) const {
+    auto it = include_lines_.find(quoted_include);
+    return it == include_lines_.end() ? kNoLines : it->second;
+  }
+  const vector<size_t>& LinesFor(const NamedDecl* decl) const {
+    auto it = fwd_decl_lines_.find(decl);
+    return it == fwd_decl_lines_.end() ? kNoLines : it->second;
+  }
+
+  // For each #include or forward-declare, marks all but the first of its
+  // lines as undesirable.
+  void ClearDesiredForSurplusLines() {
+    for (const auto& entry : include_lines_)
+      ClearDesiredForSurplus(entry.getValue());
+    for (const auto& entry : fwd_decl_lines_)
+      ClearDesiredForSurplus(entry.second);
+  }
+
+ private:
+  void Insert(size_t i) {
+    const OneIncludeOrForwardDeclareLine& line = (*lines_)[i];
+    if (line.IsIncludeLine())
+      include_lines_[line.quoted_include()].push_back(i);
+    else
+      fwd_decl_lines_[line.fwd_decl()].push_back(i);
+  }
+
+  void ClearDesiredForSurplus(const vector<size_t>& positions) {
+    for (size_t j = 1; j < positions.size(); ++j) {
+      OneIncludeOrForwardDeclareLine& line = (*lines_)[positions[j]];
+      if (!line.is_elaborated_type())
+        line.clear_desired();
     }
   }
-}
+
+  static const vector<size_t> kNoLines;
+
+  vector<OneIncludeOrForwardDeclareLine>* lines_;
+  llvm::StringMap<vector<size_t>> include_lines_;
+  llvm::DenseMap<const NamedDecl*, vector<size_t>> fwd_decl_lines_;
+};
+
+const vector<size_t> LineIndex::kNoLines;
 
 void CalculateDesiredIncludesAndForwardDeclares(
     const vector<OneUse>& uses, const set<string>& associated_desired_includes,
     const set<OptionalFileEntryRef>& kept_includes,
     vector<OneIncludeOrForwardDeclareLine>* lines) {
+  // There can be multiple includes or fwd-declares providing the same
+  // symbol, so the index maps each to all the lines where we found them.
+  LineIndex index(lines);
+
   // First make sure all uses' includes and fwd decls are reflected in lines.
   for (const OneUse& use : uses) {
     if (use.ignore_use())
@@ -1860,42 +2077,23 @@ void CalculateDesiredIncludesAndForwardDeclares(
 
     if (use.is_full_use()) {
       CHECK_(use.has_suggested_header() && "Full uses should have #includes");
-      if (!Contains(*lines, use.suggested_header())) { // must be added
-        lines->push_back(OneIncludeOrForwardDeclareLine(
+      if (!index.Contains(use.suggested_header())) { // must be added
+        index.Add(OneIncludeOrForwardDeclareLine(
             use.decl_file(), use.suggested_header(), -1));
       }
     } else if (!use.has_suggested_header()) {
       // Forward-declare uses that are already satisfied by an #include
       // have that as their suggested_header.  For the rest, we need to
       // make sure there's a forward-declare in the current file.
-      if (!Contains(*lines, use.decl())) { // must be added
+      if (!index.Contains(use.decl())) { // must be added
         // The OneIncludeOrForwardDeclareLine ctor sets up line
         // numbers, but they're for some other file!  Clear them.
-        lines->push_back(OneIncludeOrForwardDeclareLine(use.decl()));
-        lines->back().clear_line_numbers();
+        index.Add(OneIncludeOrForwardDeclareLine(use.decl()))
+            .clear_line_numbers();
       }
     }
   }
 
-  // From this point on, lines is stable and we can refer to its
-  // OneIncludeOrForwardDeclareLine objects by pointer.
-
-  // We'll want to be able to map from an include or fwd-declare to the
-  // lines where we found them.  There can be multiple includes or fwd-declares
-  // providing the same symbol, so use multimaps for these reverse lookups.
-  typedef multimap<string, OneIncludeOrForwardDeclareLine*> IncludeMap;
-  typedef multimap<const NamedDecl*, OneIncludeOrForwardDeclareLine*>
-      FwdDeclMap;
-
-  IncludeMap include_map;
-  FwdDeclMap fwd_decl_map;
-  for (OneIncludeOrForwardDeclareLine& line : *lines) {
-    if (line.IsIncludeLine())
-      include_map.insert(std::make_pair(line.quoted_include(), &line));
-    else
-      fwd_decl_map.insert(std::make_pair(line.fwd_decl(), &line));
-  }
-
   // Now run over all full uses and mark used includes as desired.
   for (const OneUse& use : uses) {
     if (use.ignore_use())
@@ -1904,20 +2102,20 @@ void CalculateDesiredIncludesAndForwardDeclares(
     if (use.is_full_use()) {
       // Full uses need a proper include, so mark all corresponding include
       // lines as desired.
-      auto range = include_map.equal_range(use.suggested_header());
-      for (auto it = range.first; it != range.second; ++it) {
-        it->second->set_desired();
+      for (size_t i : index.LinesFor(use.suggested_header())) {
+        OneIncludeOrForwardDeclareLine& line = (*lines)[i];
+        line.set_desired();
         if (GlobalFlags().comments_with_namespace) {
-          it->second->AddSymbolUse(use.symbol_name());
+          line.AddSymbolUse(use.symbol_name(), use.occurrences());
         } else {
-          it->second->AddSymbolUse(use.short_symbol_name());
+          line.AddSymbolUse(use.short_symbol_name(), use.occurrences());
         }
       }
     }
   }
 
   // Mark forward-decl uses. We need to do this in a separate pass because
-  // we need to be sure include_map is fully populated -- we don't want
+  // we need to be sure the include lines are fully marked -- we don't want
   // to bother with a "(ptr only)" use if there's already a full use.
   for (const OneUse& use : uses) {
     if (use.ignore_use() || use.is_full_use())
@@ -1926,19 +2124,17 @@ void CalculateDesiredIncludesAndForwardDeclares(
     if (!use.has_suggested_header()) {
       // A forward-declare for a use where there is no suggested header to
       // provide the symbol is very much desired.
-      auto range = fwd_decl_map.equal_range(use.decl());
-      for (auto it = range.first; it != range.second; ++it) {
-        it->second->set_desired();
-      }
-    } else if (ContainsKey(include_map, use.suggested_header())) {
+      for (size_t i : index.LinesFor(use.decl()))
+        (*lines)[i].set_desired();
+    } else if (index.Contains(use.suggested_header())) {
       // If we satisfy a forward-declare use from a file, let the file
       // know (this is just for logging).
       const string symbol_name = use.short_symbol_name();
 
-      auto range = include_map.equal_range(use.suggested_header());
-      for (auto it = range.first; it != range.second; ++it) {
-        if (!it->second->HasSymbolUse(symbol_name))
-          it->second->AddSymbolUse(symbol_name + " (ptr only)");
+      for (size_t i : index.LinesFor(use.suggested_header())) {
+        OneIncludeOrForwardDeclareLine& line = (*lines)[i];
+        if (!line.HasSymbolUse(symbol_name))
+          line.AddSymbolUse(symbol_name + " (ptr only)", use.occurrences());
       }
     }
   }
@@ -1956,8 +2152,7 @@ void CalculateDesiredIncludesAndForwardDeclares(
   }
 
   // Clear desired for all duplicates.
-  ClearDesiredForSurplusIncludesOrForwardDeclares(include_map);
-  ClearDesiredForSurplusIncludesOrForwardDeclares(fwd_decl_map);
+  index.ClearDesiredForSurplusLines();
 
   // Now reset all files included with "IWYU pragma: keep" as desired.
   for (OneIncludeOrForwardDeclareLine& line : *lines) {
@@ -2126,6 +2321,25 @@ LineSortKey GetSortKey(const OneIncludeOrForwardDeclareLine& line,
   return LineSortKey(GetLineSortOrdinal(line, associated_quoted_includes, file_info), line.line());
 }
 
+// Sorts lines the way the diffs list them: system headers before user
+// headers before forward-declares, etc.  This is a multimap because some
+// headers might be listed twice in the source file.
+multimap<LineSortKey, const OneIncludeOrForwardDeclareLine*> SortedLines(
+    const IwyuPreprocessorInfo* preprocessor_info,
+    const set<string>& associated_quoted_includes,
+    const vector<OneIncludeOrForwardDeclareLine>& lines) {
+  multimap<LineSortKey, const OneIncludeOrForwardDeclareLine*> sorted_lines;
+  for (const OneIncludeOrForwardDeclareLine& line : lines) {
+    const IwyuFileInfo* file_info = nullptr;
+    if (line.IsIncludeLine())
+      file_info = preprocessor_info->FileInfoFor(line.included_file());
+
+    sorted_lines.insert(make_pair(
+        GetSortKey(line, associated_quoted_includes, file_info), &line));
+  }
+  return sorted_lines;
+}
+
 // filename is "this" filename: the file being emitted.
 // associated_filepaths are the quoted-include form of associated_headers_.
 size_t PrintableDiffs(const string& filename,
@@ -2141,17 +2355,9 @@ size_t PrintableDiffs(const string& filename,
   const set<string>& aqi = associated_quoted_includes;  // short alias
 
   // Sort all the output-lines: system headers before user headers
-  // before forward-declares, etc.  The easiest way to do this is to
-  // just put them all in multimap whose key is a sort-order (multimap
-  // because some headers might be listed twice in the source file.)
-  multimap<LineSortKey, const OneIncludeOrForwardDeclareLine*> sorted_lines;
-  for (const OneIncludeOrForwardDeclareLine& line : lines) {
-    const IwyuFileInfo* file_info = nullptr;
-    if (line.IsIncludeLine())
-      file_info = preprocessor_info->FileInfoFor(line.included_file());
-
-    sorted_lines.insert(make_pair(GetSortKey(line, aqi, file_info), &line));
-  }
+  // before forward-declares, etc.
+  const multimap<LineSortKey, const OneIncludeOrForwardDeclareLine*>
+      sorted_lines = SortedLines(preprocessor_info, aqi, lines);
 
   // First, check if there are no adds or deletes.  If so, we print a
   // shorter summary line.
@@ -2238,6 +2444,72 @@ size_t PrintableDiffs(const string& filename,
   return num_edits;
 }
 
+// What fix_includes.py reads from the diffs PrintableDiffs reports for
+// filename.  Line numbers are printed for lines to remove, and in the full
+// include-list for present lines without symbols to explain.
+FixIncludesRecord GetFixIncludesRecord(
+    const string& filename, const IwyuPreprocessorInfo* preprocessor_info,
+    const set<string>& associated_quoted_includes,
+    const vector<OneIncludeOrForwardDeclareLine>& lines) {
+  FixIncludesRecord record;
+  record.filename = filename;
+  for (const auto& key_line :
+       SortedLines(preprocessor_info, associated_quoted_includes, lines)) {
+    const OneIncludeOrForwardDeclareLine& line = *key_line.second;
+    if (line.is_desired() && !line.is_present()) {
+      if (!ContainsValue(record.lines_to_add, line.line()))
+        record.lines_to_add.push_back(line.line());
+      continue;
+    }
+    if (!line.is_present())
+      continue;
+    if (!line.is_desired()) {
+      for (int i = line.start_linenum(); i <= line.end_linenum(); ++i)
+        record.lines_to_delete.insert(i);
+    } else if (line.is_elaborated_type() || !line.symbol_counts().empty()) {
+      continue;
+    }
+    if (line.IsIncludeLine()) {
+      for (int i = line.start_linenum(); i <= line.end_linenum(); ++i)
+        record.some_include_lines.insert(i);
+    } else {
+      const pair<int, int> span(line.start_linenum(), line.end_linenum() + 1);
+      record.seen_forward_declare_lines.insert(span);
+      if (line.line().find("::") != string::npos)
+        record.nested_forward_declare_lines.insert(span);
+    }
+  }
+  return record;
+}
+
+// Adds the edits to rewriter that fix_includes.py --nosafe_headers would
+// make to the file with file_id for the diffs PrintableDiffs reports.
+void RewriteIncludesAndForwardDeclares(
+    const string& filename, FileID file_id,
+    const IwyuPreprocessorInfo* preprocessor_info,
+    const set<string>& associated_quoted_includes,
+    const vector<OneIncludeOrForwardDeclareLine>& lines,
+    Rewriter* rewriter) {
+  const FixIncludesRecord record = GetFixIncludesRecord(
+      filename, preprocessor_info, associated_quoted_includes, lines);
+  if (record.lines_to_add.empty() && record.lines_to_delete.empty())
+    return;
+
+  const SourceManager& source_manager = rewriter->getSourceMgr();
+  const StringRef buffer = source_manager.getBufferData(file_id);
+  string fixed_buffer, error;
+  if (!FixIncludesInFile(record, GlobalFlags().quoted_includes_first, buffer,
+                         &fixed_buffer, &error)) {
+    errs() << "warning: not applying the changes to " << filename << ": "
+           << error << "\n";
+    return;
+  }
+  if (fixed_buffer != buffer) {
+    rewriter->ReplaceText(source_manager.getLocForStartOfFile(file_id),
+                          buffer.size(), fixed_buffer);
+  }
+}
+
 }  // namespace internal
 
 void IwyuFileInfo::HandlePreprocessingDone() {
@@ -2353,6 +2625,31 @@ size_t IwyuFileInfo::CalculateAndReportIwyuViolations() {
   return num_edits;
 }
 
+void IwyuFileInfo::AddIwyuEdits(Rewriter* rewriter) const {
+  if (IsSpecialFile(file_))
+    return;
+  const FileID file_id = rewriter->getSourceMgr().translateFile(*file_);
+  if (file_id.isInvalid())
+    return;
+  internal::RewriteIncludesAndForwardDeclares(
+      GetFilePath(file_), file_id, preprocessor_info_,
+      AssociatedQuotedIncludes(), lines_, rewriter);
+}
+
+string IwyuFileInfo::SerializeIwyuResult(size_t num_edits) const {
+  string serialized = std::to_string(num_edits);
+  for (const string& quoted_include : desired_includes())
+    serialized += "\n" + quoted_include;
+  return serialized;
+}
+
+size_t IwyuFileInfo::AdoptIwyuResult(const string& serialized) {
+  const vector<string> lines = Split(serialized, "\n", 0);
+  desired_includes_.insert(lines.begin() + 1, lines.end());
+  desired_includes_have_been_calculated_ = true;
+  return strtoul(lines[0].c_str(), nullptr, 10);
+}
+
 bool IsDirectlyIncluded(const NamedDecl* decl, const IwyuFileInfo& includer) {
   // If the decl or its header is private then a user should '#include' any of
   // the specified public headers for it, so check their presence.
@@ -20,11 +20,13 @@
 #include <map>                          // for map
 #include <set>                          // for set
 #include <string>                       // for string, operator<
+#include <tuple>                        // for tuple
 #include <vector>                       // for vector
 
 #include "clang/AST/Decl.h"
 #include "clang/Basic/FileEntry.h"
 #include "clang/Basic/SourceLocation.h"
+#include "iwyu_memory_report.h"
 #include "iwyu_port.h"  // for CHECK_
 #include "iwyu_stl_util.h"
 #include "iwyu_use_flags.h"
@@ -33,6 +35,7 @@
 // IWYU pragma: no_include "clang/Basic/CustomizableOptional.h"
 
 namespace clang {
+class Rewriter;
 class TagTypeLoc;
 class UsingDecl;
 }  // namespace clang
@@ -71,10 +74,13 @@ class OneUse {
          const string& quoted_include,
          clang::SourceLocation include_loc);
 
+  // For decl uses, these are only printed when first asked for.
   const string& symbol_name() const {
+    MaterializeSymbolNames();
     return symbol_name_;
   }
   const string& short_symbol_name() const {
+    MaterializeSymbolNames();
     return short_symbol_name_;
   }
   const clang::NamedDecl* decl() const {
@@ -110,6 +116,14 @@ class OneUse {
   bool has_suggested_header() const {
     return !suggested_header_.empty();
   }
+  // Later locations of the same use, coalesced into this one as they
+  // were reported.  See IwyuFileInfo::CoalesceUse.
+  const vector<clang::SourceLocation>& repeated_use_locs() const {
+    return repeated_use_locs_;
+  }
+  int occurrences() const {
+    return 1 + repeated_use_locs_.size();
+  }
 
   const string& suggested_header() const {
     CHECK_(has_suggested_header() && "Must assign suggested_header first");
@@ -123,23 +137,32 @@ class OneUse {
   void set_ignore_use() { ignore_use_ = true; }
   void set_is_iwyu_violation() { is_iwyu_violation_ = true; }
   void set_suggested_header(const string& fh) { suggested_header_ = fh; }
+  void add_repeated_use_loc(clang::SourceLocation use_loc) {
+    repeated_use_locs_.push_back(use_loc);
+  }
 
   string PrintableUseLoc() const;
   const vector<string>& public_headers();  // not const because we fill lazily
   bool PublicHeadersContain(const string& elt);
   bool NeedsSuggestedHeader() const;    // not true for fwd-declare uses, e.g.
   int UseLinenum() const;
+  // Bytes this use holds on the heap, for --memory_report.
+  int64_t HeapBytes() const;
 
  private:
   void SetPublicHeaders();         // sets based on decl_filepath_
+  void MaterializeSymbolNames() const;
 
-  string symbol_name_;             // the symbol being used
-  string short_symbol_name_;       // 'short' form of the symbol being used
+  const clang::NamedDecl* name_decl_;  // the decl symbol_name_ names, if any
+  mutable bool has_symbol_names_;  // false until the names are printed
+  mutable string symbol_name_;     // the symbol being used
+  mutable string short_symbol_name_;  // 'short' form of the symbol being used
   const clang::NamedDecl* decl_;   // decl of the symbol, if we know it
   clang::SourceLocation decl_loc_;     // where the decl is attributed to live
   clang::OptionalFileEntryRef decl_file_;  // file entry where the symbol lives
   string decl_filepath_;           // filepath where the symbol lives
   clang::SourceLocation use_loc_;  // where the symbol is used from
+  vector<clang::SourceLocation> repeated_use_locs_;  // ...and again from
   UseKind use_kind_;               // kFullUse or kForwardDeclareUse
   UseFlags use_flags_;             // flags describing features of the use
   string comment_;                 // If not empty, append to clang warning msg
@@ -161,6 +184,12 @@ class OneIncludeOrForwardDeclareLine {
   }
   bool IsIncludeLine() const;           // vs forward-declare line
   string LineNumberString() const;      // <startline>-<endline>
+  int start_linenum() const {
+    return start_linenum_;
+  }
+  int end_linenum() const {
+    return end_linenum_;
+  }
   bool is_desired() const {
     return is_desired_;
   }
@@ -206,7 +235,7 @@ class OneIncludeOrForwardDeclareLine {
   void clear_desired() { is_desired_ = false; }
   void clear_line_numbers() { start_linenum_ = end_linenum_ = -1; }
   // Another symbol we're using that's defined in this file.
-  void AddSymbolUse(const string& symbol_name);
+  void AddSymbolUse(const string& symbol_name, int count = 1);
   bool HasSymbolUse(const string& symbol_name) const;
 
   bool LineNumbersMatch(const OneIncludeOrForwardDeclareLine& that) const {
@@ -353,6 +382,29 @@ class IwyuFileInfo {
   // Reports violations on errs(), and returns the number of violations.
   size_t CalculateAndReportIwyuViolations();
 
+  // For --apply, after CalculateAndReportIwyuViolations: adds the edits
+  // that turn this file's #includes and forward-declares into the ones
+  // reported to rewriter.
+  void AddIwyuEdits(clang::Rewriter* rewriter) const;
+
+  // Whether this file's desired includes depend on those of other files,
+  // which must then be calculated first.
+  bool HasAssociatedHeaders() const {
+    return !associated_headers_.empty();
+  }
+
+  // These let CalculateAndReportIwyuViolations() run in a child process:
+  // the child returns SerializeIwyuResult() and the parent feeds it to
+  // AdoptIwyuResult(), which returns the number of violations again and
+  // makes the desired includes available to files associated with this one.
+  // Nothing else is adopted: lines_ stays empty in the parent, so neither
+  // AddIwyuEdits() nor the memory estimates may be used on such a file.
+  string SerializeIwyuResult(size_t num_edits) const;
+  size_t AdoptIwyuResult(const string& serialized);
+
+  // For --memory_report: the reported uses and their coalescing tables.
+  MemoryUsage EstimateSymbolUseMemoryUsage() const;
+
  private:
   const set<string>& desired_includes() const {
     CHECK_(desired_includes_have_been_calculated_ &&
@@ -382,6 +434,17 @@ class IwyuFileInfo {
     return associated_desired_includes;
   }
 
+  // Returns true if a use of decl from use_loc is the same as one already
+  // in symbol_uses_, in everything but its location, and counts it as
+  // another occurrence of that one.  Otherwise the caller must append
+  // the new use to symbol_uses_.
+  bool CoalesceUse(const clang::NamedDecl* decl, clang::SourceLocation use_loc,
+                   OneUse::UseKind use_kind, UseFlags flags,
+                   const char* comment);
+  // Whether the analysis of a use of decl from this file can't depend on
+  // where in the file the use is, so that its uses may be coalesced.
+  bool UsesAreCoalescable(const clang::NamedDecl* decl);
+
   // Populates uses with full data, including is_iwyu_violation_.
   void CalculateIwyuViolations(vector<OneUse>* uses);
   // Uses uses to emit warning messages (at high enough verbosity).
@@ -411,6 +474,14 @@ class IwyuFileInfo {
   // Holds all the uses that are reported.
   vector<OneUse> symbol_uses_;
 
+  // Maps the uses in symbol_uses_ that later uses may be coalesced into,
+  // by everything but their location, to their index.
+  map<std::tuple<const clang::NamedDecl*, OneUse::UseKind, UseFlags, string>,
+      size_t>
+      coalesced_uses_;
+  // Memoizes UsesAreCoalescable.
+  map<const clang::NamedDecl*, bool> coalescable_decls_;
+
   // Holds all the lines (#include and fwd-declare) that are reported.
   vector<OneIncludeOrForwardDeclareLine> lines_;
 
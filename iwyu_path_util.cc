@@ -16,8 +16,10 @@
 #include "iwyu_string_util.h"
 #include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Path.h"
+#include "llvm/Support/Regex.h"
 
 namespace include_what_you_use {
 
@@ -247,4 +249,47 @@ string PathJoin(StringRef dirpath, StringRef relative_path) {
   return string(res);
 }
 
+GlobSet::GlobSet() = default;
+
+GlobSet::~GlobSet() = default;
+
+void GlobSet::Add(const string& glob) {
+  string regex;
+  string error;
+  if (!GlobToRegex(glob, &regex)) {
+    other_globs_.push_back(glob);
+  } else if (glob.find_first_of("*?[\\") == string::npos) {
+    literals_.insert(glob);
+  } else if (!llvm::Regex(regex).isValid(error)) {
+    // E.g. a bracket expression with a reversed range, like [z-a], which
+    // fnmatch() accepts and an ERE doesn't.  One bad pattern must not
+    // spoil the combined regex.
+    other_globs_.push_back(glob);
+  } else {
+    patterns_.push_back(regex);
+    regex_.reset();
+  }
+}
+
+bool GlobSet::Matches(StringRef path) const {
+  if (literals_.contains(path))
+    return true;
+  if (!patterns_.empty()) {
+    if (!regex_) {
+      regex_ = std::make_unique<llvm::Regex>(
+          "^(" + llvm::join(patterns_, "|") + ")$");
+      string error;
+      CHECK_(regex_->isValid(error)) << "Bad glob regex: " << error;
+    }
+    if (regex_->match(path))
+      return true;
+  }
+  const string path_str = path.str();
+  for (const string& glob : other_globs_) {
+    if (GlobMatchesPath(glob.c_str(), path_str.c_str()))
+      return true;
+  }
+  return false;
+}
+
 }  // namespace include_what_you_use
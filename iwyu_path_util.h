@@ -12,15 +12,22 @@
 #ifndef INCLUDE_WHAT_YOU_USE_IWYU_PATH_UTIL_H_
 #define INCLUDE_WHAT_YOU_USE_IWYU_PATH_UTIL_H_
 
+#include <memory>                       // for unique_ptr
 #include <string>                       // for string, allocator, etc
 #include <vector>
 
 #include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
+
+namespace llvm {
+class Regex;
+}  // namespace llvm
 
 namespace include_what_you_use {
 
 using llvm::StringRef;
 using std::string;
+using std::unique_ptr;
 using std::vector;
 
 
@@ -103,6 +110,28 @@ bool IsSpecialFilenameOrStdin(StringRef name);
 // Append path to dirpath.
 string PathJoin(StringRef dirpath, StringRef relative_path);
 
+// A set of glob patterns, as matched by GlobMatchesPath, that matches a
+// path against all of them in one pass.  Globs without wildcards are
+// looked up in a hash set, and the others are compiled into a single
+// regular expression the first time they are needed.
+class GlobSet {
+ public:
+  GlobSet();
+  ~GlobSet();
+
+  void Add(const string& glob);
+  bool Matches(StringRef path) const;
+  bool empty() const {
+    return literals_.empty() && patterns_.empty() && other_globs_.empty();
+  }
+
+ private:
+  llvm::StringSet<> literals_;
+  vector<string> patterns_;         // the regex for each wildcard glob
+  vector<string> other_globs_;      // globs without a valid regex
+  mutable unique_ptr<llvm::Regex> regex_;  // null until compiled
+};
+
 }  // namespace include_what_you_use
 
 #endif  // INCLUDE_WHAT_YOU_USE_IWYU_PATH_UTIL_H_
@@ -7,6 +7,8 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "iwyu_port.h"
+
 #if defined(_WIN32)
 
 #include "Shlwapi.h"  // for PathMatchSpecA
@@ -15,12 +17,151 @@ bool GlobMatchesPath(const char *glob, const char *path) {
   return PathMatchSpecA(path, glob);
 }
 
+bool GlobToRegex(const std::string& glob, std::string* regex) {
+  return false;  // PathMatchSpecA is case-insensitive and takes lists
+}
+
+bool RunForkedTasks(const std::vector<std::function<std::string()>>& tasks,
+                    int jobs, std::vector<ForkedTaskResult>* results) {
+  return false;
+}
+
 #else  // #if defined(_WIN32)
 
 #include <fnmatch.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>                      // for strchr
+#include <map>
 
 bool GlobMatchesPath(const char *glob, const char *path) {
   return fnmatch(glob, path, 0) == 0;
 }
 
+static void AppendRegexLiteral(char c, std::string* regex) {
+  if (strchr(".^$|()+{}*?[]\\", c))
+    *regex += '\\';
+  *regex += c;
+}
+
+// Follows fnmatch() without flags: '*' and '?' match '/' too.
+bool GlobToRegex(const std::string& glob, std::string* regex) {
+  regex->clear();
+  for (size_t i = 0; i < glob.size(); ++i) {
+    switch (glob[i]) {
+      case '*':
+        *regex += ".*";
+        break;
+      case '?':
+        *regex += '.';
+        break;
+      case '\\':
+        if (++i == glob.size())
+          return false;
+        AppendRegexLiteral(glob[i], regex);
+        break;
+      case '[': {
+        size_t end = i + 1;
+        if (end < glob.size() && (glob[end] == '!' || glob[end] == '^'))
+          ++end;
+        if (end < glob.size() && glob[end] == ']')  // a literal ']'
+          ++end;
+        end = glob.find(']', end);
+        if (end == std::string::npos) {  // not a bracket expression
+          AppendRegexLiteral('[', regex);
+          break;
+        }
+        std::string chars = glob.substr(i + 1, end - i - 1);
+        // Escapes and character classes differ; leave them to fnmatch.
+        if (chars.find_first_of("\\[") != std::string::npos)
+          return false;
+        if (chars[0] == '!')
+          chars[0] = '^';
+        *regex += '[' + chars + ']';
+        i = end;
+        break;
+      }
+      default:
+        AppendRegexLiteral(glob[i], regex);
+        break;
+    }
+  }
+  return true;
+}
+
+static std::string ReadAndClose(FILE* file) {
+  std::string contents;
+  rewind(file);
+  char buffer[4096];
+  size_t size;
+  while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    contents.append(buffer, size);
+  fclose(file);
+  return contents;
+}
+
+bool RunForkedTasks(const std::vector<std::function<std::string()>>& tasks,
+                    int jobs, std::vector<ForkedTaskResult>* results) {
+  struct Child {
+    size_t task;
+    FILE* output;
+    FILE* payload;
+  };
+
+  results->assign(tasks.size(), ForkedTaskResult());
+  // Don't let children inherit (and print again) buffered output.
+  llvm::outs().flush();
+  llvm::errs().flush();
+  fflush(nullptr);
+
+  std::map<pid_t, Child> running;
+  size_t next_task = 0;
+  while (next_task < tasks.size() || !running.empty()) {
+    if (next_task < tasks.size() && running.size() < size_t(jobs)) {
+      const size_t task = next_task++;
+      FILE* output = tmpfile();
+      FILE* payload = tmpfile();
+      const pid_t pid = (output && payload) ? fork() : -1;
+      if (pid == 0) {
+        dup2(fileno(output), STDERR_FILENO);
+        const std::string result = tasks[task]();
+        fwrite(result.data(), 1, result.size(), payload);
+        fflush(nullptr);
+        _exit(EXIT_SUCCESS);
+      }
+      if (pid < 0) {
+        // Leave results[task].ok false; the caller can run it itself.
+        if (output)
+          fclose(output);
+        if (payload)
+          fclose(payload);
+        continue;
+      }
+      running[pid] = Child{task, output, payload};
+      continue;
+    }
+
+    int status = 0;
+    const pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    auto it = running.find(pid);
+    if (it == running.end())
+      continue;
+    ForkedTaskResult& result = (*results)[it->second.task];
+    result.ok = WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+    result.output = ReadAndClose(it->second.output);
+    result.payload = ReadAndClose(it->second.payload);
+    running.erase(it);
+  }
+  return true;
+}
+
 #endif  // #if defined(_WIN32)
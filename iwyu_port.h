@@ -12,6 +12,9 @@
 #define INCLUDE_WHAT_YOU_USE_PORT_H_
 
 #include <cstdlib>   // for abort
+#include <functional>
+#include <string>
+#include <vector>
 
 #include "llvm/Support/Compiler.h"
 #include "llvm/Support/raw_ostream.h"
@@ -66,4 +69,24 @@ class OstreamVoidifier {
 
 bool GlobMatchesPath(const char *glob, const char *path);
 
+// Translates a glob, in the syntax GlobMatchesPath accepts, to a POSIX
+// extended regular expression matching the same paths.  Returns false
+// if the glob can't be translated on this platform; match it with
+// GlobMatchesPath instead.
+bool GlobToRegex(const std::string& glob, std::string* regex);
+
+struct ForkedTaskResult {
+  bool ok = false;      // The child ran the task and exited normally.
+  std::string output;   // What the child wrote to stderr.
+  std::string payload;  // What the task returned.
+};
+
+// Runs every task in its own forked child process, at most 'jobs' at a time,
+// and fills in results in task order.  Children see a copy of the parent's
+// memory, so tasks may read (and scribble on) any state, but only their
+// output and payload come back.  Returns false without running anything on
+// platforms that can't fork.
+bool RunForkedTasks(const std::vector<std::function<std::string()>>& tasks,
+                    int jobs, std::vector<ForkedTaskResult>* results);
+
 #endif  // INCLUDE_WHAT_YOU_USE_PORT_H_
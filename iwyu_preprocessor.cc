@@ -9,16 +9,20 @@
 
 #include "iwyu_preprocessor.h"
 
+#include <cstdlib>                      // for atoi
 #include <cstring>
+#include <memory>                       // for unique_ptr
 #include <optional>
 #include <string>                       // for string, basic_string, etc
-#include <utility>                      // for pair, make_pair
+#include <system_error>                 // for error_code
 
 #include "clang/AST/Decl.h"
+#include "clang/Basic/FileManager.h"
 #include "clang/Basic/IdentifierTable.h"
 #include "clang/Basic/TokenKinds.h"
 #include "clang/Lex/HeaderSearch.h"
 #include "clang/Lex/MacroInfo.h"
+#include "clang/Lex/PreprocessorOptions.h"
 #include "clang/Lex/Token.h"
 #include "iwyu_ast_util.h"
 #include "iwyu_globals.h"
@@ -32,6 +36,9 @@
 #include "iwyu_string_util.h"
 #include "iwyu_verrs.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/Support/ErrorOr.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
 
 // TODO: Clean out pragmas as IWYU improves.
 // IWYU pragma: no_include "clang/Basic/CustomizableOptional.h"
@@ -52,10 +59,14 @@ using clang::SourceLocation;
 using clang::SourceRange;
 using clang::SrcMgr::CharacteristicKind;
 using clang::Token;
+using llvm::BitVector;
+using llvm::MemoryBuffer;
 using llvm::StringRef;
 using llvm::errs;
-using std::make_pair;
 using std::string;
+using std::pair;
+using std::to_string;
+using std::unique_ptr;
 
 namespace include_what_you_use {
 
@@ -222,6 +233,8 @@ void IwyuPreprocessorInfo::HandlePragmaComment(SourceRange comment_range) {
       !StripLeft(&pragma_text, "/* IWYU pragma: ")) {
     return;
   }
+  if (WritesPchSidecar())
+    RecordPchSidecarPragma(comment_range);
   const vector<string> tokens =
       SplitOnWhiteSpacePreservingQuotes(pragma_text, 0);
   if (HasOpenBeginExports(this_file_entry)) {
@@ -230,8 +243,8 @@ void IwyuPreprocessorInfo::HandlePragmaComment(SourceRange comment_range) {
       SourceLocation export_loc_begin = begin_exports_location_stack_.top();
       begin_exports_location_stack_.pop();
       SourceRange export_range(export_loc_begin, begin_loc);
-      export_location_ranges_.insert(
-          std::make_pair(this_file_entry, export_range));
+      export_location_ranges_[GetOrAssignFileIndex(this_file_entry)]
+          .push_back(export_range);
     } else {
       // No pragma allowed within "begin_exports" - "end_exports"
       Warn(begin_loc, "Expected end_exports pragma");
@@ -245,7 +258,8 @@ void IwyuPreprocessorInfo::HandlePragmaComment(SourceRange comment_range) {
       SourceLocation keep_loc_begin = begin_keep_location_stack_.top();
       begin_keep_location_stack_.pop();
       SourceRange keep_range(keep_loc_begin, begin_loc);
-      keep_location_ranges_.insert(std::make_pair(this_file_entry, keep_range));
+      keep_location_ranges_[GetOrAssignFileIndex(this_file_entry)].push_back(
+          keep_range);
     } else {
       // No pragmas allowed within "begin_keep" - "end_keep"
       Warn(begin_loc, "Expected end_keep pragma");
@@ -290,6 +304,8 @@ void IwyuPreprocessorInfo::HandlePragmaComment(SourceRange comment_range) {
     MutableGlobalIncludePicker()->AddMapping(quoted_this_file,
                                              MappedInclude(suggested));
     MutableGlobalIncludePicker()->MarkIncludeAsPrivate(quoted_this_file);
+    if (GeneratesMappings())
+      pragma_mappings_.emplace(quoted_this_file, suggested);
     return;
   }
 
@@ -309,7 +325,7 @@ void IwyuPreprocessorInfo::HandlePragmaComment(SourceRange comment_range) {
       return;
     }
 
-    no_include_map_[this_file_entry].insert(inhibited);
+    no_includes_[GetOrAssignFileIndex(this_file_entry)].insert(inhibited);
     ERRSYM(this_file_entry) << "Inhibiting include of "
                             << inhibited << "\n";
     return;
@@ -318,7 +334,8 @@ void IwyuPreprocessorInfo::HandlePragmaComment(SourceRange comment_range) {
   if (MatchOneToken(tokens, "no_forward_declare", 2, begin_loc)) {
     // 2nd token should be the qualified name of a symbol.
     const string normalized_symbol = NormalizeNamespaces(tokens[1]);
-    no_forward_declare_map_[this_file_entry].insert(normalized_symbol);
+    no_forward_declares_[GetOrAssignFileIndex(this_file_entry)].insert(
+        normalized_symbol);
     ERRSYM(this_file_entry) << "Inhibiting forward-declare of "
                             << normalized_symbol << "\n";
     return;
@@ -346,7 +363,7 @@ void IwyuPreprocessorInfo::HandlePragmaComment(SourceRange comment_range) {
   }
 
   if (MatchOneToken(tokens, "always_keep", 1, begin_loc)) {
-    always_keep_files_.insert(this_file_entry);
+    always_keep_files_.set(GetOrAssignFileIndex(this_file_entry));
     ERRSYM(this_file_entry)
         << "Marking include " << GetFilePath(this_file_entry)
         << " as always-keep\n";
@@ -427,6 +444,8 @@ void IwyuPreprocessorInfo::ProcessHeadernameDirectivesInFile(
           quoted_private_include, MappedInclude(quoted_header_name));
       MutableGlobalIncludePicker()->MarkIncludeAsPrivate(
           quoted_private_include);
+      if (GeneratesMappings())
+        pragma_mappings_.emplace(quoted_private_include, quoted_header_name);
     }
     break;  // No more than one @headername directive allowed.
   }
@@ -435,26 +454,48 @@ void IwyuPreprocessorInfo::ProcessHeadernameDirectivesInFile(
 //------------------------------------------------------------
 // Utilities for adding #includes.
 
-// Helper function that returns iwyu_file_info_map_[file_entry] if
+int IwyuPreprocessorInfo::FileIndex(OptionalFileEntryRef file) const {
+  const auto it = file_indices_.find(file ? &file->getFileEntry() : nullptr);
+  return it == file_indices_.end() ? -1 : it->second;
+}
+
+int IwyuPreprocessorInfo::GetOrAssignFileIndex(OptionalFileEntryRef file) {
+  const auto [it, inserted] = file_indices_.try_emplace(
+      file ? &file->getFileEntry() : nullptr, indexed_files_.size());
+  if (inserted) {
+    indexed_files_.push_back(file);
+    file_infos_.emplace_back();
+    num_includes_seen_.push_back(0);
+    no_includes_.emplace_back();
+    no_forward_declares_.emplace_back();
+    keep_location_ranges_.emplace_back();
+    export_location_ranges_.emplace_back();
+    always_keep_files_.push_back(false);
+  }
+  return it->second;
+}
+
+// Helper function that returns file_infos_[file_entry] if
 // it already exists, or creates a new one and returns it otherwise.
 IwyuFileInfo* IwyuPreprocessorInfo::GetFromFileInfoMap(
     OptionalFileEntryRef file) {
-  IwyuFileInfo* iwyu_file_info = FindInMap(&iwyu_file_info_map_, file);
+  unique_ptr<IwyuFileInfo>& iwyu_file_info =
+      file_infos_[GetOrAssignFileIndex(file)];
   if (!iwyu_file_info) {
     const string quoted_include = ConvertToQuotedInclude(GetFilePath(file));
-    iwyu_file_info_map_.insert(
-        make_pair(file, IwyuFileInfo(file, this, quoted_include)));
-    iwyu_file_info = FindInMap(&iwyu_file_info_map_, file);
-    CHECK_(iwyu_file_info);   // should succeed this time!
+    iwyu_file_info =
+        std::make_unique<IwyuFileInfo>(file, this, quoted_include);
   }
-  return iwyu_file_info;
+  return iwyu_file_info.get();
 }
 
 void IwyuPreprocessorInfo::InsertIntoFileInfoMap(
     OptionalFileEntryRef file, const string& quoted_include_name) {
-  if (!FindInMap(&iwyu_file_info_map_, file)) {
-    iwyu_file_info_map_.insert(
-        make_pair(file, IwyuFileInfo(file, this, quoted_include_name)));
+  unique_ptr<IwyuFileInfo>& iwyu_file_info =
+      file_infos_[GetOrAssignFileIndex(file)];
+  if (!iwyu_file_info) {
+    iwyu_file_info =
+        std::make_unique<IwyuFileInfo>(file, this, quoted_include_name);
   }
 }
 
@@ -522,7 +563,7 @@ void IwyuPreprocessorInfo::MaybeProtectInclude(
   }
 
   if (!protect_reason.empty()) {
-    CHECK_(ContainsKey(iwyu_file_info_map_, includer));
+    CHECK_(FileInfoFor(includer));
     GetFromFileInfoMap(includer)->ReportIncludeFileUse(
         includee, include_name_as_written, includer_loc);
     ERRSYM(includer) << "Marked dep: " << GetFilePath(includer)
@@ -532,9 +573,11 @@ void IwyuPreprocessorInfo::MaybeProtectInclude(
 }
 
 void IwyuPreprocessorInfo::FinalizeProtectedIncludes() {
-  for (auto& entry : iwyu_file_info_map_) {
-    OptionalFileEntryRef includer_file = entry.first;
-    IwyuFileInfo& includer = entry.second;
+  for (size_t i = 0; i < file_infos_.size(); ++i) {
+    if (!file_infos_[i])
+      continue;
+    OptionalFileEntryRef includer_file = indexed_files_[i];
+    IwyuFileInfo& includer = *file_infos_[i];
     const string includer_path = GetFilePath(includer_file);
 
     for (OptionalFileEntryRef include :
@@ -548,7 +591,8 @@ void IwyuPreprocessorInfo::FinalizeProtectedIncludes() {
         ERRSYM(includer_file)
             << "Marked dep: " << includer_path << " needs to keep "
             << includee_path << " (reason: re-exports)\n";
-      } else if (always_keep_files_.count(include) > 0) {
+      } else if (const int index = FileIndex(include);
+                 index >= 0 && always_keep_files_.test(index)) {
         // Includee itself contains an "always_keep" pragma that protects it
         // from removal in all includers.
         includer.ReportIncludeFileUse(include,
@@ -564,7 +608,7 @@ void IwyuPreprocessorInfo::FinalizeProtectedIncludes() {
 
 // Called when a #include is encountered.  i_n_a_t includes <> or "".
 // We keep track of this information in two places:
-// 1) iwyu_file_info_map_ maps the includer as a FileEntry to the
+// 1) file_infos_ maps the includer as a FileEntry to the
 //    includee both as the literal name used and as a FileEntry.
 // 2) include_to_fileentry_map_ maps the includee's literal name
 //    as written to the FileEntry used.  This can be used (in a
@@ -586,7 +630,8 @@ void IwyuPreprocessorInfo::AddDirectInclude(
     CHECK_(includee != nullptr);
     CHECK_(!include_name_as_written.empty());
   }
-  ++num_includes_seen_[includer];
+  const int includer_index = GetOrAssignFileIndex(includer);
+  ++num_includes_seen_[includer_index];
 
   GetFromFileInfoMap(includer)->AddInclude(
       includee, include_name_as_written, GetLineNumber(includer_loc));
@@ -596,7 +641,8 @@ void IwyuPreprocessorInfo::AddDirectInclude(
   // The first #include in every translation unit might be a precompiled header
   // and we need to mark it as such for later analysis.
   bool is_includer_main_compilation_unit = main_file_ && includer == main_file_;
-  if (is_includer_main_compilation_unit && num_includes_seen_[includer] == 1) {
+  if (is_includer_main_compilation_unit &&
+      num_includes_seen_[includer_index] == 1) {
     CHECK_(includee && "The first #include must be an actual file.");
 
     // Now we know includee is the first included header file. Mark it as
@@ -825,6 +871,8 @@ void IwyuPreprocessorInfo::FileSkipped(const FileEntryRef& file,
   if (ShouldReportIWYUViolationsFor(file)) {
     files_to_report_iwyu_violations_for_.insert(file);
   }
+  if (WritesPchSidecar())
+    RecordPchSidecarInclude("skip", include_loc, file, include_name_as_written);
 }
 
 // Called when a file is #included.
@@ -851,11 +899,20 @@ void IwyuPreprocessorInfo::FileChanged_EnterFile(
   if (IsSpecialFile(new_file))
     return;
 
+  if (WritesPchSidecar()) {
+    RecordPchSidecarInclude("enter", include_loc, new_file,
+                            include_name_as_written);
+  }
+
   ProcessHeadernameDirectivesInFile(file_beginning);
 
-  // The first non-special file entered is the main file.
-  if (main_file_ == nullptr)
+  // The first non-special file entered is the main file.  Everything in a
+  // precompiled header comes before it, so that's when we replay the PCH.
+  if (main_file_ == nullptr) {
     main_file_ = new_file;
+    if (ReadsPchSidecar())
+      ReplayPchSidecar();
+  }
 
   if (main_file_ != nullptr &&
       BelongsToMainCompilationUnit(GetFileEntry(include_loc), new_file)) {
@@ -890,6 +947,8 @@ void IwyuPreprocessorInfo::FileChanged_ExitToFile(
     SourceLocation include_loc, OptionalFileEntryRef exiting_from) {
   ERRSYM(GetFileEntry(include_loc))
       << "[ Exiting to  ] " << PrintableLoc(include_loc) << "\n";
+  if (WritesPchSidecar() && !IsSpecialFile(exiting_from))
+    RecordPchSidecarExit(exiting_from);
   if (HasOpenBeginExports(exiting_from)) {
     Warn(begin_exports_location_stack_.top(),
          "begin_exports without an end_exports");
@@ -948,37 +1007,42 @@ void IwyuPreprocessorInfo::ReportMacroUse(const string& name,
 // Post-processing functions (done after all source is read).
 
 // Adds of includer's includes, direct or indirect, into retval.
-void IwyuPreprocessorInfo::AddAllIncludesAsFileEntries(
-    OptionalFileEntryRef includer, set<OptionalFileEntryRef>* retval) const {
-  const IwyuFileInfo* file_info = FileInfoFor(includer);
+void IwyuPreprocessorInfo::AddAllIncludes(int includer,
+                                          BitVector* retval) const {
+  const IwyuFileInfo* file_info = file_infos_[includer].get();
   if (!file_info)
     return;
 
   for (OptionalFileEntryRef include :
        file_info->direct_includes_as_fileentries()) {
-    if (ContainsKey(*retval, include))  // avoid infinite recursion
+    const int index = FileIndex(include);
+    if (index < 0 || retval->test(index))  // avoid infinite recursion
       continue;
-    retval->insert(include);
-    AddAllIncludesAsFileEntries(include, retval);
+    retval->set(index);
+    AddAllIncludes(index, retval);
   }
 }
 
 void IwyuPreprocessorInfo::PopulateIntendsToProvideMap() {
-  CHECK_(intends_to_provide_map_.empty() && "Should only call this fn once");
+  CHECK_(intends_to_provide_.empty() && "Should only call this fn once");
+  const size_t num_files = indexed_files_.size();
   // Figure out which of the header files we have are public.  We'll
   // map each one to a set of all private header files that map to it.
-  map<OptionalFileEntryRef, set<OptionalFileEntryRef>> private_headers_behind;
-  for (const auto& fileinfo : iwyu_file_info_map_) {
-    OptionalFileEntryRef header = fileinfo.first;
+  vector<vector<int>> private_headers_behind(num_files);
+  for (size_t header = 0; header < num_files; ++header) {
+    if (!file_infos_[header])
+      continue;
     const vector<MappedInclude> public_headers_for_header =
         GlobalIncludePicker().GetCandidateHeadersForFilepath(
-            GetFilePath(header));
+            GetFilePath(indexed_files_[header]));
     for (const MappedInclude& pub : public_headers_for_header) {
       if (OptionalFileEntryRef public_file = GetOrDefault(
               include_to_fileentry_map_, pub.quoted_include, std::nullopt)) {
-        CHECK_(ContainsKey(iwyu_file_info_map_, public_file));
-        if (public_file != header)  // no credit for mapping to yourself :-)
-          private_headers_behind[public_file].insert(header);
+        CHECK_(FileInfoFor(public_file));
+        const int public_index = FileIndex(public_file);
+        // No credit for mapping to yourself :-)
+        if (public_index != static_cast<int>(header))
+          private_headers_behind[public_index].push_back(header);
       }
     }
   }
@@ -990,37 +1054,46 @@ void IwyuPreprocessorInfo::PopulateIntendsToProvideMap() {
   // itself and all its direct includes.
   // TODO(csilvers): use AddAssociatedHeaders() to get includes here.
   const IncludePicker& picker = GlobalIncludePicker();
-  for (const auto& fileinfo : iwyu_file_info_map_) {
-    OptionalFileEntryRef file = fileinfo.first;
-    if (file == nullptr)
+  intends_to_provide_.resize(num_files);
+  for (size_t i = 0; i < num_files; ++i) {
+    OptionalFileEntryRef file = indexed_files_[i];
+    if (!file_infos_[i] || file == nullptr)
       continue;
-    intends_to_provide_map_[file].insert(file);  // Everyone provides itself!
+    BitVector& provides = intends_to_provide_[i];
+    provides.resize(num_files);
+    provides.set(i);  // Everyone provides itself!
     if (picker.IsPublic(file)) {
-      AddAllIncludesAsFileEntries(file, &intends_to_provide_map_[file]);
+      AddAllIncludes(i, &provides);
     } else {
       const set<OptionalFileEntryRef>& direct_includes =
-          fileinfo.second.direct_includes_as_fileentries();
+          file_infos_[i]->direct_includes_as_fileentries();
       for (OptionalFileEntryRef inc : direct_includes) {
-        intends_to_provide_map_[file].insert(inc);
+        const int inc_index = FileIndex(inc);
+        if (inc_index < 0)
+          continue;
+        provides.set(inc_index);
         if (picker.IsPublic(inc))
-          AddAllIncludesAsFileEntries(inc, &intends_to_provide_map_[file]);
+          AddAllIncludes(inc_index, &provides);
       }
     }
   }
   // Ugh, we can have two files with the same name, using
   // #include-next.  Merge them.
-  for (const auto& fileinfo : iwyu_file_info_map_) {
-    OptionalFileEntryRef file = fileinfo.first;
+  for (size_t i = 0; i < num_files; ++i) {
+    OptionalFileEntryRef file = indexed_files_[i];
+    if (!file_infos_[i] || file == nullptr)
+      continue;
     // See if a round-trip to string and back ends up at a different file.
     const string quoted_include = ConvertToQuotedInclude(GetFilePath(file));
     OptionalFileEntryRef other_file =
         GetOrDefault(include_to_fileentry_map_, quoted_include, file);
-    if (other_file != file) {
-      InsertAllInto(intends_to_provide_map_[file],
-                    &intends_to_provide_map_[other_file]);
+    const int other = FileIndex(other_file);
+    if (other >= 0 && other != static_cast<int>(i)) {
+      intends_to_provide_[other].resize(num_files);
+      intends_to_provide_[other] |= intends_to_provide_[i];
       // TODO(csilvers): this isn't enough if there are *more* than 2
       // files with the same name.
-      intends_to_provide_map_[file] = intends_to_provide_map_[other_file];
+      intends_to_provide_[i] = intends_to_provide_[other];
     }
   }
   // Finally, for convenience, we'll say every private header file
@@ -1036,43 +1109,220 @@ void IwyuPreprocessorInfo::PopulateIntendsToProvideMap() {
   //   a templated function or class in i1.h, you see the need for
   //   symbol Foo which isn't a template argument, don't worry about
   //   it.'  Double check whether that's true.
-  for (const auto& header_map : private_headers_behind) {
-    OptionalFileEntryRef public_header = header_map.first;
-    for (OptionalFileEntryRef private_header : header_map.second) {
-      CHECK_(ContainsKey(intends_to_provide_map_, private_header));
-      InsertAllInto(intends_to_provide_map_[public_header],
-                    &intends_to_provide_map_[private_header]);
+  for (size_t public_header = 0; public_header < num_files; ++public_header) {
+    for (int private_header : private_headers_behind[public_header]) {
+      CHECK_(!intends_to_provide_[private_header].empty());
+      intends_to_provide_[private_header] |=
+          intends_to_provide_[public_header];
     }
   }
   // Show our work, at a high enough verbosity level.
-  for (const auto& header_map : intends_to_provide_map_) {
-    VERRS(4) << "Intends-to-provide for " << GetFilePath(header_map.first)
-             << ":\n";
-    for (OptionalFileEntryRef private_header : header_map.second) {
-      VERRS(4) << "   " << GetFilePath(private_header) << "\n";
+  if (ShouldPrint(4)) {
+    for (size_t i = 0; i < num_files; ++i) {
+      if (intends_to_provide_[i].empty())
+        continue;
+      VERRS(4) << "Intends-to-provide for " << GetFilePath(indexed_files_[i])
+               << ":\n";
+      for (int private_header : intends_to_provide_[i].set_bits()) {
+        VERRS(4) << "   " << GetFilePath(indexed_files_[private_header])
+                 << "\n";
+      }
     }
   }
 }
 
 void IwyuPreprocessorInfo::PopulateTransitiveIncludeMap() {
-  CHECK_(transitive_include_map_.empty() && "Should only call this fn once");
-  for (const auto& fileinfo : iwyu_file_info_map_) {
-    OptionalFileEntryRef file = fileinfo.first;
-    transitive_include_map_[file].insert(file);   // everyone includes itself!
-    AddAllIncludesAsFileEntries(file, &transitive_include_map_[file]);
+  CHECK_(transitive_includes_.empty() && "Should only call this fn once");
+  const size_t num_files = indexed_files_.size();
+  transitive_includes_.resize(num_files);
+  for (size_t i = 0; i < num_files; ++i) {
+    if (!file_infos_[i])
+      continue;
+    transitive_includes_[i].resize(num_files);
+    transitive_includes_[i].set(i);   // everyone includes itself!
+    AddAllIncludes(i, &transitive_includes_[i]);
   }
 }
 
+//------------------------------------------------------------
+// Support for --pch_sidecar and --write_pch_sidecar.
+//
+// The sidecar is a text file starting with kPchSidecarHeader, followed by
+// one tab-separated event per line, in preprocessing order:
+//   enter  <includer> <line> <column> <name-as-written> <includee>
+//   skip   <includer> <line> <column> <name-as-written> <includee>
+//   exit   <file>
+//   pragma <file> <begin-line> <begin-column> <end-line> <end-column>
+// The includer fields are empty for files included from the command line.
+
+static const char kPchSidecarHeader[] = "iwyu-pch-sidecar 1";
+
+static string PchSidecarLocation(SourceLocation loc) {
+  OptionalFileEntryRef file = GetFileEntry(loc);
+  if (IsSpecialFile(file))
+    return "\t0\t0";
+  const clang::SourceManager& sm = *GlobalSourceManager();
+  const SourceLocation spelling_loc = sm.getSpellingLoc(loc);
+  return GetFilePath(file) + "\t" +
+         to_string(sm.getSpellingLineNumber(spelling_loc)) + "\t" +
+         to_string(sm.getSpellingColumnNumber(spelling_loc));
+}
+
+static OptionalFileEntryRef LookupPchSidecarFile(const string& path) {
+  if (path.empty())
+    return std::nullopt;
+  return GlobalSourceManager()->getFileManager().getOptionalFileRef(path);
+}
+
+static SourceLocation LookupPchSidecarLocation(OptionalFileEntryRef file,
+                                               const string& line,
+                                               const string& column) {
+  if (!file || atoi(line.c_str()) <= 0 || atoi(column.c_str()) <= 0)
+    return SourceLocation();
+  // The headers inside the PCH are only known to the source manager through
+  // the source location entries loaded from it.  Check that this one is
+  // there before asking for a position in it.
+  const clang::SourceManager& sm = *GlobalSourceManager();
+  const FileID file_id = sm.translateFile(*file);
+  if (file_id.isInvalid())
+    return SourceLocation();
+  return sm.translateLineCol(file_id, atoi(line.c_str()), atoi(column.c_str()));
+}
+
+bool IwyuPreprocessorInfo::ReadsPchSidecar() const {
+  return !GlobalFlags().pch_sidecar.empty() &&
+         !preprocessor_.getPreprocessorOpts().ImplicitPCHInclude.empty();
+}
+
+bool IwyuPreprocessorInfo::WritesPchSidecar() const {
+  return !GlobalFlags().write_pch_sidecar.empty();
+}
+
+void IwyuPreprocessorInfo::RecordPchSidecarInclude(
+    const char* kind, SourceLocation include_loc, OptionalFileEntryRef includee,
+    const string& include_name_as_written) {
+  pch_sidecar_events_.push_back(string(kind) + "\t" +
+                                PchSidecarLocation(include_loc) + "\t" +
+                                include_name_as_written + "\t" +
+                                GetFilePath(includee));
+}
+
+void IwyuPreprocessorInfo::RecordPchSidecarExit(
+    OptionalFileEntryRef exiting_from) {
+  pch_sidecar_events_.push_back("exit\t" + GetFilePath(exiting_from));
+}
+
+void IwyuPreprocessorInfo::RecordPchSidecarPragma(SourceRange comment_range) {
+  const SourceLocation begin_loc = comment_range.getBegin();
+  const SourceLocation end_loc = comment_range.getEnd();
+  if (IsInSpecialFile(begin_loc))
+    return;
+  // Both ends of a comment are in the same file, so drop the second path.
+  const string end = PchSidecarLocation(end_loc);
+  pch_sidecar_events_.push_back("pragma\t" + PchSidecarLocation(begin_loc) +
+                                end.substr(end.find('\t', 1)));
+}
+
+// Feeds the events recorded for the headers in a precompiled header through
+// the same handlers the preprocessor would have called had it seen them.
+// Macro uses inside the PCH are not recorded, so they are not replayed.
+void IwyuPreprocessorInfo::ReplayPchSidecar() {
+  const string& filename = GlobalFlags().pch_sidecar;
+  llvm::ErrorOr<unique_ptr<MemoryBuffer>> buffer =
+      MemoryBuffer::getFile(filename);
+  if (std::error_code error = buffer.getError()) {
+    errs() << filename << ": error: cannot read PCH sidecar: "
+           << error.message() << "\n";
+    return;
+  }
+  const vector<string> lines = Split(buffer.get()->getBuffer().str(), "\n", 0);
+  if (lines.empty() || lines[0] != kPchSidecarHeader) {
+    errs() << filename << ": error: not an include-what-you-use PCH sidecar\n";
+    return;
+  }
+
+  VERRS(5) << "Replaying PCH sidecar '" << filename << "'.\n";
+  for (size_t i = 1; i < lines.size(); ++i) {
+    if (lines[i].empty())
+      continue;
+    const vector<string> fields = Split(lines[i], "\t", 0);
+    const string& kind = fields[0];
+    if ((kind == "enter" || kind == "skip") && fields.size() == 6) {
+      OptionalFileEntryRef includer = LookupPchSidecarFile(fields[1]);
+      const SourceLocation include_loc =
+          LookupPchSidecarLocation(includer, fields[2], fields[3]);
+      if (!fields[1].empty() && include_loc.isInvalid()) {
+        errs() << filename << ":" << i + 1 << ": warning: cannot locate "
+               << fields[1] << ":" << fields[2] << " in the PCH\n";
+        continue;
+      }
+      const string& include_name_as_written = fields[4];
+      OptionalFileEntryRef includee = LookupPchSidecarFile(fields[5]);
+      if (!includee) {
+        errs() << filename << ":" << i + 1 << ": warning: cannot find "
+               << fields[5] << "\n";
+        continue;
+      }
+      ERRSYM(includer) << "[ #include pch] " << include_name_as_written
+                       << " (" << GetFilePath(includee) << ")\n";
+
+      AddDirectInclude(include_loc, includee, include_name_as_written);
+      if (ShouldReportIWYUViolationsFor(includee)) {
+        files_to_report_iwyu_violations_for_.insert(includee);
+      }
+      if (kind == "enter") {
+        ProcessHeadernameDirectivesInFile(GetFileStartLoc(includee));
+        // Everything inside a precompiled header is a prefix header.
+        GetFromFileInfoMap(includee)->set_prefix_header();
+      }
+    } else if (kind == "exit" && fields.size() == 2) {
+      FileChanged_ExitToFile(SourceLocation(), LookupPchSidecarFile(fields[1]));
+    } else if (kind == "pragma" && fields.size() == 6) {
+      OptionalFileEntryRef file = LookupPchSidecarFile(fields[1]);
+      const SourceLocation begin_loc =
+          LookupPchSidecarLocation(file, fields[2], fields[3]);
+      const SourceLocation end_loc =
+          LookupPchSidecarLocation(file, fields[4], fields[5]);
+      if (begin_loc.isValid() && end_loc.isValid())
+        HandlePragmaComment(SourceRange(begin_loc, end_loc));
+    } else {
+      errs() << filename << ":" << i + 1
+             << ": warning: malformed PCH sidecar entry\n";
+    }
+  }
+}
+
+void IwyuPreprocessorInfo::WritePchSidecar() const {
+  const string& filename = GlobalFlags().write_pch_sidecar;
+  std::error_code error;
+  llvm::raw_fd_ostream out(filename, error);
+  if (error) {
+    errs() << filename << ": " << error.message() << "\n";
+    return;
+  }
+  out << kPchSidecarHeader << "\n";
+  for (const string& event : pch_sidecar_events_) {
+    out << event << "\n";
+  }
+}
+
+bool IwyuPreprocessorInfo::GeneratesMappings() const {
+  return !GlobalFlags().generate_mappings.empty();
+}
+
 //------------------------------------------------------------
 // The public API.
 
 void IwyuPreprocessorInfo::HandlePreprocessingDone() {
   CHECK_(main_file_ && "Main file should be present");
   FileChanged_ExitToFile(SourceLocation(), main_file_);
+  if (WritesPchSidecar())
+    WritePchSidecar();
 
   // Other post-processing steps.
-  for (auto& file_info_map_entry : iwyu_file_info_map_) {
-    file_info_map_entry.second.HandlePreprocessingDone();
+  for (const unique_ptr<IwyuFileInfo>& file_info : file_infos_) {
+    if (file_info)
+      file_info->HandlePreprocessingDone();
   }
   MutableGlobalIncludePicker()->FinalizeAddedIncludes();
   FinalizeProtectedIncludes();
@@ -1080,6 +1330,56 @@ void IwyuPreprocessorInfo::HandlePreprocessingDone() {
   PopulateTransitiveIncludeMap();
 }
 
+set<pair<string, string>> IwyuPreprocessorInfo::GenerateMappings() const {
+  set<pair<string, string>> mappings = pragma_mappings_;
+  set<string> mapped_by_pragma;
+  for (const auto& [map_from, map_to] : pragma_mappings_)
+    mapped_by_pragma.insert(map_from);
+
+  const IwyuFileInfo* main_file_info = FileInfoFor(main_file_);
+  if (!main_file_info)
+    return mappings;
+  const set<OptionalFileEntryRef>& entry_headers =
+      main_file_info->direct_includes_as_fileentries();
+  for (OptionalFileEntryRef entry_header : entry_headers) {
+    if (!entry_header)
+      continue;
+    const string entry_path = GetFilePath(entry_header);
+    const string quoted_entry_header = ConvertToQuotedInclude(entry_path);
+    const string library_dir =
+        NormalizeDirPath(MakeAbsolutePath(GetParentPath(entry_path)));
+
+    // Walk the headers behind the entry header, without leaving its
+    // directory tree or passing through other entry headers, which get
+    // their own walk.
+    set<OptionalFileEntryRef> seen = {entry_header};
+    vector<OptionalFileEntryRef> worklist = {entry_header};
+    while (!worklist.empty()) {
+      const IwyuFileInfo* file_info = FileInfoFor(worklist.back());
+      worklist.pop_back();
+      if (!file_info)
+        continue;
+      for (OptionalFileEntryRef includee :
+           file_info->direct_includes_as_fileentries()) {
+        if (!includee || ContainsKey(entry_headers, includee) ||
+            !seen.insert(includee).second) {
+          continue;
+        }
+        const string includee_path = GetFilePath(includee);
+        if (!StartsWith(NormalizeFilePath(MakeAbsolutePath(includee_path)),
+                        library_dir)) {
+          continue;
+        }
+        const string quoted_includee = ConvertToQuotedInclude(includee_path);
+        if (!ContainsKey(mapped_by_pragma, quoted_includee))
+          mappings.emplace(quoted_includee, quoted_entry_header);
+        worklist.push_back(includee);
+      }
+    }
+  }
+  return mappings;
+}
+
 bool IwyuPreprocessorInfo::BelongsToMainCompilationUnit(
     OptionalFileEntryRef includer, OptionalFileEntryRef includee) const {
   // TODO: Should probably have a CHECK_(main_file_), but this method is
@@ -1099,8 +1399,9 @@ bool IwyuPreprocessorInfo::BelongsToMainCompilationUnit(
   // In the case of pch-in-code make this the *second* include,
   // as the PCH must always be first.
   int first_include_index = GlobalFlags().pch_in_code ? 2 : 1;
-  if (includer == main_file_ &&
-      ContainsKeyValue(num_includes_seen_, includer, first_include_index)) {
+  const int includer_index = FileIndex(includer);
+  if (includer == main_file_ && includer_index >= 0 &&
+      num_includes_seen_[includer_index] == first_include_index) {
     if (GetCanonicalName(Basename(GetFilePath(includee))) ==
         GetCanonicalName(Basename(GetFilePath(main_file_))))
       return true;
@@ -1115,63 +1416,70 @@ OptionalFileEntryRef IwyuPreprocessorInfo::IncludeToFileEntry(
 
 IwyuFileInfo* IwyuPreprocessorInfo::FileInfoFor(
     OptionalFileEntryRef file) const {
-  return const_cast<IwyuFileInfo*>(FindInMap(&iwyu_file_info_map_, file));
+  const int index = FileIndex(file);
+  return index < 0 ? nullptr : file_infos_[index].get();
+}
+
+// Returns whether bit other is set in the table row of file, for the
+// tables filled in once preprocessing is done.
+static bool RowContains(const vector<BitVector>& table, int file, int other) {
+  if (file < 0 || other < 0 || static_cast<size_t>(file) >= table.size())
+    return false;
+  const BitVector& row = table[file];
+  return static_cast<size_t>(other) < row.size() && row.test(other);
 }
 
 bool IwyuPreprocessorInfo::PublicHeaderIntendsToProvide(
     OptionalFileEntryRef public_header, OptionalFileEntryRef other_file) const {
-  if (const set<OptionalFileEntryRef>* provides =
-          FindInMap(&intends_to_provide_map_, public_header)) {
-    return ContainsKey(*provides, other_file);
-  }
-  return false;
+  return RowContains(intends_to_provide_, FileIndex(public_header),
+                     FileIndex(other_file));
 }
 
 bool IwyuPreprocessorInfo::FileTransitivelyIncludes(
     OptionalFileEntryRef includer, OptionalFileEntryRef includee) const {
-  if (const set<OptionalFileEntryRef>* all_includes =
-          FindInMap(&transitive_include_map_, includer)) {
-    return ContainsKey(*all_includes, includee);
-  }
-  return false;
+  return RowContains(transitive_includes_, FileIndex(includer),
+                     FileIndex(includee));
 }
 
 bool IwyuPreprocessorInfo::FileTransitivelyIncludes(
     OptionalFileEntryRef includer, const string& quoted_includee) const {
-  if (const set<OptionalFileEntryRef>* all_includes =
-          FindInMap(&transitive_include_map_, includer)) {
-    for (OptionalFileEntryRef include : *all_includes) {
-      if (ConvertToQuotedInclude(GetFilePath(include)) == quoted_includee)
-        return true;
-    }
+  const int index = FileIndex(includer);
+  if (index < 0 || static_cast<size_t>(index) >= transitive_includes_.size())
+    return false;
+  for (int include : transitive_includes_[index].set_bits()) {
+    if (ConvertToQuotedInclude(GetFilePath(indexed_files_[include])) ==
+        quoted_includee)
+      return true;
   }
   return false;
 }
 
 bool IwyuPreprocessorInfo::FileTransitivelyIncludes(
     const string& quoted_includer, OptionalFileEntryRef includee) const {
-  for (const auto& entry : transitive_include_map_) {
-    if (ConvertToQuotedInclude(GetFilePath(entry.first)) == quoted_includer)
-      return ContainsKey(entry.second, includee);
+  for (size_t i = 0; i < transitive_includes_.size(); ++i) {
+    if (transitive_includes_[i].empty())
+      continue;
+    if (ConvertToQuotedInclude(GetFilePath(indexed_files_[i])) ==
+        quoted_includer)
+      return RowContains(transitive_includes_, i, FileIndex(includee));
   }
   return false;
 }
 
 bool IwyuPreprocessorInfo::IncludeIsInhibited(
     OptionalFileEntryRef file, const string& other_filename) const {
-  const set<string>* inhibited_includes = FindInMap(&no_include_map_, file);
-  return (inhibited_includes != nullptr) &&
-      ContainsKey(*inhibited_includes, other_filename);
+  const int index = FileIndex(file);
+  return index >= 0 && ContainsKey(no_includes_[index], other_filename);
 }
 
 bool IwyuPreprocessorInfo::ForwardDeclareIsInhibited(
     OptionalFileEntryRef file, const string& qualified_symbol_name) const {
+  const int index = FileIndex(file);
+  if (index < 0 || no_forward_declares_[index].empty())
+    return false;
   const string normalized_symbol_name =
       NormalizeNamespaces(qualified_symbol_name);
-  const set<string>* inhibited_forward_declares =
-      FindInMap(&no_forward_declare_map_, file);
-  return (inhibited_forward_declares != nullptr) &&
-      ContainsKey(*inhibited_forward_declares, normalized_symbol_name);
+  return ContainsKey(no_forward_declares_[index], normalized_symbol_name);
 }
 
 bool IwyuPreprocessorInfo::ForwardDeclareIsMarkedKeep(
@@ -1180,11 +1488,11 @@ bool IwyuPreprocessorInfo::ForwardDeclareIsMarkedKeep(
   SourceLocation loc = decl->getEndLoc();
 
   // Is the decl part of a begin_keep/end_keep block?
-  OptionalFileEntryRef file = GetFileEntry(loc);
-  auto keep_ranges = keep_location_ranges_.equal_range(file);
-  for (auto it = keep_ranges.first; it != keep_ranges.second; ++it) {
-    if (it->second.fullyContains(loc)) {
-      return true;
+  const int index = FileIndex(GetFileEntry(loc));
+  if (index >= 0) {
+    for (const SourceRange& keep_range : keep_location_ranges_[index]) {
+      if (keep_range.fullyContains(loc))
+        return true;
     }
   }
   // Is the declaration itself marked with trailing comment?
@@ -1200,15 +1508,45 @@ bool IwyuPreprocessorInfo::ForwardDeclareIsExported(
     return false;
 
   // Is the decl part of a begin_exports/end_exports block?
-  OptionalFileEntryRef file = GetFileEntry(loc);
-  auto export_ranges = export_location_ranges_.equal_range(file);
-  for (auto it = export_ranges.first; it != export_ranges.second; ++it) {
-    if (it->second.fullyContains(loc)) {
-      return true;
+  const int index = FileIndex(GetFileEntry(loc));
+  if (index >= 0) {
+    for (const SourceRange& export_range : export_location_ranges_[index]) {
+      if (export_range.fullyContains(loc))
+        return true;
     }
   }
   // Is the declaration itself marked with trailing comment?
   return (LineHasText(loc, "// IWYU pragma: export") ||
           LineHasText(loc, "/* IWYU pragma: export"));
 }
+
+MemoryUsage IwyuPreprocessorInfo::EstimateSymbolUseMemoryUsage() const {
+  MemoryUsage usage;
+  for (const unique_ptr<IwyuFileInfo>& file_info : file_infos_) {
+    if (file_info)
+      usage += file_info->EstimateSymbolUseMemoryUsage();
+  }
+  return usage;
+}
+
+MemoryUsage IwyuPreprocessorInfo::EstimateIncludeGraphMemoryUsage() const {
+  MemoryUsage usage;
+  usage.bytes = file_indices_.getMemorySize() + VectorHeapBytes(indexed_files_);
+  for (const vector<llvm::BitVector>* table :
+       {&transitive_includes_, &intends_to_provide_}) {
+    usage.bytes += VectorHeapBytes(*table);
+    for (const llvm::BitVector& row : *table) {
+      usage.entries += row.count();
+      usage.bytes += row.getMemorySize();
+    }
+  }
+  for (const auto& entry : include_to_fileentry_map_) {
+    ++usage.entries;
+    usage.bytes +=
+        TreeNodeBytes<decltype(include_to_fileentry_map_)::value_type>() +
+        StringHeapBytes(entry.first);
+  }
+  return usage;
+}
+
 }  // namespace include_what_you_use
@@ -61,9 +61,11 @@
 #define INCLUDE_WHAT_YOU_USE_IWYU_PREPROCESSOR_H_
 
 #include <map>                          // for map
+#include <memory>                       // for unique_ptr
 #include <set>                          // for set
 #include <stack>                        // for stack
 #include <string>                       // for string
+#include <utility>                      // for pair
 #include <vector>                       // for vector
 
 #include "clang/Basic/FileEntry.h"
@@ -71,7 +73,10 @@
 #include "clang/Basic/SourceManager.h"
 #include "clang/Lex/PPCallbacks.h"
 #include "clang/Lex/Preprocessor.h"
+#include "iwyu_memory_report.h"
 #include "iwyu_output.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
 
 namespace clang {
 class NamedDecl;
@@ -80,11 +85,12 @@ class NamedDecl;
 namespace include_what_you_use {
 
 using std::map;
+using std::pair;
 using std::set;
 using std::stack;
 using std::string;
+using std::unique_ptr;
 using std::vector;
-using std::multimap;
 
 class IwyuPreprocessorInfo : public clang::PPCallbacks,
                              public clang::CommentHandler {
@@ -169,6 +175,22 @@ class IwyuPreprocessorInfo : public clang::PPCallbacks,
   // Return true if the fwd decl is marked with "IWYU pragma: export".
   bool ForwardDeclareIsExported(const clang::NamedDecl* decl) const;
 
+  // For --generate_mappings, once preprocessing is done.  Takes the
+  // files the main file #includes as the public entry headers of a
+  // library, and maps every header an entry header reaches from its own
+  // directory tree -- directly or through other such headers, but not
+  // through another entry header -- to that entry header.  Headers with
+  // an IWYU pragma or @headername mapping keep just that mapping, which
+  // is returned as well.  Each pair is a private and a public quoted
+  // include.
+  set<pair<string, string>> GenerateMappings() const;
+
+  // For --memory_report.  The symbol uses recorded in all file infos,
+  // and the include graph: the file index, the transitive-include and
+  // intends-to-provide tables, with an entry per edge.
+  MemoryUsage EstimateSymbolUseMemoryUsage() const;
+  MemoryUsage EstimateIncludeGraphMemoryUsage() const;
+
  protected:
   // Preprocessor event handlers called by Clang.
   void MacroExpands(const clang::Token& macro_use_token,
@@ -231,13 +253,21 @@ class IwyuPreprocessorInfo : public clang::PPCallbacks,
   bool BelongsToMainCompilationUnit(clang::OptionalFileEntryRef includer,
                                     clang::OptionalFileEntryRef includee) const;
 
-  // Creates a new iwyu_file_info_map_[file_entry] if it doesn't exist,
+  // Returns the dense index of file in the per-file tables below, or -1
+  // if nothing has been recorded for it yet.
+  int FileIndex(clang::OptionalFileEntryRef file) const;
+
+  // As above, but assigns the next free index (growing the tables) the
+  // first time a file is seen.
+  int GetOrAssignFileIndex(clang::OptionalFileEntryRef file);
+
+  // Creates a new file_infos_[file_entry] if it doesn't exist,
   // or a noop otherwise.  quoted_include_name is used to create the
   // new entry if necessary.
   void InsertIntoFileInfoMap(clang::OptionalFileEntryRef file,
                              const string& quoted_include_name);
 
-  // Helper function that returns iwyu_file_info_map_[file_entry] if
+  // Helper function that returns file_infos_[file_entry] if
   // it already exists, or creates a new one and returns it otherwise.
   // If it creates a new one, it generates the quoted_include_name
   // from the file-path for 'file'.
@@ -266,14 +296,32 @@ class IwyuPreprocessorInfo : public clang::PPCallbacks,
                       clang::SourceLocation usage_location,
                       clang::SourceLocation dfn_location);
 
-  // Helper for PopulateIntendsToProvideMap().
-  void AddAllIncludesAsFileEntries(
-      clang::OptionalFileEntryRef includer,
-      set<clang::OptionalFileEntryRef>* retval) const;
+  // Helper for PopulateIntendsToProvideMap().  Sets the bits of all
+  // the includes, direct or indirect, of the file at index includer.
+  void AddAllIncludes(int includer, llvm::BitVector* retval) const;
   void PopulateIntendsToProvideMap();
   void PopulateTransitiveIncludeMap();
   void FinalizeProtectedIncludes();
 
+  // Support for --pch_sidecar.  A precompiled header hides the #includes
+  // and comments of the headers inside it from the preprocessor, so we
+  // record the events we need from them when iwyu runs on the prefix
+  // header with --write_pch_sidecar, and replay them through the handlers
+  // above when a translation unit is compiled with -include-pch.
+  bool ReadsPchSidecar() const;
+  bool WritesPchSidecar() const;
+  void RecordPchSidecarInclude(const char* kind,
+                               clang::SourceLocation include_loc,
+                               clang::OptionalFileEntryRef includee,
+                               const string& include_name_as_written);
+  void RecordPchSidecarExit(clang::OptionalFileEntryRef exiting_from);
+  void RecordPchSidecarPragma(clang::SourceRange comment_range);
+  void ReplayPchSidecar();
+  void WritePchSidecar() const;
+
+  // True when running for --generate_mappings.
+  bool GeneratesMappings() const;
+
   // Return true if at the current point in the parse of the given file,
   // there is a pending "begin_exports" pragma.
   bool HasOpenBeginExports(clang::OptionalFileEntryRef file) const;
@@ -300,36 +348,42 @@ class IwyuPreprocessorInfo : public clang::PPCallbacks,
   // #include.
   map<string, clang::OptionalFileEntryRef> include_to_fileentry_map_;
 
-  map<clang::OptionalFileEntryRef, IwyuFileInfo> iwyu_file_info_map_;
+  // Per-file state lives in tables indexed by a dense file index,
+  // assigned the first time anything is recorded for a file.  They are
+  // consulted from every preprocessor callback and every use check, so
+  // lookups must be cheap.  A file without a FileEntry (e.g. <built-in>)
+  // gets an index too, under the null key.
+  llvm::DenseMap<const clang::FileEntry*, int> file_indices_;
+  vector<clang::OptionalFileEntryRef> indexed_files_;
+
+  vector<unique_ptr<IwyuFileInfo>> file_infos_;
 
   // How many #include lines we've encountered from the given file.
-  map<clang::OptionalFileEntryRef, int> num_includes_seen_;
-
-  // Maps from a FileEntry to all files that this file "intends" to
-  // provide the symbols from.  For now, we say a file intentionally
-  // provides a symbol if it defines it, or if any file it directly
-  // #includes defines it.  However, if the header is a private header
-  // -- as determined by the fact it's in the private->public header
-  // map -- we relax the second requirement to allow any file directly
-  // or indirectly included by the public file.  This isn't perfect,
-  // but is as close as we can be to matching the intent of the author
-  // of the public/private system.
-  map<clang::OptionalFileEntryRef, set<clang::OptionalFileEntryRef>>
-      intends_to_provide_map_;
-
-  // Maps from a FileEntry to all the files that this file includes,
-  // either directly or indirectly.
-  map<clang::OptionalFileEntryRef, set<clang::OptionalFileEntryRef>>
-      transitive_include_map_;
-
-  // Maps from a FileEntry to the quoted names of files that its file
-  // is directed *not* to include via the "no_include" pragma.
-  map<clang::OptionalFileEntryRef, set<string>> no_include_map_;
-
-  // Maps from a FileEntry to the qualified names of symbols that its
-  // file is directed *not* to forward-declare via the
-  // "no_forward_declare" pragma.
-  map<clang::OptionalFileEntryRef, set<string>> no_forward_declare_map_;
+  vector<int> num_includes_seen_;
+
+  // For each file, the files that it "intends" to provide the symbols
+  // from, as a bit per file index.  For now, we say a file
+  // intentionally provides a symbol if it defines it, or if any file it
+  // directly #includes defines it.  However, if the header is a private
+  // header -- as determined by the fact it's in the private->public
+  // header map -- we relax the second requirement to allow any file
+  // directly or indirectly included by the public file.  This isn't
+  // perfect, but is as close as we can be to matching the intent of the
+  // author of the public/private system.  Empty until preprocessing is
+  // done.
+  vector<llvm::BitVector> intends_to_provide_;
+
+  // For each file, all the files that it includes, either directly or
+  // indirectly, as a bit per file index.
+  vector<llvm::BitVector> transitive_includes_;
+
+  // For each file, the quoted names of files that it is directed *not*
+  // to include via the "no_include" pragma.
+  vector<set<string>> no_includes_;
+
+  // For each file, the qualified names of symbols that it is directed
+  // *not* to forward-declare via the "no_forward_declare" pragma.
+  vector<set<string>> no_forward_declares_;
 
   // For processing pragmas. It is the current stack of open
   // "begin_exports".  There should be at most one item in this stack
@@ -341,15 +395,13 @@ class IwyuPreprocessorInfo : public clang::PPCallbacks,
   // inclusion chain.
   stack<clang::SourceLocation> begin_keep_location_stack_;
 
-  // For processing forward decls. It is a multimap containing the bounds of
-  // every keep range.
-  multimap<clang::OptionalFileEntryRef, clang::SourceRange>
-      keep_location_ranges_;
+  // For processing forward decls. The bounds of every keep range, per
+  // file.
+  vector<vector<clang::SourceRange>> keep_location_ranges_;
 
-  // For processing forward decls. It is a multimap containing the bounds of
-  // every export range.
-  multimap<clang::OptionalFileEntryRef, clang::SourceRange>
-      export_location_ranges_;
+  // For processing forward decls. The bounds of every export range, per
+  // file.
+  vector<vector<clang::SourceRange>> export_location_ranges_;
 
   // For processing associated pragma. It is the current open
   // "associated" pragma.
@@ -363,8 +415,16 @@ class IwyuPreprocessorInfo : public clang::PPCallbacks,
   clang::SourceLocation include_filename_loc_;
 
   // Keeps track of which files have the "always_keep" pragma, so they can be
-  // marked as such for all includers.
-  std::set<clang::OptionalFileEntryRef> always_keep_files_;
+  // marked as such for all includers.  A bit per file index.
+  llvm::BitVector always_keep_files_;
+
+  // Serialized preprocessor events to write to the --write_pch_sidecar
+  // file, in the order they were seen.
+  vector<string> pch_sidecar_events_;
+
+  // Private-to-public mappings from IWYU pragmas and @headername, as
+  // quoted includes.  Only recorded for --generate_mappings.
+  set<pair<string, string>> pragma_mappings_;
 };
 
 }  // namespace include_what_you_use
@@ -0,0 +1,117 @@
+//===--- iwyu_template_profile.cc - cost of template scans, for iwyu ------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "iwyu_template_profile.h"
+
+#include <algorithm>                    // for min, sort
+#include <system_error>                 // for error_code
+#include <vector>                       // for vector
+
+#include "clang/AST/Decl.h"
+#include "iwyu_ast_util.h"
+#include "iwyu_globals.h"
+#include "iwyu_location_util.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+using clang::NamedDecl;
+using llvm::errs;
+using llvm::raw_fd_ostream;
+using llvm::raw_ostream;
+using llvm::raw_string_ostream;
+using std::vector;
+
+namespace include_what_you_use {
+
+namespace {
+
+template <typename Cost>
+vector<const Cost*> SortedByTime(const map<const clang::Decl*, Cost>& costs) {
+  vector<const Cost*> sorted;
+  for (const auto& entry : costs)
+    sorted.push_back(&entry.second);
+  std::sort(sorted.begin(), sorted.end(), [](const Cost* a, const Cost* b) {
+    return a->seconds > b->seconds;
+  });
+  return sorted;
+}
+
+}  // anonymous namespace
+
+bool TemplateProfile::IsEnabled() {
+  return GlobalFlags().template_profile > 0 ||
+         !GlobalFlags().template_profile_json.empty();
+}
+
+void TemplateProfile::Record(const NamedDecl* decl, const Counters& counters,
+                             double seconds) {
+  auto [it, inserted] = costs_.try_emplace(decl);
+  Cost& cost = it->second;
+  if (inserted) {
+    raw_string_ostream name(cost.name);
+    decl->getNameForDiagnostic(name, DefaultPrintPolicy(), /*Qualified=*/true);
+    name.flush();
+    cost.location = PrintableLoc(GetLocation(decl));
+  }
+  ++cost.scans;
+  cost.seconds += seconds;
+  cost.counters.nodes += counters.nodes;
+  cost.counters.callee_traversals += counters.callee_traversals;
+  cost.counters.cache_hits += counters.cache_hits;
+  cost.counters.cache_misses += counters.cache_misses;
+}
+
+void TemplateProfile::PrintTop(int n, raw_ostream& os) const {
+  const vector<const Cost*> sorted = SortedByTime(costs_);
+  const size_t shown = std::min(sorted.size(), static_cast<size_t>(n));
+  os << "Template profile: " << shown << " most expensive of "
+     << sorted.size() << " scanned templates\n"
+     << "   seconds  scans      nodes  traversed  cache hits/misses"
+        "  template\n";
+  for (size_t i = 0; i < shown; ++i) {
+    const Cost& cost = *sorted[i];
+    os << llvm::format("%10.3f %6lld %10lld %10lld %10lld/%-6lld",
+                       cost.seconds, static_cast<long long>(cost.scans),
+                       static_cast<long long>(cost.counters.nodes),
+                       static_cast<long long>(cost.counters.callee_traversals),
+                       static_cast<long long>(cost.counters.cache_hits),
+                       static_cast<long long>(cost.counters.cache_misses))
+       << "  " << cost.name << " (" << cost.location << ")\n";
+  }
+}
+
+bool TemplateProfile::WriteJson(const string& filename) const {
+  std::error_code error;
+  raw_fd_ostream os(filename, error);
+  if (error) {
+    errs() << filename << ": error: " << error.message() << "\n";
+    return false;
+  }
+
+  llvm::json::OStream json(os, /*IndentSize=*/2);
+  json.array([&] {
+    for (const Cost* cost : SortedByTime(costs_)) {
+      json.object([&] {
+        json.attribute("template", cost->name);
+        json.attribute("location", cost->location);
+        json.attribute("scans", cost->scans);
+        json.attribute("seconds", cost->seconds);
+        json.attribute("nodes", cost->counters.nodes);
+        json.attribute("callee_traversals", cost->counters.callee_traversals);
+        json.attribute("cache_hits", cost->counters.cache_hits);
+        json.attribute("cache_misses", cost->counters.cache_misses);
+      });
+    }
+  });
+  os << "\n";
+  return true;
+}
+
+}  // namespace include_what_you_use
@@ -0,0 +1,76 @@
+//===--- iwyu_template_profile.h - cost of template scans, for iwyu -------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// Attributes the cost of scanning template instantiations to the
+// template each scan started from.  Enabled by --template_profile and
+// --template_profile_json; it answers "which templates made iwyu slow
+// on this file?", e.g. to decide what to add to the precomputed
+// full-use types or cover with pragmas.
+
+#ifndef INCLUDE_WHAT_YOU_USE_IWYU_TEMPLATE_PROFILE_H_
+#define INCLUDE_WHAT_YOU_USE_IWYU_TEMPLATE_PROFILE_H_
+
+#include <cstdint>                      // for int64_t
+#include <map>                          // for map
+#include <string>                       // for string
+
+namespace clang {
+class Decl;
+class NamedDecl;
+}  // namespace clang
+
+namespace llvm {
+class raw_ostream;
+}  // namespace llvm
+
+namespace include_what_you_use {
+
+using std::map;
+using std::string;
+
+class TemplateProfile {
+ public:
+  // What a single scan did.  InstantiatedTemplateVisitor counts these
+  // as it goes; callee traversals include the scanned template itself.
+  struct Counters {
+    int64_t nodes = 0;             // Decls, Stmts, Types and TypeLocs
+    int64_t callee_traversals = 0; // function and class bodies traversed
+    int64_t cache_hits = 0;        // FullUseCache replays
+    int64_t cache_misses = 0;
+  };
+
+  // Returns true if either profiling flag is set.
+  static bool IsEnabled();
+
+  // Adds the cost of one scan starting from decl.
+  void Record(const clang::NamedDecl* decl, const Counters& counters,
+              double seconds);
+
+  // Prints the n templates with the highest total scan time.
+  void PrintTop(int n, llvm::raw_ostream& os) const;
+
+  // Writes all records as a JSON array, most expensive first.  Returns
+  // false, after printing an error, if the file can't be written.
+  bool WriteJson(const string& filename) const;
+
+ private:
+  struct Cost {
+    string name;      // qualified, with template arguments
+    string location;
+    int64_t scans = 0;
+    double seconds = 0;
+    Counters counters;
+  };
+
+  map<const clang::Decl*, Cost> costs_;
+};
+
+}  // namespace include_what_you_use
+
+#endif  // INCLUDE_WHAT_YOU_USE_IWYU_TEMPLATE_PROFILE_H_
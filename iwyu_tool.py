@@ -38,8 +38,14 @@ import shlex
 import shutil
 import argparse
 import tempfile
+import threading
 import subprocess
 
+try:
+    import queue
+except ImportError:
+    import Queue as queue
+
 
 CORRECT_RE = re.compile(r'^\((.*?) has correct #includes/fwd-decls\)$')
 SHOULD_ADD_RE = re.compile(r'^(.*?) should add these lines:$')
@@ -238,12 +244,27 @@ def find_include_what_you_use():
 IWYU_EXECUTABLE = find_include_what_you_use()
 
 
+# Unit of ru_maxrss in bytes; Linux and most other systems report KiB.
+RUSAGE_MAXRSS_UNIT = 1 if sys.platform == 'darwin' else 1024
+
+
+def exit_code_from_wait_status(status):
+    """ Translate an os.wait* status into a subprocess-style exit code. """
+    if os.WIFSIGNALED(status):
+        return -os.WTERMSIG(status)
+    return os.WEXITSTATUS(status)
+
+
 class Process(object):
     """ Manages an IWYU process in flight """
     def __init__(self, proc, outfile):
         self.proc = proc
         self.outfile = outfile
         self.output = None
+        self.start_time = time.time()
+        # Resource usage, known once the process has been waited for.
+        self.wall_time = None
+        self.max_rss = None
 
     def poll(self):
         """ Return the exit code if the process has completed, None otherwise.
@@ -254,13 +275,26 @@ class Process(object):
     def returncode(self):
         return self.proc.returncode
 
+    def wait(self):
+        """ Block until the process is complete and record its resource usage.
+        """
+        if self.wall_time is None:
+            if hasattr(os, 'wait4'):
+                _, status, rusage = os.wait4(self.proc.pid, 0)
+                self.proc.returncode = exit_code_from_wait_status(status)
+                self.max_rss = rusage.ru_maxrss * RUSAGE_MAXRSS_UNIT
+            else:
+                self.proc.wait()
+            self.wall_time = time.time() - self.start_time
+        return self.proc.returncode
+
     def get_output(self):
         """ Return stdout+stderr output of the process.
 
         This call blocks until the process is complete, then returns the output.
         """
-        if not self.output:
-            self.proc.wait()
+        if self.output is None:
+            self.wait()
             self.outfile.seek(0)
             self.output = self.outfile.read().decode("utf-8")
             self.outfile.close()
@@ -286,9 +320,10 @@ KNOWN_COMPILER_WRAPPERS=frozenset([
 
 class Invocation(object):
     """ Holds arguments of an IWYU invocation. """
-    def __init__(self, command, cwd):
+    def __init__(self, command, cwd, source_file=None):
         self.command = command
         self.cwd = cwd
+        self.source_file = source_file
 
     def __str__(self):
         return ' '.join(self.command)
@@ -316,7 +351,7 @@ class Invocation(object):
             extra_args = ['--driver-mode=cl'] + extra_args
 
         command = [IWYU_EXECUTABLE] + extra_args + compile_args
-        return cls(command, entry['directory'])
+        return cls(command, entry['directory'], entry.get('file'))
 
     def start(self, verbose):
         """ Run invocation and collect output. """
@@ -382,6 +417,96 @@ def slice_compilation_db(compilation_db, selection, exclude):
     return new_db
 
 
+class History(object):
+    """ Persistent per-source-file record of IWYU wall time and peak RSS.
+
+    The history is stored as JSON, mapping each source file to the resource
+    usage of its most recent IWYU run. It is used to estimate the cost of
+    invocations before they are started.
+    """
+    def __init__(self, path=None):
+        self.path = path
+        self.entries = {}
+        if path and os.path.exists(path):
+            try:
+                with open(path, 'r') as fileobj:
+                    self.entries = json.load(fileobj)
+            except (IOError, ValueError) as why:
+                print('warning: ignoring unreadable history \'%s\': %s' %
+                      (path, why), file=sys.stderr)
+
+    def _average(self, key):
+        values = [e[key] for e in self.entries.values()
+                  if e.get(key) is not None]
+        if not values:
+            return None
+        return sum(values) / len(values)
+
+    def wall_time(self, invocation):
+        """ Return last recorded wall time for invocation, or None. """
+        return self.entries.get(invocation.source_file, {}).get('wall_time')
+
+    def max_rss(self, invocation):
+        """ Return an estimate of peak RSS in bytes for invocation.
+
+        Invocations without history are assumed to need as much memory as the
+        average recorded invocation. Returns 0 if nothing is known.
+        """
+        max_rss = self.entries.get(invocation.source_file, {}).get('max_rss')
+        if max_rss is None:
+            max_rss = self._average('max_rss')
+        return max_rss or 0
+
+    def record(self, invocation, proc):
+        """ Record resource usage of the completed proc for invocation. """
+        if not invocation.source_file or proc.wall_time is None:
+            return
+        entry = {'wall_time': proc.wall_time}
+        if proc.max_rss is not None:
+            entry['max_rss'] = proc.max_rss
+        self.entries[invocation.source_file] = entry
+
+    def save(self):
+        """ Write history back to disk, replacing the old file atomically. """
+        if not self.path:
+            return
+        tmp_path = self.path + '.tmp'
+        try:
+            with open(tmp_path, 'w') as fileobj:
+                json.dump(self.entries, fileobj, indent=1, sort_keys=True)
+            os.replace(tmp_path, self.path)
+        except (IOError, OSError) as why:
+            print('warning: failed to write history \'%s\': %s' %
+                  (self.path, why), file=sys.stderr)
+
+
+def schedule(invocations, history):
+    """ Return invocations in longest-processing-time-first order.
+
+    Invocations without history go first, since they may be arbitrarily
+    expensive. The sort is stable, so without any history the compilation
+    database order is kept.
+    """
+    def cost(invocation):
+        wall_time = history.wall_time(invocation)
+        return float('inf') if wall_time is None else wall_time
+
+    return sorted(invocations, key=cost, reverse=True)
+
+
+def parse_memory_size(value):
+    """ Parse a memory size in bytes with optional K, M or G suffix. """
+    suffixes = {'K': 1 << 10, 'M': 1 << 20, 'G': 1 << 30}
+    value = value.strip()
+    multiplier = suffixes.get(value[-1:].upper())
+    if multiplier:
+        value = value[:-1]
+    try:
+        return int(float(value) * (multiplier or 1))
+    except ValueError:
+        raise argparse.ArgumentTypeError('invalid memory size: %s' % value)
+
+
 def worst_exit_code(worst, cur):
     """Return the most extreme exit code of two.
 
@@ -402,27 +527,40 @@ def worst_exit_code(worst, cur):
         return max(worst, cur)
 
 
-def execute(invocations, verbose, formatter, jobs, max_load_average=0):
-    """ Launch processes described by invocations. """
+def execute(invocations, verbose, formatter, jobs, max_load_average=0,
+            max_memory=0, history=None):
+    """ Launch processes described by invocations.
+
+    With more than one job, invocations are started in longest-processing-
+    time-first order according to history, and an invocation is not started
+    if its estimated peak RSS would exceed max_memory bytes alongside the
+    ones already running. At least one invocation is always running.
+    """
+    history = history or History()
     exit_code = 0
     if jobs == 1:
         for invocation in invocations:
             proc = invocation.start(verbose)
             print(formatter(proc.get_output()))
             exit_code = worst_exit_code(exit_code, proc.returncode)
+            history.record(invocation, proc)
+        history.save()
         return exit_code
 
-    pending = []
-    while invocations or pending:
-        # Collect completed IWYU processes and print results.
-        complete = [proc for proc in pending if proc.poll() is not None]
-        for proc in complete:
-            pending.remove(proc)
-            print(formatter(proc.get_output()))
-            exit_code = worst_exit_code(exit_code, proc.returncode)
-
+    def wait_for_completion(invocation, proc, reserved_memory):
+        """ Block until proc is complete, then post it for collection. """
+        try:
+            proc.get_output()
+        finally:
+            completed.put((invocation, proc, reserved_memory))
+
+    invocations = schedule(invocations, history)
+    completed = queue.Queue()
+    running = 0
+    running_memory = 0
+    while invocations or running:
         # Schedule new processes if there's room.
-        capacity = jobs - len(pending)
+        capacity = jobs - running
 
         if max_load_average > 0:
             one_min_load_average, _, _ = os.getloadavg()
@@ -431,20 +569,47 @@ def execute(invocations, verbose, formatter, jobs, max_load_average=0):
                 load_capacity = 0
             if load_capacity < capacity:
                 capacity = int(load_capacity)
-                if not capacity and not pending:
+                if not capacity and not running:
                     # Ensure there is at least one job running.
                     capacity = 1
 
-        pending.extend(i.start(verbose) for i in invocations[:capacity])
-        invocations = invocations[capacity:]
+        while capacity > 0 and invocations:
+            if max_memory > 0 and running:
+                # Start the most expensive invocation that fits in the budget.
+                available = max_memory - running_memory
+                fitting = [i for i in invocations
+                           if history.max_rss(i) <= available]
+                if not fitting:
+                    break
+                invocation = fitting[0]
+            else:
+                invocation = invocations[0]
+            invocations.remove(invocation)
 
-        # Yield CPU.
-        time.sleep(0.0001)
+            reserved_memory = history.max_rss(invocation)
+            proc = invocation.start(verbose)
+            waiter = threading.Thread(target=wait_for_completion,
+                                      args=(invocation, proc, reserved_memory))
+            waiter.daemon = True
+            waiter.start()
+            running += 1
+            running_memory += reserved_memory
+            capacity -= 1
+
+        # Block until an IWYU process completes and print its results.
+        invocation, proc, reserved_memory = completed.get()
+        running -= 1
+        running_memory -= reserved_memory
+        print(formatter(proc.get_output()))
+        exit_code = worst_exit_code(exit_code, proc.returncode)
+        history.record(invocation, proc)
+
+    history.save()
     return exit_code
 
 
 def main(compilation_db_path, source_files, exclude, verbose, formatter, jobs,
-         max_load_average, extra_args):
+         max_load_average, max_memory, history_path, extra_args):
     """ Entry point. """
 
     if not IWYU_EXECUTABLE:
@@ -474,7 +639,8 @@ def main(compilation_db_path, source_files, exclude, verbose, formatter, jobs,
         Invocation.from_compile_command(e, extra_args) for e in compilation_db
     ]
 
-    return execute(invocations, verbose, formatter, jobs, max_load_average)
+    return execute(invocations, verbose, formatter, jobs, max_load_average,
+                   max_memory, History(history_path))
 
 
 def _bootstrap(sys_argv):
@@ -521,6 +687,18 @@ def _bootstrap(sys_argv):
     parser.add_argument('-l', '--load', type=float, default=0,
                         help=('Do not start new jobs if the 1min load average '
                               'is greater than the provided value'))
+    parser.add_argument('--max-memory', type=parse_memory_size, default=0,
+                        metavar='<size>',
+                        help=('Do not start new jobs if their estimated peak '
+                              'memory use, added to that of running jobs, '
+                              'would exceed this many bytes (K, M and G '
+                              'suffixes allowed). Estimates come from '
+                              '--history.'))
+    parser.add_argument('--history', metavar='<file>', default=None,
+                        dest='history_path',
+                        help=('Record wall time and peak memory use per '
+                              'source file in this file, and use it to start '
+                              'the most expensive files first.'))
     parser.add_argument('-p', metavar='<build-path>', required=True,
                         help='Compilation database path', dest='dbpath')
     parser.add_argument('-e', '--exclude', action='append', default=[],
@@ -546,7 +724,8 @@ def _bootstrap(sys_argv):
         jobs = os.cpu_count() or 1
 
     return main(args.dbpath, args.source, args.exclude, args.verbose,
-                FORMATTERS[args.output_format], jobs, args.load, extra_args)
+                FORMATTERS[args.output_format], jobs, args.load,
+                args.max_memory, args.history_path, extra_args)
 
 
 if __name__ == '__main__':
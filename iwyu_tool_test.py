@@ -13,6 +13,7 @@ import sys
 import time
 import random
 import inspect
+import tempfile
 import unittest
 import iwyu_tool
 
@@ -23,10 +24,12 @@ except ImportError:
 
 
 class MockProcess(object):
-    def __init__(self, block, content, returncode):
+    def __init__(self, block, content, returncode, max_rss=None):
         self.content = content
         self.complete_ts = time.time() + block
         self.returncode = returncode
+        self.wall_time = block
+        self.max_rss = max_rss
 
     def poll(self):
         if time.time() < self.complete_ts:
@@ -46,6 +49,7 @@ class MockInvocation(iwyu_tool.Invocation):
         self._will_return = ''
         self._will_block = 0
         self._will_returncode = 0
+        self._will_use_memory = None
 
     def will_block(self, seconds):
         self._will_block = seconds
@@ -56,9 +60,13 @@ class MockInvocation(iwyu_tool.Invocation):
     def will_returncode(self, returncode):
         self._will_returncode = returncode
 
+    def will_use_memory(self, max_rss):
+        self._will_use_memory = max_rss
+
     def start(self, verbose):
+        self.start_ts = time.time()
         return MockProcess(self._will_block, self._will_return,
-                           self._will_returncode)
+                           self._will_returncode, self._will_use_memory)
 
 
 class MockIwyuToolMain(object):
@@ -86,10 +94,12 @@ class MockIwyuToolMain(object):
 
 
 class IWYUToolTests(unittest.TestCase):
-    def _execute(self, invocations, verbose=False, formatter=None, jobs=1):
+    def _execute(self, invocations, verbose=False, formatter=None, jobs=1,
+                 max_memory=0, history=None):
         formatter = formatter or iwyu_tool.DEFAULT_FORMAT
         formatter = iwyu_tool.FORMATTERS.get(formatter, formatter)
-        return iwyu_tool.execute(invocations, verbose, formatter, jobs)
+        return iwyu_tool.execute(invocations, verbose, formatter, jobs,
+                                 max_memory=max_memory, history=history)
 
     def setUp(self):
         self.stdout_stub = StringIO()
@@ -214,6 +224,60 @@ class IWYUToolTests(unittest.TestCase):
             invocation.will_returncode(exit_code)
         self.assertEqual(self._execute(invocations), -1)
 
+    def test_schedule_longest_first(self):
+        history = iwyu_tool.History()
+        invocations = [MockInvocation(cwd=str(n)) for n in range(4)]
+        for n, invocation in enumerate(invocations):
+            invocation.source_file = 'file%d.cc' % n
+        history.entries = {'file0.cc': {'wall_time': 1.0},
+                           'file1.cc': {'wall_time': 5.0},
+                           'file3.cc': {'wall_time': 3.0}}
+        # Files without history are assumed to be the most expensive.
+        self.assertEqual(['file2.cc', 'file1.cc', 'file3.cc', 'file0.cc'],
+                         [i.source_file for i in
+                          iwyu_tool.schedule(invocations, history)])
+
+    def test_history_records_usage(self):
+        invocations = [MockInvocation() for _ in range(3)]
+        for n, invocation in enumerate(invocations):
+            invocation.source_file = 'file%d.cc' % n
+            invocation.will_block(n / 100)
+            invocation.will_use_memory(n * 1000)
+        history = iwyu_tool.History()
+        self._execute(invocations, jobs=2, history=history)
+        self.assertEqual({'wall_time': 0.02, 'max_rss': 2000},
+                         history.entries['file2.cc'])
+        self.assertEqual(1000, history.max_rss(invocations[1]))
+        # Unknown files are estimated from the average of known ones.
+        self.assertEqual(1000, history.max_rss(MockInvocation()))
+
+    def test_history_persists(self):
+        path = os.path.join(tempfile.mkdtemp(), 'history.json')
+        history = iwyu_tool.History(path)
+        history.entries = {'file.cc': {'wall_time': 2.5, 'max_rss': 100}}
+        history.save()
+        self.assertEqual(history.entries, iwyu_tool.History(path).entries)
+
+    def test_max_memory_admission(self):
+        history = iwyu_tool.History()
+        invocations = [MockInvocation() for _ in range(3)]
+        for n, invocation in enumerate(invocations):
+            invocation.source_file = 'file%d.cc' % n
+            invocation.will_block(0.05)
+            history.entries[invocation.source_file] = {
+                'wall_time': 3 - n, 'max_rss': 600}
+        self._execute(invocations, jobs=3, max_memory=1000, history=history)
+        # Only one 600 byte job fits in the budget at a time.
+        start_times = sorted(i.start_ts for i in invocations)
+        self.assertGreaterEqual(start_times[1] - start_times[0], 0.04)
+        self.assertGreaterEqual(start_times[2] - start_times[1], 0.04)
+
+    def test_parse_memory_size(self):
+        self.assertEqual(100, iwyu_tool.parse_memory_size('100'))
+        self.assertEqual(2048, iwyu_tool.parse_memory_size('2K'))
+        self.assertEqual(3 << 20, iwyu_tool.parse_memory_size('3m'))
+        self.assertEqual(1 << 29, iwyu_tool.parse_memory_size('0.5G'))
+
     @unittest.skipIf(sys.platform.startswith('win'), "POSIX only")
     def test_is_subpath_of_posix(self):
         self.assertTrue(iwyu_tool.is_subpath_of('/a/b/c.c', '/a/b'))
@@ -342,6 +406,14 @@ class BootstrapTests(unittest.TestCase):
         self.assertEqual(12, self.main.call_args['jobs'])
         self.assertEqual([], self.main.call_args['extra_args'])
 
+    def test_scheduling_args(self):
+        """ Scheduling arguments are forwarded to main. """
+        argv = ['iwyu_tool.py', '-p', '.', '--max-memory', '4G',
+                '--history', 'h.json']
+        iwyu_tool._bootstrap(argv)
+        self.assertEqual(4 << 30, self.main.call_args['max_memory'])
+        self.assertEqual('h.json', self.main.call_args['history_path'])
+
     def test_extra_args(self):
         """ Extra arguments after '--' are forwarded to main. """
         argv = ['iwyu_tool.py', '-p', '.', '--', '-extra1', '-extra2']
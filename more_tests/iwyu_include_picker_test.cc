@@ -154,6 +154,18 @@ TEST(DynamicMapping, MultipleTransitiveMapping) {
       "\"project/public/baz.h\"");
 }
 
+TEST(DynamicMapping, CyclicTransitiveMapping) {
+  IncludePicker p;
+  p.AddMapping("\"project/a.h\"", "\"project/b.h\"");
+  p.AddMapping("\"project/b.h\"", "\"project/a.h\"");
+  p.AddMapping("\"project/b.h\"", "\"project/c.h\"");
+  p.MarkIncludeAsPrivate("\"project/a.h\"");
+  p.FinalizeAddedIncludes();
+  EXPECT_VECTOR_STREQ(
+      p.GetCandidateHeadersForFilepath("project/a.h"),
+      "\"project/b.h\"", "\"project/c.h\"");
+}
+
 TEST(DynamicMapping, NormalizesAsm) {
   IncludePicker p;
   p.AddDirectInclude("/usr/include/types.h",
@@ -7,9 +7,11 @@
 //
 //===----------------------------------------------------------------------===//
 
-// IWYU_ARGS: -Xiwyu --check_also="tests/cxx/*-d1.h" -I .
+// IWYU_ARGS: -Xiwyu --check_also="tests/cxx/*-d1.h" \
+//            -Xiwyu --check_also="tests/cxx/[z-a]*" -I .
 
-// Tests the '--check_also' flag.
+// Tests the '--check_also' flag.  The second glob has a range that is not
+// valid in a regex, and matches nothing.
 
 #include "check_also-d1.h"   // part of the --check-also glob
 #include "check_also-n1.h"   // not part of the --check-also glob
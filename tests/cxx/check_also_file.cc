@@ -0,0 +1,34 @@
+//===--- check_also_file.cc - test input file for iwyu --------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// IWYU_ARGS: -Xiwyu --check_also_file=tests/cxx/check_also_file.globs -I .
+
+// Tests the '--check_also_file' flag.
+
+#include "check_also_file-d1.h"  // matches a glob in check_also_file.globs
+#include "check_also-n1.h"       // not matched by any of them
+
+int main() {
+  // IWYU: kI1 is...*check_also-i1.h
+  return kI1;
+}
+
+/**** IWYU_SUMMARY
+
+tests/cxx/check_also_file.cc should add these lines:
+#include "tests/cxx/check_also-i1.h"
+
+tests/cxx/check_also_file.cc should remove these lines:
+- #include "check_also-n1.h"  // lines XX-XX
+- #include "check_also_file-d1.h"  // lines XX-XX
+
+The full include-list for tests/cxx/check_also_file.cc:
+#include "tests/cxx/check_also-i1.h"  // for kI1
+
+***** IWYU_SUMMARY */
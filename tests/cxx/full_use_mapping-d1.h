@@ -0,0 +1,37 @@
+//===--- full_use_mapping-d1.h - test input file for iwyu -----------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef INCLUDE_WHAT_YOU_USE_TESTS_CXX_FULL_USE_MAPPING_D1_H_
+#define INCLUDE_WHAT_YOU_USE_TESTS_CXX_FULL_USE_MAPPING_D1_H_
+
+#include "tests/cxx/full_use_mapping-i1.h"
+
+namespace lib {
+
+// Neither template needs its argument to be complete, so only the
+// full_use mapping makes a full use of it.
+template <typename T>
+class FlatSet {
+  T* data;
+  int size;
+};
+
+template <typename T, int N>
+class SmallVector {
+  T* data;
+};
+
+template <typename T, int N>
+class InlinedArray {
+  T* data;
+};
+
+}  // namespace lib
+
+#endif  // INCLUDE_WHAT_YOU_USE_TESTS_CXX_FULL_USE_MAPPING_D1_H_
@@ -0,0 +1,15 @@
+//===--- full_use_mapping-i1.h - test input file for iwyu -----------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef INCLUDE_WHAT_YOU_USE_TESTS_CXX_FULL_USE_MAPPING_I1_H_
+#define INCLUDE_WHAT_YOU_USE_TESTS_CXX_FULL_USE_MAPPING_I1_H_
+
+class IndirectClass {};
+
+#endif  // INCLUDE_WHAT_YOU_USE_TESTS_CXX_FULL_USE_MAPPING_I1_H_
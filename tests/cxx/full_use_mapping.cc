@@ -0,0 +1,49 @@
+//===--- full_use_mapping.cc - test input file for iwyu -------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// IWYU_ARGS: -Xiwyu --mapping_file=tests/cxx/full_use_mapping.imp -I .
+
+// Tests the full_use mapping directive.
+
+#include "tests/cxx/full_use_mapping-d1.h"
+
+// The mapping makes this a full use, like std::set<IndirectClass>.
+// IWYU: IndirectClass needs a declaration
+// IWYU: IndirectClass is...*full_use_mapping-i1.h
+lib::FlatSet<IndirectClass> flat_set;
+
+// Templates with non-type arguments are not supported, so the mapping is
+// ignored, with a warning, rather than aborting the analysis.
+// IWYU~: ignoring full_use mapping for lib::SmallVector
+// IWYU: IndirectClass needs a declaration
+lib::SmallVector<IndirectClass, 4> small_vector;
+
+// The same holds when the template is first seen as a dependent type, with
+// no template arguments to check.
+// IWYU~: ignoring full_use mapping for lib::InlinedArray
+template <typename T>
+struct UsesInlinedArray {
+  lib::InlinedArray<T, 2> array;
+};
+
+// IWYU: IndirectClass needs a declaration
+lib::InlinedArray<IndirectClass, 2> inlined_array;
+
+/**** IWYU_SUMMARY
+
+tests/cxx/full_use_mapping.cc should add these lines:
+#include "tests/cxx/full_use_mapping-i1.h"
+
+tests/cxx/full_use_mapping.cc should remove these lines:
+
+The full include-list for tests/cxx/full_use_mapping.cc:
+#include "tests/cxx/full_use_mapping-d1.h"  // for FlatSet, InlinedArray, SmallVector
+#include "tests/cxx/full_use_mapping-i1.h"  // for IndirectClass
+
+***** IWYU_SUMMARY */
@@ -0,0 +1,54 @@
+//===--- scan_budget.cc - test input file for iwyu ------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// IWYU_ARGS: -Xiwyu --max_scan_nodes=1 -I .
+
+// Tests that a template instantiation whose scan runs out of budget
+// has its template arguments reported as fully used, and that this is
+// only warned about once per instantiation.
+
+#include "tests/cxx/direct.h"
+
+// A full scan would find that T is only used by pointer.
+template <typename T>
+class PtrHolder {
+  T* ptr;
+  int size;
+};
+
+void Fn() {
+  // IWYU: scan of .*PtrHolder.* stopped by --max_scan_nodes
+  // IWYU: IndirectClass needs a declaration
+  // IWYU: IndirectClass is...*indirect.h
+  (void)sizeof(PtrHolder<IndirectClass>);
+
+  // The earlier scan ran out of budget, so this one gives up right
+  // away, and without a second warning.
+  // IWYU: IndirectClass needs a declaration
+  // IWYU: IndirectClass is...*indirect.h
+  (void)sizeof(PtrHolder<IndirectClass>);
+
+  // Pointers are never fully used, even when the budget is spent.
+  // IWYU: scan of .*PtrHolder.* stopped by --max_scan_nodes
+  // IWYU: IndirectClass needs a declaration
+  (void)sizeof(PtrHolder<IndirectClass*>);
+}
+
+/**** IWYU_SUMMARY
+
+tests/cxx/scan_budget.cc should add these lines:
+#include "tests/cxx/indirect.h"
+
+tests/cxx/scan_budget.cc should remove these lines:
+- #include "tests/cxx/direct.h"  // lines XX-XX
+
+The full include-list for tests/cxx/scan_budget.cc:
+#include "tests/cxx/indirect.h"  // for IndirectClass
+
+***** IWYU_SUMMARY */
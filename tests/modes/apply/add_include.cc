@@ -0,0 +1,9 @@
+// Analyzed with --check_also=lib/no_includes.h, which gets lib/used.h
+// added after its license header and header guard.
+
+#include "lib/used.h"
+#include "lib/no_includes.h"
+
+int main() {
+  return Used() + UsesUsed();
+}
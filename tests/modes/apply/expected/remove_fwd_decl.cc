@@ -0,0 +1,14 @@
+// Unused, ns::Gone and ns2::Dropped are removed, and with them namespace
+// ns, which is left empty.
+
+#include "lib/used.h"
+
+namespace ns2 {
+class Kept;
+}  // namespace ns2
+
+ns2::Kept* kept;
+
+int main() {
+  return Used();
+}
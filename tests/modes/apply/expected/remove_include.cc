@@ -0,0 +1,7 @@
+// lib/unused.h is removed.
+
+#include "lib/used.h"
+
+int main() {
+  return Used();
+}
@@ -0,0 +1,20 @@
+//===--- no_includes.h - test input file for iwyu -------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// Uses Used() without including lib/used.h; add_include.cc includes it
+// first.
+
+#ifndef LIB_NO_INCLUDES_H_
+#define LIB_NO_INCLUDES_H_
+
+inline int UsesUsed() {
+  return Used();
+}
+
+#endif  // LIB_NO_INCLUDES_H_
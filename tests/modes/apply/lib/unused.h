@@ -0,0 +1,6 @@
+#ifndef LIB_UNUSED_H_
+#define LIB_UNUSED_H_
+
+int Unused();
+
+#endif  // LIB_UNUSED_H_
@@ -0,0 +1,6 @@
+#ifndef LIB_USED_H_
+#define LIB_USED_H_
+
+int Used();
+
+#endif  // LIB_USED_H_
@@ -0,0 +1,21 @@
+// Unused, ns::Gone and ns2::Dropped are removed, and with them namespace
+// ns, which is left empty.
+
+#include "lib/used.h"
+
+class Unused;
+
+namespace ns {
+class Gone;
+}  // namespace ns
+
+namespace ns2 {
+class Dropped;
+class Kept;
+}  // namespace ns2
+
+ns2::Kept* kept;
+
+int main() {
+  return Used();
+}
@@ -0,0 +1,8 @@
+// lib/unused.h is removed.
+
+#include "lib/unused.h"
+#include "lib/used.h"
+
+int main() {
+  return Used();
+}
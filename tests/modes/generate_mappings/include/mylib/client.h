@@ -0,0 +1,8 @@
+#ifndef MYLIB_CLIENT_H_
+#define MYLIB_CLIENT_H_
+
+#include "mylib/internal/client_impl.h"
+#include "mylib/internal/shared.h"
+#include "other/util.h"  // outside mylib/, not mapped
+
+#endif  // MYLIB_CLIENT_H_
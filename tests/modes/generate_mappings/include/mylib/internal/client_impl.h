@@ -0,0 +1,6 @@
+#ifndef MYLIB_INTERNAL_CLIENT_IMPL_H_
+#define MYLIB_INTERNAL_CLIENT_IMPL_H_
+
+class Client {};
+
+#endif  // MYLIB_INTERNAL_CLIENT_IMPL_H_
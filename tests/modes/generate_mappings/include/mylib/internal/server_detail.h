@@ -0,0 +1,8 @@
+#ifndef MYLIB_INTERNAL_SERVER_DETAIL_H_
+#define MYLIB_INTERNAL_SERVER_DETAIL_H_
+
+// IWYU pragma: private, include "mylib/types.h"
+
+class Server {};
+
+#endif  // MYLIB_INTERNAL_SERVER_DETAIL_H_
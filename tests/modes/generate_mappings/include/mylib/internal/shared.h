@@ -0,0 +1,8 @@
+#ifndef MYLIB_INTERNAL_SHARED_H_
+#define MYLIB_INTERNAL_SHARED_H_
+
+// Included by both entry headers, so mapped to both.
+
+class Connection {};
+
+#endif  // MYLIB_INTERNAL_SHARED_H_
@@ -0,0 +1,7 @@
+#ifndef MYLIB_SERVER_H_
+#define MYLIB_SERVER_H_
+
+#include "mylib/internal/server_detail.h"
+#include "mylib/internal/shared.h"
+
+#endif  // MYLIB_SERVER_H_
@@ -0,0 +1,6 @@
+#ifndef OTHER_UTIL_H_
+#define OTHER_UTIL_H_
+
+class Util {};
+
+#endif  // OTHER_UTIL_H_
@@ -0,0 +1,4 @@
+// The entry headers of mylib.
+
+#include "mylib/client.h"
+#include "mylib/server.h"
@@ -0,0 +1,11 @@
+#ifndef LIB_A_H_
+#define LIB_A_H_
+
+#include "lib/b.h"
+#include "lib/d.h"
+
+class A {
+  C c;
+};
+
+#endif  // LIB_A_H_
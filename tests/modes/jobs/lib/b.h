@@ -0,0 +1,10 @@
+#ifndef LIB_B_H_
+#define LIB_B_H_
+
+#include "lib/c.h"
+
+class B {
+  D d;
+};
+
+#endif  // LIB_B_H_
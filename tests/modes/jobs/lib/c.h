@@ -0,0 +1,10 @@
+#ifndef LIB_C_H_
+#define LIB_C_H_
+
+#include "lib/d.h"
+
+class C {
+  D d;
+};
+
+#endif  // LIB_C_H_
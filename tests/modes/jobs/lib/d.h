@@ -0,0 +1,6 @@
+#ifndef LIB_D_H_
+#define LIB_D_H_
+
+class D {};
+
+#endif  // LIB_D_H_
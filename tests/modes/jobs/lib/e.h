@@ -0,0 +1,11 @@
+#ifndef LIB_E_H_
+#define LIB_E_H_
+
+class D;
+class Unused;
+
+class E {
+  D* d;
+};
+
+#endif  // LIB_E_H_
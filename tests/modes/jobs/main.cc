@@ -0,0 +1,9 @@
+// Analyzed with --check_also=lib/*.h, so every header below gets its own
+// report.  Only the headers in lib/ can be computed in forked processes.
+
+#include "main.h"
+#include "lib/e.h"
+
+B b;
+C c;
+E e;
@@ -0,0 +1,10 @@
+#ifndef MAIN_H_
+#define MAIN_H_
+
+#include "lib/a.h"
+
+class Main {
+  A a;
+};
+
+#endif  // MAIN_H_
@@ -0,0 +1,8 @@
+#ifndef BAR_PRIVATE_H_
+#define BAR_PRIVATE_H_
+
+// IWYU pragma: private, include "bar.h"
+
+class Bar {};
+
+#endif  // BAR_PRIVATE_H_
@@ -0,0 +1,6 @@
+#ifndef BAR_H_
+#define BAR_H_
+
+#include "bar-private.h"  // IWYU pragma: export
+
+#endif  // BAR_H_
@@ -0,0 +1,6 @@
+#ifndef FOO_H_
+#define FOO_H_
+
+class Foo {};
+
+#endif  // FOO_H_
@@ -0,0 +1,6 @@
+// Uses Foo and Bar from the prefix header without including them.
+
+#include "unused.h"
+
+Foo foo;
+Bar bar;
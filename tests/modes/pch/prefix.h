@@ -0,0 +1,4 @@
+// The prefix header the PCH is built from.
+
+#include "foo.h"
+#include "bar.h"
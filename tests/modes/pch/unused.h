@@ -0,0 +1,6 @@
+#ifndef UNUSED_H_
+#define UNUSED_H_
+
+class Unused {};
+
+#endif  // UNUSED_H_